@@ -1,72 +1,508 @@
-#include "client_utils.h" // Client specific headers
+#include "client_utils.h"         // Client specific headers
+#include "load_balancer.h"        // Server lists (power of two choices, hedged requests)
+#include "../network/tcp_stats.h" // --tcp-info sampling
 
 #include <fcntl.h> // Socket mode control - setting non-blocking (fcntl)
+#include <poll.h>  // Wait on a request and its hedge at once (poll)
+#include <chrono>  // Time to first grid row (steady_clock)
+#include <cstdio>  // Write grid CSV (fopen, fwrite)
+#include <algorithm> // Count received grid rows (count)
+#include <random>  // Request ids for --tcp-info (random_device)
 
-const int RETRY_INTERVAL = 1;          // Retry interval in seconds
-const int MAX_RETRIES = 10;            // Limit retries to avoid infinite loop
-const int RESPONSE_BUFFER_SIZE = 1024; // Server response buffer size in bytes
+const int RETRY_INTERVAL = 1;           // Retry interval in seconds
+const int MAX_RETRIES = 10;             // Limit retries to avoid infinite loop
+const int RESPONSE_BUFFER_SIZE = 32768; // Server response buffer size in bytes (fits a full *_BATCH response or SCHEDULE)
+const int GRID_BUFFER_SIZE = 1 << 16;   // Grid stream buffer size in bytes (64 KiB)
 
-int attempt_new_TCP_connection(const sockaddr_in &serverAddress);                // Attempt TCP socket connection with timeout
-int attempt_send(int c_socket, string &message, int flags = 0);                  // Sending message to server host via TCP
-int await_and_display_server_response(int c_socket, sockaddr_in &clientAddress); // Handle response or no response from server
+int attempt_new_TCP_connection(const sockaddr_in &serverAddress);                                     // Attempt TCP socket connection with timeout
+int attempt_send(int c_socket, string &message, int flags = 0);                                       // Sending message to server host via TCP
+int await_and_display_server_response(int c_socket, sockaddr_in &clientAddress, int &retry_after_ms); // Handle response or no response from server
+int receive_grid_csv(int c_socket, const string &csv_path, long expected_lines, int &retry_after_ms); // Stream a GRID response into a CSV file (or stdout)
+int run_request(const sockaddr_in &serverAddress, const char *server_name, string message, long grid_lines, const string &csv_path, bool tcp_info, tcp_sample &sample); // Connect, send and receive once (grid_lines: CSV lines of a GRID response, 0 otherwise)
+int run_hedged_request(load_balancer &balancer, const string &message, bool tcp_info, tcp_sample &sample); // Same through a server list, hedged to a second replica when slow
+
+// One connection of a hedged request
+struct tcp_attempt
+{
+    int socket = -1;           // Non-blocking, -1 when not in use
+    int replica = -1;          // Index in the load balancer
+    bool hedge = false;        // Sent because the first attempt was slow
+    uint64_t start_us = 0;     // connect() called
+    uint64_t connected_us = 0; // Connection established, 0 while connecting
+    size_t sent = 0;           // Bytes of the request sent
+    string response;           // Bytes received so far (the server closes after the response)
+};
 
 int main(int argc, char *argv[])
 {
+    client_options options; // --tcp-info, --repeat <n>, --hedge-budget <fraction>, server list
+    if (extract_client_options(argc, argv, options) != 0)
+    {
+        return 1; // Exit program
+    }
+
     sockaddr_in serverAddress{}; // IPv4 Server address and port setup
-    // Validate ALL arguments <ip> <amount> <years> <rate>
-    if (validate_command_line_arguments(argc, argv, serverAddress) != 0)
+    string message;              // Message sent to the server once connected
+    string csv_path;             // Only used with --grid
+    grid_request grid;           // Only used with --grid
+    const bool GRID_MODE = argc > 2 && string(argv[2]) == "--grid";
+    const int SOLVER_MODE = GRID_MODE ? 1 : validate_solver_arguments(argc, argv, serverAddress, message); // 0 when a --principal/--rate mode was given
+    if (GRID_MODE)
+    {
+        // Validate <ip> --grid <amounts> <rates> <years> [--csv <file>]
+        if (validate_grid_arguments(argc, argv, serverAddress, message, csv_path, grid) != 0)
+        {
+            return 1; // Exit program
+        }
+    }
+    else if (SOLVER_MODE == -1)
+    {
+        return 1; // Exit program
+    }
+    else if (SOLVER_MODE == 1)
+    {
+        // Validate ALL arguments <ip> <amount> <years> <rate>
+        if (validate_command_line_arguments(argc, argv, serverAddress) != 0)
+        {
+            return 1; // Exit program
+        }
+        message = string(argv[2]) + " " + argv[3] + " " + argv[4]; // Message with validated arguments <amount> <ip> <rate>
+    }
+    const long GRID_LINES = GRID_MODE ? grid.amount_count() * grid.term_count * grid.rate_count() + 1 : 0; // Every row plus the CSV header
+
+    // One server keeps the plain path, a list of replicas goes through the load balancer
+    load_balancer balancer;
+    if (!options.servers.empty() && load_replicas(options.servers, balancer) != 0)
     {
         return 1; // Exit program
     }
+    if (options.hedge_budget >= 0)
+    {
+        balancer.hedge_budget = options.hedge_budget;
+    }
+    const bool BALANCED = balancer.replicas.size() > 1;
 
-    sockaddr_in clientAddress; // Used to get port number that client listens on for server response (for logging)
+    // Every run is a new connection, like the server expects (one request per connection)
+    // With --tcp-info each run carries a request id that the server logs next to its own TCP_INFO outliers
+    random_device random;   // Request ids
+    tcp_stats network;      // TCP_INFO of every run (with --tcp-info)
+    log2_histogram latency; // Application latency of every successful run in microseconds
+    int failures = 0;       // Runs without a response
+    int status = 0;         // Exit status
+    for (int run = 0; run < options.repeat; run++)
+    {
+        tcp_sample sample;
+        sample.request_id = ((uint64_t)random() << 32) | random();
+        const string request = options.tcp_info ? REQUEST_ID_COMMAND + " " + to_string(sample.request_id) + " " + message : message;
+        int result;
+        if (!BALANCED)
+        {
+            result = run_request(serverAddress, argv[1], request, GRID_LINES, csv_path, options.tcp_info, sample);
+        }
+        else if (GRID_MODE)
+        {
+            // A grid streams into the CSV as it arrives, so it goes to one picked replica and is never hedged
+            const int replica = balancer.pick();
+            char host[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &balancer.replicas[replica].address.sin_addr, host, sizeof(host));
+            balancer.start_request();
+            balancer.sent(replica);
+            result = run_request(balancer.replicas[replica].address, host, request, GRID_LINES, csv_path, options.tcp_info, sample);
+            result == 0 ? balancer.answered(replica, sample.total_us) : balancer.failed(replica);
+            balancer.finish_request(result == 0, sample.total_us);
+        }
+        else
+        {
+            result = run_hedged_request(balancer, request, options.tcp_info, sample);
+        }
+        if (result == 1)
+        {
+            status = 1; // Could not connect, the server is gone
+            break;
+        }
+        if (result != 0)
+        {
+            failures++;
+            continue;
+        }
+        latency.add(sample.total_us);
+        if (options.tcp_info)
+        {
+            if (network.add(sample))
+            {
+                log("WARNING", "TCP outlier", describe_sample(sample));
+            }
+            else
+            {
+                log("INFO", "TCP_INFO", describe_sample(sample));
+            }
+        }
+    }
+
+    // Per-run summary: what the application saw next to what the kernel saw
+    if (options.repeat > 1 || options.tcp_info)
+    {
+        log("INFO", "Application latency (us)", to_string(latency.count) + " ok, " + to_string(failures) + " failed | p50 " + to_string(latency.percentile(50)) +
+                                                     " p90 " + to_string(latency.percentile(90)) + " p99 " + to_string(latency.percentile(99)) + " max " + to_string(latency.max));
+    }
+    if (options.tcp_info && network.samples > 0)
+    {
+        log("INFO", "Network quality", network.summary());
+    }
+    if (BALANCED)
+    {
+        balancer.log_summary();
+    }
+    return status; // Exit program
+}
+
+// Start a non-blocking connection to a replica
+// Return 0 when connecting, -1 on fail (refused right away)
+static int start_attempt(tcp_attempt &attempt, load_balancer &balancer, int replica, bool hedge)
+{
+    attempt = tcp_attempt();
+    attempt.replica = replica;
+    attempt.hedge = hedge;
+    attempt.start_us = monotonic_us();
+    balancer.sent(replica);
+    attempt.socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (attempt.socket == -1 ||
+        (connect(attempt.socket, (sockaddr *)&balancer.replicas[replica].address, sizeof(sockaddr_in)) == -1 && errno != EINPROGRESS))
+    {
+        log("ERROR", "Connection failed", balancer.describe(replica) + ": " + strerror(errno));
+        return -1; // Fail
+    }
+    return 0; // Success
+}
+
+static void close_attempt(tcp_attempt &attempt)
+{
+    if (attempt.socket != -1)
+    {
+        close(attempt.socket);
+        attempt.socket = -1;
+    }
+}
+
+// Move one attempt forward after poll(): finish connecting, send what's left of the request, read what arrived
+// Return 0 while in progress, 1 once the server closed the connection (response complete), -1 on fail
+static int advance_attempt(tcp_attempt &attempt, const string &request, short revents)
+{
+    if (attempt.connected_us == 0)
+    {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(attempt.socket, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error != 0)
+        {
+            errno = error;
+            return -1; // Fail
+        }
+        if (!(revents & (POLLOUT | POLLIN)))
+        {
+            return 0; // Still connecting
+        }
+        attempt.connected_us = monotonic_us();
+    }
+    while (attempt.sent < request.size())
+    {
+        ssize_t sent = send(attempt.socket, request.data() + attempt.sent, request.size() - attempt.sent, MSG_NOSIGNAL);
+        if (sent == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return 0;
+            return -1; // Fail
+        }
+        attempt.sent += sent;
+    }
+    char buffer[RESPONSE_BUFFER_SIZE];
+    while (true)
+    {
+        ssize_t received = recv(attempt.socket, buffer, sizeof(buffer), 0);
+        if (received == 0)
+            return 1; // Response complete
+        if (received > 0)
+        {
+            attempt.response.append(buffer, received);
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return 0;
+        return -1; // Fail
+    }
+}
+
+// Send message to the replica the load balancer picks, hedge it to a second replica once the hedge delay passes
+// without an answer (if the budget allows), and use whichever answer completes first
+// - A replica that refuses, resets or answers BUSY is replaced by another one right away, up to MAX_RETRIES attempts,
+//   after every replica failed once in a row the client waits RETRY_INTERVAL like the single server path
+// - OVERLOADED <ms> is handled the same way except that the wait is the server's hint and the attempt doesn't count against MAX_RETRIES
+// - The losing connection is closed, its elapsed time still counts against its replica
+// Return 0 on success, -1 if there was no valid response, 1 if no replica accepted a connection
+int run_hedged_request(load_balancer &balancer, const string &message, bool tcp_info, tcp_sample &sample)
+{
+    const string request = message + MESSAGE_TERMINATOR;
+    const uint64_t START_US = monotonic_us();
+    const uint64_t DEADLINE_US = START_US + (uint64_t)MAX_RETRIES * RETRY_INTERVAL * 1000000;
+    balancer.start_request();
+
+    tcp_attempt attempts[2];  // The request and its hedge
+    int launched = 0;         // Attempts started, hedges excluded
+    int failures = 0;         // Attempts failed so far
+    int shed = 0;             // Attempts answered OVERLOADED (not counted against MAX_RETRIES)
+    int retry_after_ms = -1;  // Hint of the last failed attempt, -1 unless it was OVERLOADED
+    int last_failed = -1;     // Replica of the last failed attempt, avoided by the next pick
+    bool connected = false;   // Some replica accepted a connection
+    bool hedge_due = false;   // Hedge delay passed for the current attempt
+    uint64_t hedge_at_us = 0; // When to hedge the current attempt
+    int winner = -1;          // Attempt whose answer is used
+
+    while (winner == -1)
+    {
+        uint64_t now = monotonic_us();
+        // Keep one attempt running: the first one, or a replacement for one that failed
+        if (attempts[0].socket == -1 && attempts[1].socket == -1)
+        {
+            if (launched - shed >= MAX_RETRIES || now >= DEADLINE_US)
+            {
+                break;
+            }
+            if (failures > 0 && failures % (int)balancer.replicas.size() == 0)
+            {
+                // Every replica failed, give them time (hot restart, overload), or as long as the last one asked if it shed the request
+                const int wait_ms = retry_after_ms >= 0 ? retry_wait_ms(retry_after_ms, DEADLINE_US - now) : RETRY_INTERVAL * 1000;
+                if (wait_ms == -1)
+                {
+                    log("WARNING", "Giving up", "Still overloaded too close to the deadline");
+                    break;
+                }
+                usleep(wait_ms * 1000);
+            }
+            int replica = balancer.pick(last_failed);
+            launched++;
+            if (start_attempt(attempts[0], balancer, replica == -1 ? balancer.pick() : replica, false) != 0)
+            {
+                balancer.failed(attempts[0].replica);
+                last_failed = attempts[0].replica;
+                failures++;
+                retry_after_ms = -1;
+                close_attempt(attempts[0]);
+                continue;
+            }
+            hedge_due = false;
+            hedge_at_us = monotonic_us() + balancer.hedge_delay_us();
+        }
+
+        // Hedge once the delay passed without an answer
+        if (!hedge_due && now >= hedge_at_us)
+        {
+            hedge_due = true;
+            tcp_attempt &first = attempts[0].socket != -1 ? attempts[0] : attempts[1];
+            tcp_attempt &spare = attempts[0].socket != -1 ? attempts[1] : attempts[0];
+            const int replica = balancer.pick(first.replica);
+            if (spare.socket == -1 && replica != -1 && balancer.take_hedge())
+            {
+                log("WARNING", "Hedging request", "no answer from " + balancer.describe(first.replica) + " after " + to_string(now - first.start_us) + " us, also sent to " + balancer.describe(replica));
+                if (start_attempt(spare, balancer, replica, true) != 0)
+                {
+                    balancer.failed(replica);
+                    close_attempt(spare);
+                }
+            }
+        }
+
+        // Wait on both connections until one makes progress, the hedge is due or the deadline passes
+        pollfd fds[2];
+        int owners[2];
+        int count = 0;
+        for (int i = 0; i < 2; i++)
+        {
+            if (attempts[i].socket != -1)
+            {
+                fds[count].fd = attempts[i].socket;
+                fds[count].events = attempts[i].connected_us == 0 || attempts[i].sent < request.size() ? POLLOUT : POLLIN;
+                fds[count].revents = 0;
+                owners[count++] = i;
+            }
+        }
+        const uint64_t wake_us = hedge_due ? DEADLINE_US : min(hedge_at_us, DEADLINE_US);
+        now = monotonic_us();
+        const int timeout_ms = wake_us > now ? (int)((wake_us - now + 999) / 1000) : 0;
+        if (poll(fds, count, timeout_ms) == -1 && errno != EINTR)
+        {
+            log("ERROR", "poll() failed", strerror(errno));
+            break;
+        }
 
-    int c_socket = -1; // Initialize socket variable for access outside while loop
+        for (int n = 0; n < count && winner == -1; n++)
+        {
+            if (fds[n].revents == 0)
+                continue;
+            tcp_attempt &attempt = attempts[owners[n]];
+            int progress = advance_attempt(attempt, request, fds[n].revents);
+            connected = connected || attempt.connected_us != 0;
+            int hint = -1; // OVERLOADED hint of this attempt
+            if (progress == -1)
+            {
+                log("ERROR", "Request failed", balancer.describe(attempt.replica) + ": " + strerror(errno));
+            }
+            else if (progress == 1 && (attempt.response.empty() || attempt.response == BUSY_RESPONSE))
+            {
+                log("WARNING", attempt.response.empty() ? "Connection closed by server" : "Server busy", balancer.describe(attempt.replica));
+                progress = -1;
+            }
+            else if (progress == 1 && parse_overloaded(attempt.response, hint) == 0)
+            {
+                log("WARNING", "Server overloaded", balancer.describe(attempt.replica) + " asks to retry after " + to_string(hint) + " ms");
+                shed += attempt.hedge ? 0 : 1;
+                progress = -1;
+            }
+            if (progress == -1)
+            {
+                balancer.failed(attempt.replica);
+                last_failed = attempt.replica;
+                failures++;
+                retry_after_ms = hint;
+                close_attempt(attempt);
+            }
+            else if (progress == 1)
+            {
+                winner = owners[n];
+            }
+        }
+        if (winner == -1 && monotonic_us() >= DEADLINE_US)
+        {
+            break;
+        }
+    }
 
-    // Attempt to connect via TCP to server on a new socket each iteration
-    int retries = 0;
-    while (retries < MAX_RETRIES)
+    const uint64_t END_US = monotonic_us();
+    sample.total_us = END_US - START_US;
+    if (winner == -1)
     {
-        c_socket = attempt_new_TCP_connection(serverAddress); // Create new TCP socket
-        if (c_socket != -1)
+        for (tcp_attempt &attempt : attempts)
         {
-            log("INFO", "Connected to server", string(argv[1]) + ":" + to_string(SERVER_PORT));
-            // Gets the local address and port assigned to client socket (used for logging later)
-            // Documentation on getsockname - https://man7.org/linux/man-pages/man2/getsockname.2.html
-            socklen_t clientAddressLength = sizeof(clientAddress);
-            if (getsockname(c_socket, (sockaddr *)&clientAddress, &clientAddressLength) == -1)
+            if (attempt.socket != -1)
             {
-                log("ERROR", "getsockname failed", strerror(errno));
-                close(c_socket); // Close current socket
-                return 1;        // Exit program
+                balancer.failed(attempt.replica);
+                close_attempt(attempt);
             }
-            break; // Exit loop on succesful connection
         }
-        retries++;
-        sleep(RETRY_INTERVAL); // Wait before retrying
+        log("ERROR", "No response from any server", to_string(launched) + " attempt(s)");
+        balancer.finish_request(false, sample.total_us);
+        return connected ? -1 : 1; // Fail
     }
 
-    // Handle failed connection after MAX_RETRIES attempts
-    if (c_socket == -1)
+    tcp_attempt &won = attempts[winner];
+    tcp_attempt &lost = attempts[1 - winner];
+    balancer.answered(won.replica, END_US - won.start_us);
+    if (won.hedge)
     {
-        log("ERROR", "Failed to connect after " + to_string(MAX_RETRIES) + " attempts");
-        return 1; // Exit program
+        balancer.replicas[won.replica].hedges_won++;
+    }
+    if (lost.socket != -1)
+    {
+        balancer.abandoned(lost.replica, END_US - lost.start_us);
+        close_attempt(lost);
+    }
+    sample.wait_us = won.connected_us - won.start_us;
+    if (tcp_info && sample_tcp_info(won.socket, sample) != 0)
+    {
+        log("WARNING", "TCP_INFO unavailable", strerror(errno));
+    }
+    close_attempt(won);
+    balancer.finish_request(true, sample.total_us);
+    log("INFO", string("Received response from ") + balancer.describe(won.replica) + (won.hedge ? " (hedge)" : ""), won.response);
+    return 0; // Success
+}
+
+// Connect, send message and receive the response once, filling the application timings (and TCP_INFO with tcp_info) of sample
+// - A request the server shed (OVERLOADED <ms>) is sent again on a new connection after the hint, for as long as MAX_RETRIES
+//   failed connection attempts would have taken
+// Return 0 on success, -1 if there was no valid response, 1 if the connection failed after MAX_RETRIES attempts
+int run_request(const sockaddr_in &serverAddress, const char *server_name, string message, long grid_lines, const string &csv_path, bool tcp_info, tcp_sample &sample)
+{
+    sockaddr_in clientAddress; // Used to get port number that client listens on for server response (for logging)
+
+    int c_socket = -1;       // Initialize socket variable for access outside while loop
+    int s_response = -1;     // 0 once a valid response arrived
+    int retry_after_ms = -1; // Hint of an OVERLOADED answer
+    uint64_t start_us = monotonic_us();
+    const uint64_t DEADLINE_US = start_us + (uint64_t)MAX_RETRIES * RETRY_INTERVAL * 1000000;
+    message += MESSAGE_TERMINATOR; // The terminator tells the server the whole message arrived
+    while (true)
+    {
+        // Attempt to connect via TCP to server on a new socket each iteration
+        int retries = 0;
+        while (retries < MAX_RETRIES)
+        {
+            // A retry starts the clock again, the sleep is not latency
+            start_us = monotonic_us();
+            c_socket = attempt_new_TCP_connection(serverAddress); // Create new TCP socket
+            if (c_socket != -1)
+            {
+                sample.wait_us = monotonic_us() - start_us;
+                log("INFO", "Connected to server", string(server_name) + ":" + to_string(ntohs(serverAddress.sin_port)));
+                // Gets the local address and port assigned to client socket (used for logging later)
+                // Documentation on getsockname - https://man7.org/linux/man-pages/man2/getsockname.2.html
+                socklen_t clientAddressLength = sizeof(clientAddress);
+                if (getsockname(c_socket, (sockaddr *)&clientAddress, &clientAddressLength) == -1)
+                {
+                    log("ERROR", "getsockname failed", strerror(errno));
+                    close(c_socket); // Close current socket
+                    return 1;        // Fail
+                }
+                break; // Exit loop on succesful connection
+            }
+            retries++;
+            sleep(RETRY_INTERVAL); // Wait before retrying
+        }
+
+        // Handle failed connection after MAX_RETRIES attempts
+        if (c_socket == -1)
+        {
+            log("ERROR", "Failed to connect after " + to_string(MAX_RETRIES) + " attempts");
+            return 1; // Fail
+        }
+
+        // Client should be succesfully connected by this point
+        // Attempt to send initial command line message
+        int message_to_send = attempt_send(c_socket, message);
+        s_response = -1;
+        if (message_to_send == 0)
+        {
+            if (grid_lines > 0)
+            {
+                // Grid rows are streamed until the server closes the connection
+                s_response = receive_grid_csv(c_socket, csv_path, grid_lines, retry_after_ms);
+            }
+            else
+            {
+                // Wait for server response and display it
+                s_response = await_and_display_server_response(c_socket, clientAddress, retry_after_ms);
+            }
+        }
+        const uint64_t now = monotonic_us();
+        const int wait_ms = s_response == 1 && now < DEADLINE_US ? retry_wait_ms(retry_after_ms, DEADLINE_US - now) : -1;
+        if (wait_ms == -1)
+        {
+            break;
+        }
+        close(c_socket);
+        usleep(wait_ms * 1000); // Shed by the server, come back when it said there is room
     }
+    sample.total_us = monotonic_us() - start_us;
 
-    // Client should be succesfully connected by this point
-    // Attempt to send initial command line message
-    string message = string(argv[2]) + " " + argv[3] + " " + argv[4]; // Message with validated arguments <amount> <ip> <rate>
-    int message_to_send = attempt_send(c_socket, message);
-    if (message_to_send == 0)
+    // The server closed its side, the socket still holds TCP_INFO for the whole exchange
+    if (tcp_info && sample_tcp_info(c_socket, sample) != 0)
     {
-        // Wait for server response and display it
-        int s_response = await_and_display_server_response(c_socket, clientAddress);
+        log("WARNING", "TCP_INFO unavailable", strerror(errno));
     }
 
-    // This whole program is only meant to send messages typed in the command line
+    // This whole program is only meant to send messages typed in the command line (--repeat sends the same one again)
     // If you want to send a new message to the server you have to type the command again
-    close(c_socket); // Close socket
-    return 0;        // Exit program
+    close(c_socket);                  // Close socket
+    return s_response == 0 ? 0 : -1; // Success or no valid response
 }
 
 // Attempts a TCP connection with a new socket to some serverAddress
@@ -222,17 +658,37 @@ int attempt_send(int c_socket, string &message, int flags)
 }
 
 // Wait for a reply from the server and display the response
-// Return 0 on success, -1 on fail
-int await_and_display_server_response(int c_socket, sockaddr_in &clientAddress)
+// Return 0 on success, -1 on fail, 1 if the server shed the request (retry_after_ms holds its hint)
+int await_and_display_server_response(int c_socket, sockaddr_in &clientAddress, int &retry_after_ms)
 {
     log("INFO", "Awaiting response on port", to_string(ntohs(clientAddress.sin_port)));
     char buffer[RESPONSE_BUFFER_SIZE] = {0};                           // Initialize a buffer populated with 0's
     int bytesReceived = recv(c_socket, buffer, sizeof(buffer) - 1, 0); // Store received server response in buffer
+    while (bytesReceived > 0 && bytesReceived < (int)sizeof(buffer) - 1)
+    {
+        // Larger responses (batches) can arrive in several segments, keep reading until the server closes the connection
+        int more = recv(c_socket, buffer + bytesReceived, sizeof(buffer) - 1 - bytesReceived, 0);
+        if (more <= 0)
+            break;
+        bytesReceived += more;
+    }
     // Handle different states of received messages
     if (bytesReceived > 0)
     {
         // Handle succesfully received message
         buffer[bytesReceived] = '\0'; // Null-terminate to make a valid C-string when converting to string
+        if (string(buffer) == BUSY_RESPONSE)
+        {
+            // Server rate limited this client
+            log("WARNING", "Server busy", "Rate limited, try again later");
+            return -1; // Fail
+        }
+        if (parse_overloaded(buffer, retry_after_ms) == 0)
+        {
+            // Server shed the request before doing any work
+            log("WARNING", "Server overloaded", "Retrying after " + to_string(retry_after_ms) + " ms");
+            return 1; // Retry
+        }
         log("INFO", "Received response", string(buffer));
         return 0; // Success
     }
@@ -250,3 +706,87 @@ int await_and_display_server_response(int c_socket, sockaddr_in &clientAddress)
     }
     return -1; // Assume failure
 }
+
+// Receive a GRID response and write it as CSV until the server closes the connection
+// - Rows are written as they arrive, so large grids never have to fit in memory
+// - The grid is only complete with expected_lines lines, a stream cut short before that fails (the file keeps what arrived)
+// Return 0 on success, -1 on fail, 1 if the server shed the request (retry_after_ms holds its hint)
+int receive_grid_csv(int c_socket, const string &csv_path, long expected_lines, int &retry_after_ms)
+{
+    FILE *output = csv_path.empty() ? stdout : fopen(csv_path.c_str(), "w");
+    if (output == nullptr)
+    {
+        log("ERROR", "Cannot open CSV file", csv_path + ": " + strerror(errno));
+        return -1; // Fail
+    }
+
+    const auto START = chrono::steady_clock::now();
+    long first_byte_ms = -1; // Time until the first rows arrived
+    long total_bytes = 0;
+    long total_lines = 0;
+    static char buffer[GRID_BUFFER_SIZE];
+    int status = 0;
+    while (true)
+    {
+        ssize_t bytesReceived = recv(c_socket, buffer, sizeof(buffer), 0);
+        if (bytesReceived == 0)
+        {
+            break; // Server closed the connection, complete if every line arrived
+        }
+        if (bytesReceived == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            log("ERROR", "Receive failed", strerror(errno));
+            status = -1;
+            break;
+        }
+        if (first_byte_ms == -1)
+        {
+            first_byte_ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - START).count();
+            if (string_view(buffer, bytesReceived) == BUSY_RESPONSE)
+            {
+                // Server rate limited this client
+                log("WARNING", "Server busy", "Rate limited, try again later");
+                status = -1; // Nothing written
+                break;
+            }
+            if (parse_overloaded(string_view(buffer, bytesReceived), retry_after_ms) == 0)
+            {
+                log("WARNING", "Server overloaded", "Retrying after " + to_string(retry_after_ms) + " ms");
+                status = 1; // Nothing written, the retry starts the file over
+                break;
+            }
+        }
+        total_bytes += bytesReceived;
+        total_lines += count(buffer, buffer + bytesReceived, '\n');
+        fwrite(buffer, 1, bytesReceived, output);
+    }
+    const long TOTAL_MS = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - START).count();
+
+    if (output != stdout)
+    {
+        fclose(output);
+    }
+    if (status == 1)
+    {
+        return 1; // Shed, the caller retries
+    }
+    if (status == -1)
+    {
+        return -1; // Fail
+    }
+    if (total_lines == 0)
+    {
+        log("ERROR", "Empty grid response", "Server rejected the request or closed the connection");
+        return -1; // Fail
+    }
+    if (total_lines != expected_lines)
+    {
+        log("ERROR", "Incomplete grid", to_string(total_lines) + " of " + to_string(expected_lines) + " CSV lines received before the server closed the connection");
+        return -1; // Fail
+    }
+    log("INFO", "Grid received", to_string(total_lines - 1) + " CSV lines, " + to_string(total_bytes) + " bytes" + (csv_path.empty() ? "" : " -> " + csv_path));
+    log("INFO", "Grid timing", "first rows after " + to_string(first_byte_ms) + " ms, complete after " + to_string(TOTAL_MS) + " ms");
+    return status;
+}
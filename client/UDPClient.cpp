@@ -1,25 +1,69 @@
-#include "client_utils.h" // Client specific headers
+#include "client_utils.h"  // Client specific headers
+#include "load_balancer.h" // Server lists (power of two choices, hedged requests)
+
+#include <random> // Request ids for segmented responses (random_device)
+#include <chrono> // Request latency (steady_clock)
 
 const int RETRY_INTERVAL = 1;          // Retry interval in seconds
 const int MAX_RETRIES = 10;            // Limit retries to avoid infinite loop
-const int RESPONSE_BUFFER_SIZE = 1024; // Server response buffer size in bytes
+const int RESPONSE_BUFFER_SIZE = 2048; // One response datagram in bytes (a segment header plus SEGMENT_PAYLOAD_SIZE)
+const int SEGMENT_TIMEOUT_MS = 200;    // Gap after the last segment before asking for the missing ones (NACK)
+const int MAX_NACKS = 10;              // NACK rounds before falling back to repeating the whole request
 
 const string ACK_START = "\nACK_START"; // Custom protocol ACK
 const string ACK_END = "\nACK_END";     // Custom protocol ACK
 
 int create_UDP_socket();                                                     // Creates UDP socket
 int send_message(int c_socket, string &message, sockaddr_in &serverAddress); // Fire and forget a message to server
-int wait_response(int c_socket);                                             // Listen for a response from server
+int run_request(int c_socket, load_balancer &balancer, string &message, uint32_t request_id); // Send one request (retries and hedges included) until answered
+int wait_response(int c_socket, load_balancer &balancer, int primary, string &message, uint32_t request_id, int &retry_after_ms); // Collect every segment of the response to request_id
 string remove_substring(string &input, const string &substring);             // Removes a substring from an input string
 
 int main(int argc, char *argv[])
 {
+    client_options options; // --repeat <n>, --hedge-budget <fraction>, server list
+    if (extract_client_options(argc, argv, options) != 0)
+    {
+        return 1; // Exit program
+    }
+    if (options.tcp_info)
+    {
+        log("WARNING", "Ignoring --tcp-info", "TCP only");
+    }
+
     sockaddr_in serverAddress{}; // IPv4 Server address and port setup
-    // Validate ALL arguments <ip> <amount> <years> <rate>
-    if (validate_command_line_arguments(argc, argv, serverAddress) != 0)
+    string message_to_send;      // Pre-validated arguments
+    const int SOLVER_MODE = validate_solver_arguments(argc, argv, serverAddress, message_to_send); // 0 when a --principal/--rate mode was given
+    if (SOLVER_MODE == -1)
+    {
+        return 1; // Exit program
+    }
+    if (SOLVER_MODE == 1)
+    {
+        // Validate ALL arguments <ip> <amount> <years> <rate>
+        if (validate_command_line_arguments(argc, argv, serverAddress) != 0)
+        {
+            return 1; // Exit program
+        }
+        message_to_send = string(argv[2]) + " " + argv[3] + " " + argv[4];
+    }
+
+    // One server or a list of replicas, both go through the load balancer (one replica is never hedged)
+    load_balancer balancer;
+    if (options.servers.empty())
+    {
+        replica server;
+        server.address = serverAddress;
+        balancer.replicas.push_back(server);
+    }
+    else if (load_replicas(options.servers, balancer) != 0)
     {
         return 1; // Exit program
     }
+    if (options.hedge_budget >= 0)
+    {
+        balancer.hedge_budget = options.hedge_budget;
+    }
 
     int c_socket = -1; // Initialize socket variable for access outside while loop
 
@@ -29,22 +73,64 @@ int main(int argc, char *argv[])
         return 1; // If socket creation failed, exit program
     }
 
-    sockaddr_in clientAddress; // Used to get port number that client listens on for server response (for logging)
+    random_device random; // Request ids
+    for (int run = 0; run < options.repeat; run++)
+    {
+        // Ask for a segmented response so answers larger than one datagram (schedules, batches) arrive whole
+        // The id stays the same across retries, so a repeated request is answered from the server's cache
+        const uint32_t request_id = random();
+        string request = SEGMENT_COMMAND + " " + to_string(request_id) + " " + message_to_send;
+        if (run_request(c_socket, balancer, request, request_id) == 1)
+        {
+            return 1; // Exit program, the socket is gone
+        }
+    }
+
+    if (options.repeat > 1 || balancer.replicas.size() > 1)
+    {
+        balancer.log_summary();
+    }
+    close(c_socket);
+    return 0; // Exit program
+}
+
+static uint64_t now_us()
+{
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Send one request to the replica the load balancer picks until an answer arrives (wait_response may hedge it)
+// - One server: the request is repeated to it every RETRY_INTERVAL like before, or after the hint of an OVERLOADED answer
+// - Several: a retry goes to another replica right away, after every replica failed once in a row the client waits the same way
+//   (the hint if the last one shed the request), so replicas that are all shedding don't get the request bounced between them
+// - OVERLOADED answers don't use up MAX_RETRIES, they are bounded by the time MAX_RETRIES silent attempts would have taken
+// Return 0 on success, -1 after MAX_RETRIES attempts without an answer, 1 if the socket failed
+int run_request(int c_socket, load_balancer &balancer, string &message, uint32_t request_id)
+{
+    const uint64_t START_US = now_us();
+    balancer.start_request();
 
-    string message_to_send = string(argv[2]) + " " + argv[3] + " " + argv[4]; // Pre-validated arguments
+    sockaddr_in clientAddress; // Used to get port number that client listens on for server response (for logging)
 
     // Send message to server (no connection required)
-    int retries = 0;
-    while (retries < MAX_RETRIES)
+    int retries = 0;  // Attempts without an answer (OVERLOADED excluded)
+    int failures = 0; // Attempts failed so far
+    int exclude = -1; // Replica that just timed out
+    const uint64_t DEADLINE_US = START_US + (uint64_t)MAX_RETRIES * RETRY_INTERVAL * 1000000;
+    while (retries < MAX_RETRIES && now_us() < DEADLINE_US)
     {
         // Send message
-        if (send_message(c_socket, message_to_send, serverAddress) == -1)
+        int primary = balancer.pick(exclude);
+        primary = primary == -1 ? 0 : primary; // Only one server: the same one again
+        if (send_message(c_socket, message, balancer.replicas[primary].address) == -1)
         {
-            return 1; // Exit program
+            return 1; // Fail
         }
+        balancer.sent(primary);
 
-        int response = wait_response(c_socket); // Wait with my protocol
-        if (response == 0)
+        int retry_after_ms = -1;                                                                        // Set if the server shed the request
+        int response = wait_response(c_socket, balancer, primary, message, request_id, retry_after_ms); // Wait with my protocol
+        if (response >= 0)
         {
             // Handle successfully received response
             // Get the local address and port assigned to client socket (used for logging later)
@@ -54,20 +140,30 @@ int main(int argc, char *argv[])
             {
                 log("ERROR", "getsockname failed", strerror(errno));
                 close(c_socket);
-                return 1; // Exit program
+                return 1; // Fail
             }
-            break; // Exit on success
+            balancer.finish_request(true, now_us() - START_US);
+            return 0; // Success
         }
 
-        retries++;
-        sleep(1); // Wait before re-sending message
-    }
-    if (retries >= MAX_RETRIES)
-    {
-        log("ERROR", "Failed to send message after " + to_string(MAX_RETRIES) + " attempts");
+        exclude = balancer.replicas.size() > 1 ? primary : -1;
+        failures++;
+        retries += retry_after_ms >= 0 ? 0 : 1;
+        if (failures % (int)balancer.replicas.size() == 0)
+        {
+            // Every replica failed once in a row, wait before re-sending message
+            const uint64_t now = now_us();
+            const int wait_ms = retry_after_ms < 0 ? RETRY_INTERVAL * 1000 : now < DEADLINE_US ? retry_wait_ms(retry_after_ms, DEADLINE_US - now) : -1; // The server said when it expects room, not a whole RETRY_INTERVAL
+            if (wait_ms == -1)
+            {
+                break; // Still overloaded too close to the deadline
+            }
+            usleep(wait_ms * 1000);
+        }
     }
-
-    return 0; // Exit program
+    log("ERROR", "Failed to send message after " + to_string(MAX_RETRIES) + " attempts");
+    balancer.finish_request(false, now_us() - START_US);
+    return -1; // Fail
 }
 
 // Create a new UDP socket
@@ -118,56 +214,229 @@ int send_message(int c_socket, string &message, sockaddr_in &serverAddress)
     return -1; // Assume failure
 }
 
-// Listen for a response from server with RETRY_INTERVAL second timeout
-// Return 0 on response received success, -1 on fail
-int wait_response(int c_socket)
+// Set how long recvfrom() waits before giving up
+// Documentation on SO_RCVTIMEO and SOL_SOCKET - https://linux.die.net/man/7/socket
+static void set_receive_timeout(int c_socket, int milliseconds)
 {
-    struct timeval timeout = {RETRY_INTERVAL, 0}; // Set automatic timeout when waiting for response
-    // Documentation on SO_RCVTIMEO and SOL_SOCKET - https://linux.die.net/man/7/socket
-    setsockopt(c_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)); // Apply SO_REUSEADDR to the socket
-
-    char buffer[RESPONSE_BUFFER_SIZE] = {0};               // Initialize a buffer populated with 0's
-    sockaddr_in serverAddress{};                           // To store server ip address
-    socklen_t serverAddressLength = sizeof(serverAddress); // Length of server ip address
+    struct timeval timeout = {milliseconds / 1000, (milliseconds % 1000) * 1000};
+    setsockopt(c_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
 
-    ssize_t recv_bytes = recvfrom(c_socket, buffer, sizeof(buffer) - 1, 0, (sockaddr *)&serverAddress, &serverAddressLength); // Store server response in buffer
+// Index of the replica a datagram came from, among the primary and the hedge, -1 if neither
+static int replica_of(const load_balancer &balancer, const sockaddr_in &from, int primary, int hedge)
+{
+    for (int index : {primary, hedge})
+    {
+        if (index != -1 && balancer.replicas[index].address.sin_addr.s_addr == from.sin_addr.s_addr &&
+            balancer.replicas[index].address.sin_port == from.sin_port)
+        {
+            return index;
+        }
+    }
+    return -1;
+}
 
-    // Handle different states of received messages
-    if (recv_bytes == -1)
+// No answer from the primary nor the hedge: both count as failed (once a replica answered, its outcome is already recorded)
+static void give_up(load_balancer &balancer, int primary, int hedge, int source)
+{
+    if (source != -1)
     {
-        // Handle no response after a timeout
-        log("ERROR", "No response after " + to_string(RETRY_INTERVAL) + " seconds", strerror(errno));
-        return -1; // Fail
+        return;
     }
-    else
+    balancer.failed(primary);
+    if (hedge != -1)
     {
-        // Handle message received
-        // The custom protocol states that a succesful server response uses the format "ACK_START<result>ACK_END"
-        // If "ACK_START" and "ACK_END" aren't detecteed in the response then some of the message must have been lost
-        buffer[recv_bytes] = '\0'; // Null-terminate to make a valid C-string when converting to string
-        const string SERVER_RESPONSE = string(buffer);
-        const size_t ACK_START_FOUND = SERVER_RESPONSE.find(ACK_START); // Position of substring, string::npos If not found
-        const size_t ACK_END_FOUND = SERVER_RESPONSE.find(ACK_END);     // Position of substring, string::npos If not found
+        balancer.failed(hedge);
+    }
+}
 
-        // Check for acknowledgement start and end
-        if (ACK_START_FOUND != string::npos && ACK_END_FOUND != string::npos)
+// Listen for the segments of a response from server
+// - Waits RETRY_INTERVAL seconds for the first segment, then SEGMENT_TIMEOUT_MS between segments
+// - With several servers, no segment after the hedge delay sends the same request to a second replica (if the budget allows),
+//   the first replica to send a segment answers the whole response and datagrams from the other one are dropped
+// - When segments stop arriving with some still missing, sends NACK <request_id> <missing bitmap> so only those are sent again
+// - Segments are placed by sequence number, so duplicates and reordering don't matter
+// - OVERLOADED <ms> ends the attempt right away, retry_after_ms tells the caller how long to wait before repeating it
+// Return index of the replica that answered, -1 on fail (caller repeats the whole request)
+int wait_response(int c_socket, load_balancer &balancer, int primary, string &message, uint32_t request_id, int &retry_after_ms)
+{
+    char buffer[RESPONSE_BUFFER_SIZE];
+    string response;        // Reassembled payload, segment n starts at n * SEGMENT_PAYLOAD_SIZE
+    int total = 0;          // Segment count, 0 until the first segment arrives
+    uint64_t received = 0;  // Bitmap of segments received
+    uint64_t expected = 0;  // Bitmap with a bit for every segment
+    size_t last_length = 0; // Payload length of the last segment
+    int nacks = 0;          // NACKs sent for this attempt
+
+    const uint64_t SENT_US = now_us();                                 // Request went to the primary
+    const uint64_t GIVE_UP_US = SENT_US + RETRY_INTERVAL * 1000000ULL; // No first segment by then: repeat the request
+    const uint64_t HEDGE_AT_US = SENT_US + balancer.hedge_delay_us();  // No first segment by then: hedge
+    int hedge = -1;                                                    // Replica the hedge went to, -1 if none
+    uint64_t hedge_sent_us = 0;                                        // When the hedge went out
+    bool hedge_considered = false;                                     // The hedge delay passed (hedged or not)
+    int source = -1;                                                   // Replica answering, -1 until its first segment
+
+    while (total == 0 || received != expected)
+    {
+        int timeout_ms = SEGMENT_TIMEOUT_MS;
+        if (total == 0)
         {
-            // Response contains ACK
-            // Remove "ACK_START" and "ACK_END" from response string
-            string formated_response = string(buffer);
-            remove_substring(formated_response, ACK_START);
-            remove_substring(formated_response, ACK_END);
-            log("INFO", "Response from server", formated_response);
-            return 0; // Success
+            const uint64_t now = now_us();
+            if (now >= GIVE_UP_US)
+            {
+                // Handle no response after a timeout
+                log("ERROR", "No response after " + to_string(RETRY_INTERVAL) + " seconds", strerror(EAGAIN));
+                give_up(balancer, primary, hedge, source);
+                return -1; // Fail
+            }
+            if (!hedge_considered && now >= HEDGE_AT_US)
+            {
+                hedge_considered = true;
+                hedge = balancer.pick(primary);
+                if (hedge != -1 && balancer.take_hedge())
+                {
+                    log("WARNING", "Hedging request", "no answer from " + balancer.describe(primary) + " after " + to_string(now - SENT_US) + " us, also sent to " + balancer.describe(hedge));
+                    if (send_message(c_socket, message, balancer.replicas[hedge].address) == -1)
+                    {
+                        return -1; // Fail
+                    }
+                    balancer.sent(hedge);
+                    hedge_sent_us = now_us();
+                }
+                else
+                {
+                    hedge = -1;
+                }
+                continue;
+            }
+            const uint64_t wake = hedge_considered ? GIVE_UP_US : min(HEDGE_AT_US, GIVE_UP_US);
+            timeout_ms = (int)((wake - now + 999) / 1000);
+        }
+        set_receive_timeout(c_socket, timeout_ms);
+        sockaddr_in responseAddress{};                             // To store server ip address
+        socklen_t responseAddressLength = sizeof(responseAddress); // Length of server ip address
+        ssize_t recv_bytes = recvfrom(c_socket, buffer, sizeof(buffer), 0, (sockaddr *)&responseAddress, &responseAddressLength); // Store one datagram in buffer
+
+        if (recv_bytes == -1)
+        {
+            if (total == 0)
+            {
+                continue; // Time to hedge or to give up, checked above
+            }
+            if (nacks == MAX_NACKS)
+            {
+                log("ERROR", "Segments still missing after " + to_string(MAX_NACKS) + " NACKs", "repeating request");
+                give_up(balancer, primary, hedge, source);
+                return -1; // Fail
+            }
+
+            // Ask for exactly the segments that are missing
+            char nack[64];
+            snprintf(nack, sizeof(nack), "%s %u %llx", NACK_COMMAND.c_str(), request_id, (unsigned long long)(expected & ~received));
+            sendto(c_socket, nack, strlen(nack), 0, (sockaddr *)&balancer.replicas[source].address, sizeof(sockaddr_in));
+            nacks++;
+            log("WARNING", "Missing segments", to_string(__builtin_popcountll(expected & ~received)) + " of " + to_string(total) + ", sent NACK");
+            continue;
+        }
+
+        const int from = replica_of(balancer, responseAddress, primary, hedge);
+        if (from != -1 && source != -1 && from != source)
+        {
+            continue; // The other replica answered too, first one wins
         }
-        else
+        const string_view datagram(buffer, recv_bytes);
+        if (from != -1 && datagram == BUSY_RESPONSE)
         {
-            // Message contains no ACK or partial ACK
-            log("ERROR", "No ACK from server");
+            // Server rate limited this client, back off and try again
+            log("WARNING", "Server busy", "Rate limited, retrying in " + to_string(RETRY_INTERVAL) + " second(s)");
+            give_up(balancer, primary, hedge, source);
             return -1; // Fail
         }
+        if (from != -1 && source == -1 && parse_overloaded(datagram, retry_after_ms) == 0)
+        {
+            // Server shed the request before doing any work, it told us when to come back
+            log("WARNING", "Server overloaded", balancer.describe(from) + " asks to retry after " + to_string(retry_after_ms) + " ms");
+            give_up(balancer, primary, hedge, source);
+            return -1; // Fail
+        }
+
+        uint32_t segment_id;
+        int sequence, segment_total;
+        string_view payload;
+        if (from == -1 || parse_segment_header(datagram, segment_id, sequence, segment_total, payload) != 0 || segment_id != request_id ||
+            (total != 0 && segment_total != total) || payload.size() > SEGMENT_PAYLOAD_SIZE)
+        {
+            log("WARNING", "Ignoring unexpected datagram", to_string(recv_bytes) + " bytes");
+            continue;
+        }
+        if (total == 0)
+        {
+            source = from;
+            total = segment_total;
+            expected = total == MAX_SEGMENTS ? ~0ULL : (1ULL << total) - 1;
+            response.assign((size_t)total * SEGMENT_PAYLOAD_SIZE, '\0');
+
+            // Time to first segment is what the hedge delay is compared with
+            const uint64_t now = now_us();
+            balancer.answered(source, now - (source == hedge ? hedge_sent_us : SENT_US));
+            if (source == hedge)
+            {
+                balancer.replicas[hedge].hedges_won++;
+            }
+            const int other = source == primary ? hedge : primary;
+            if (other != -1)
+            {
+                balancer.abandoned(other, now - (other == hedge ? hedge_sent_us : SENT_US));
+            }
+        }
+        response.replace((size_t)sequence * SEGMENT_PAYLOAD_SIZE, payload.size(), payload.data(), payload.size());
+        if (sequence == total - 1)
+        {
+            last_length = payload.size();
+        }
+        received |= 1ULL << sequence;
+    }
+    response.resize((size_t)(total - 1) * SEGMENT_PAYLOAD_SIZE + last_length);
+
+    // Let the server forget the response (if this is lost the server evicts it later), a hedge replica cached it too
+    const string fin = FIN_COMMAND + " " + to_string(request_id);
+    for (int index : {primary, hedge})
+    {
+        if (index != -1)
+        {
+            sendto(c_socket, fin.c_str(), fin.size(), 0, (sockaddr *)&balancer.replicas[index].address, sizeof(sockaddr_in));
+        }
+    }
+    if (total > 1)
+    {
+        log("INFO", "Received segmented response", to_string(total) + " segments, " + to_string(response.size()) + " bytes, " + to_string(nacks) + " NACK(s)");
+    }
+    if (hedge != -1)
+    {
+        log("INFO", "Answered by", balancer.describe(source) + (source == hedge ? " (hedge)" : ""));
+    }
+
+    // The custom protocol states that a succesful server response uses the format "ACK_START<result>ACK_END"
+    // If "ACK_START" and "ACK_END" aren't detecteed in the reassembled response then some of the message must have been lost
+    const size_t ACK_START_FOUND = response.find(ACK_START); // Position of substring, string::npos If not found
+    const size_t ACK_END_FOUND = response.find(ACK_END);     // Position of substring, string::npos If not found
+
+    // Check for acknowledgement start and end
+    if (ACK_START_FOUND != string::npos && ACK_END_FOUND != string::npos)
+    {
+        // Response contains ACK
+        // Remove "ACK_START" and "ACK_END" from response string
+        remove_substring(response, ACK_START);
+        remove_substring(response, ACK_END);
+        log("INFO", "Response from server", response);
+        return source; // Success
+    }
+    else
+    {
+        // Message contains no ACK or partial ACK
+        log("ERROR", "No ACK from server");
+        return -1; // Fail
     }
-    return -1; // Assume failure
 }
 
 // Removes a substring from an input string
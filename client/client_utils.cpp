@@ -1,5 +1,59 @@
 #include "client_utils.h" // Client specific headers
 #include <netdb.h>        // For getaddrinfo
+#include <algorithm>      // For removing commas (remove)
+
+// Remove the optional client flags from argv (wherever they appear) so the positional checks below stay unchanged
+// A comma separated <ip> list is kept in options.servers and argv[1] is cut to its first entry
+// Return 0 on success, -1 on an invalid value
+int extract_client_options(int &argc, char *argv[], client_options &options)
+{
+    int kept = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        const string flag = argv[i];
+        if (flag == "--tcp-info")
+        {
+            options.tcp_info = true;
+        }
+        else if (flag == "--repeat" && i + 1 < argc)
+        {
+            char *end;
+            const long value = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || value < 1 || value > 1000000)
+            {
+                log("ERROR", "Invalid value for --repeat", argv[i]);
+                return -1; // Fail
+            }
+            options.repeat = (int)value;
+        }
+        else if (flag == "--hedge-budget" && i + 1 < argc)
+        {
+            char *end;
+            const double value = strtod(argv[++i], &end);
+            if (*end != '\0' || value < 0 || value > 1)
+            {
+                log("ERROR", "Invalid value for --hedge-budget", argv[i]);
+                return -1; // Fail
+            }
+            options.hedge_budget = value;
+        }
+        else
+        {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    argv[argc] = nullptr;
+
+    // <ip>,<ip>,... : the positional checks see the first replica, the whole list is resolved later (load_replicas)
+    char *comma = argc > 1 ? strchr(argv[1], ',') : nullptr;
+    if (comma != nullptr)
+    {
+        options.servers = argv[1];
+        *comma = '\0';
+    }
+    return 0; // Success
+}
 
 // Expects 4 arguments <ip> <amount> <years> <rate>
 // Returns 0 if valid arguments, 1 if too many arguments, -1 if invalid argument is present
@@ -35,7 +89,105 @@ int validate_command_line_arguments(int argc, char *argv[], sockaddr_in &serverA
     return 0; // All arguments are valid
 }
 
+// Expects one of the inverse solver modes:
+// - <ip> --principal <payment> <years> <rate>      (largest affordable loan amount)
+// - <ip> --rate <payment> <amount> <years>         (rate implied by a payment)
+// - <ip> --principal-batch <payment:years:rate> ... (many principal solves in one message)
+// - <ip> --rate-batch <payment:amount:years> ...    (many rate solves in one message)
+// - <ip> --schedule <amount> <years> <rate>         (amortization schedule, not a solve but built the same way)
+// - <ip> --scenario <amount> <years> <rate> <event>+<event>... ... (what-if scenarios on the loan's schedule)
+// Returns 0 if valid arguments (message is filled in), 1 if argv[2] isn't one of these modes, -1 if invalid
+int validate_solver_arguments(int argc, char *argv[], sockaddr_in &serverAddress, string &message)
+{
+    const string MODE = argc > 2 ? string(argv[2]) : "";
+    const bool SINGLE = MODE == "--principal" || MODE == "--rate" || MODE == "--schedule";
+    const bool BATCH = MODE == "--principal-batch" || MODE == "--rate-batch";
+    const bool SCENARIO = MODE == "--scenario";
+    if (!SINGLE && !BATCH && !SCENARIO)
+    {
+        return 1; // Not a solver mode
+    }
+    if ((SINGLE && (argc - 1) != 5) || (BATCH && (argc - 1) < 3) || (SCENARIO && (argc - 1) < 6))
+    {
+        log("ERROR", "Invalid arguments", "Usage: " + string(argv[0]) + " <ip> --principal <payment> <years> <rate>");
+        log("INFO", "Or", string(argv[0]) + " <ip> --rate <payment> <amount> <years>");
+        log("INFO", "Or", string(argv[0]) + " <ip> --principal-batch|--rate-batch <payment:years:rate>|<payment:amount:years> ...");
+        log("INFO", "Or", string(argv[0]) + " <ip> --schedule <amount> <years> <rate>");
+        log("INFO", "Or", string(argv[0]) + " <ip> --scenario <amount> <years> <rate> <event>+<event>... ... (extra:<amount>[:<from>[:<to>]], lump:<amount>:<month>, reset:<rate>:<month>)");
+        log("INFO", "Example", string(argv[0]) + " 127.0.0.1 --rate 777.06 150,000 30");
+        return -1; // Fail
+    }
+    if (validate_ip(argv[1], serverAddress) != 0)
+    {
+        return -1; // Fail
+    }
+
+    if (MODE == "--principal")
+    {
+        // <payment> is a dollar amount just like <amount>
+        if (validate_amount(argv[3]) != 0 || validate_years(argv[4]) != 0 || validate_rate(argv[5]) != 0)
+        {
+            return -1; // Fail
+        }
+        message = PRINCIPAL_COMMAND;
+    }
+    else if (MODE == "--rate")
+    {
+        if (validate_amount(argv[3]) != 0 || validate_amount(argv[4]) != 0 || validate_years(argv[5]) != 0)
+        {
+            return -1; // Fail
+        }
+        message = RATE_COMMAND;
+    }
+    else if (MODE == "--schedule" || SCENARIO)
+    {
+        // Scenario events are checked by the server against the loan's term, a bad one rejects the whole request
+        if (validate_amount(argv[3]) != 0 || validate_years(argv[4]) != 0 || validate_rate(argv[5]) != 0)
+        {
+            return -1; // Fail
+        }
+        message = SCENARIO ? SCENARIO_COMMAND : SCHEDULE_COMMAND;
+    }
+    else
+    {
+        // Batch items are checked by the server, a bad item rejects the whole batch
+        message = MODE == "--principal-batch" ? PRINCIPAL_BATCH_COMMAND : RATE_BATCH_COMMAND;
+    }
+    for (int i = 3; i < argc; i++)
+    {
+        message += " " + string(argv[i]);
+    }
+    message.erase(remove(message.begin(), message.end(), ','), message.end()); // Remove commas
+    return 0;                                                                  // All arguments are valid
+}
+
+// Expects <ip> --grid <amount_min:amount_max:amount_step> <rate_min:rate_max:rate_step> <years/years/...> [--csv <file>]
+// Returns 0 if valid arguments (message and csv_path are filled in), -1 otherwise
+int validate_grid_arguments(int argc, char *argv[], sockaddr_in &serverAddress, string &message, string &csv_path, grid_request &grid)
+{
+    // 5 arguments without --csv, 7 with it (ignoring the first argument of the file name)
+    if (!((argc - 1) == 5 || ((argc - 1) == 7 && string(argv[6]) == "--csv")))
+    {
+        log("ERROR", "Invalid arguments", "Usage: " + string(argv[0]) + " <ip> --grid <amount_min:amount_max:amount_step> <rate_min:rate_max:rate_step> <years/years/...> [--csv <file>]");
+        log("INFO", "Example", string(argv[0]) + " 127.0.0.1 --grid 100,000:1,000,000:50,000 3:8:0.25 15/20/30 --csv grid.csv");
+        return -1; // Fail
+    }
+    if (validate_ip(argv[1], serverAddress) != 0)
+    {
+        return -1; // Fail
+    }
+    message = GRID_COMMAND + " " + argv[3] + " " + argv[4] + " " + argv[5]; // Same format is checked again by the server
+    message.erase(remove(message.begin(), message.end(), ','), message.end()); // Remove commas (server strips them too)
+    if (parse_grid_message(message, grid) != 0)
+    {
+        return -1; // Fail
+    }
+    csv_path = (argc - 1) == 7 ? string(argv[7]) : ""; // Empty path means print to stdout
+    return 0;                                          // All arguments are valid
+}
+
 // Validate <ip>, resolves hostname to IPv4 address, or accepts IPv4 address and configure sockaddr_in
+// <ip>:<port> picks another port than SERVER_PORT (e.g. a ChaosProxy in front of the server)
 // Return 0 if <ip> valid, -1 if invalid
 int validate_ip(char *address, sockaddr_in &serverAddress)
 {
@@ -43,10 +195,26 @@ int validate_ip(char *address, sockaddr_in &serverAddress)
     struct addrinfo hints; // Hints is a filter for getaddrinfo
     struct addrinfo *res;  // Pointer to struct addrinfo which holds an address filtered by getaddrinfo
 
+    // Split off an optional :<port>
+    int port = SERVER_PORT;
+    char *colon = strrchr(address, ':');
+    if (colon != NULL)
+    {
+        char *end;
+        long value = strtol(colon + 1, &end, 10);
+        if (colon[1] == '\0' || *end != '\0' || value < 1 || value > 65535)
+        {
+            log("ERROR", "Invalid port", colon + 1);
+            return -1; // Fail
+        }
+        port = (int)value;
+        *colon = '\0'; // <ip> alone from here on
+    }
+
     // Set up temporary server ip address and port number configurations
     // Documentation on htons - https://linux.die.net/man/3/htons
-    serverAddress.sin_family = AF_INET;          // Set address family to IPv4
-    serverAddress.sin_port = htons(SERVER_PORT); // Assign port number in network
+    serverAddress.sin_family = AF_INET;   // Set address family to IPv4
+    serverAddress.sin_port = htons(port); // Assign port number in network
 
     // Set up hints for getaddrinfo (to translate <ip>)
     // Documentation on memset - https://en.cppreference.com/w/cpp/string/byte/memset
@@ -2,7 +2,19 @@
 #define CLIENT_H_UTILS_H
 #include "../network/network_utils.h" // Headers shared by client & server
 
+// Optional client flags, removed from argv before the positional arguments are validated
+struct client_options
+{
+    bool tcp_info = false;    // --tcp-info: TCP only, sample TCP_INFO of every connection and print a network quality summary
+    int repeat = 1;           // --repeat <n>: send the same request n times (one connection each) and summarize the runs
+    string servers;           // <ip> given as a comma separated list of replicas (argv[1] keeps the first entry), empty for one server
+    double hedge_budget = -1; // --hedge-budget <fraction>: extra requests allowed for hedging, -1 keeps the default
+};
+
 int validate_command_line_arguments(int argc, char *argv[], sockaddr_in &serverAddress); // Validates ALL 4 command line arguments with helper methods
-int validate_ip(char *address, sockaddr_in &serverAddress);                              // Validate an <ip> either hostname or numeric address (IPv4 only) and configure sockaddr_in
+int validate_ip(char *address, sockaddr_in &serverAddress);                              // Validate an <ip>[:<port>] either hostname or numeric address (IPv4 only) and configure sockaddr_in
+int validate_solver_arguments(int argc, char *argv[], sockaddr_in &serverAddress, string &message); // Validates <ip> --principal/--rate/--principal-batch/--rate-batch/--schedule/--scenario ... and builds the message
+int validate_grid_arguments(int argc, char *argv[], sockaddr_in &serverAddress, string &message, string &csv_path, grid_request &grid); // Validates <ip> --grid <amounts> <rates> <years> [--csv <file>] and builds the GRID message
+int extract_client_options(int &argc, char *argv[], client_options &options);            // Remove --tcp-info/--repeat <n>/--hedge-budget <fraction> from argv and split a server list, -1 on an invalid value
 
 #endif // CLIENT_H_UTILS_H
\ No newline at end of file
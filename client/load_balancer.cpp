@@ -0,0 +1,182 @@
+#include "load_balancer.h" // Replica selection and hedging
+#include "client_utils.h"  // Resolve <ip>[:<port>] (validate_ip)
+
+#include <algorithm> // nth_element, sort, max
+#include <cstdio>    // Summary lines (snprintf)
+
+// Resolve one <ip>[:<port>] (validate_ip cuts the port off in place, so it works on a copy)
+// Return 0 on success, -1 if invalid
+int load_balancer::add(char *address)
+{
+    if (replicas.size() >= MAX_REPLICAS)
+    {
+        log("ERROR", "Too many servers", "at most " + to_string(MAX_REPLICAS));
+        return -1; // Fail
+    }
+    replica entry;
+    if (validate_ip(address, entry.address) != 0)
+    {
+        return -1; // Fail
+    }
+    replicas.push_back(entry);
+    return 0; // Success
+}
+
+// Two distinct random candidates, the one with the lower latency x (in flight + 1) wins
+// The loser looks PROBE_DECAY faster afterwards, so a replica that was slow once is tried again eventually
+// Documentation on the power of two choices - https://www.eecs.harvard.edu/~michaelm/postscripts/mythesis.pdf
+// Return replica index, -1 if exclude was the only replica
+int load_balancer::pick(int exclude)
+{
+    const int count = (int)replicas.size() - (exclude >= 0 ? 1 : 0);
+    if (count <= 0)
+    {
+        return -1; // Nothing else to pick
+    }
+    // Draw among the candidates (indexes above exclude shift by one)
+    auto candidate = [&](int n) { return exclude >= 0 && n >= exclude ? n + 1 : n; };
+    if (count == 1)
+    {
+        return candidate(0);
+    }
+    const int a = (int)(random() % count);
+    int b = (int)(random() % (count - 1));
+    b += b >= a ? 1 : 0; // Skip a, so the two are distinct
+    const int first = candidate(a);
+    const int second = candidate(b);
+
+    const double first_score = replicas[first].latency_us * (replicas[first].outstanding + 1);
+    const double second_score = replicas[second].latency_us * (replicas[second].outstanding + 1);
+    const int winner = first_score <= second_score ? first : second;
+    replicas[winner == first ? second : first].latency_us *= PROBE_DECAY;
+    return winner;
+}
+
+// Tokens accumulate at hedge_budget per request, capped so a long quiet period can't fund a flood of hedges
+void load_balancer::start_request()
+{
+    requests++;
+    hedge_tokens = min(hedge_tokens + hedge_budget, (double)MAX_HEDGE_TOKENS);
+}
+
+// Return true if a hedge may be sent (and spend it)
+bool load_balancer::take_hedge()
+{
+    if (hedge_budget <= 0 || replicas.size() < 2 || hedge_tokens < 1)
+    {
+        return false;
+    }
+    hedge_tokens -= 1;
+    hedges++;
+    return true;
+}
+
+uint64_t load_balancer::hedge_delay_us() const
+{
+    if (answers < MIN_HEDGE_SAMPLES)
+    {
+        return DEFAULT_HEDGE_DELAY_US;
+    }
+    const size_t count = (size_t)min(answers, (uint64_t)LATENCY_WINDOW);
+    uint64_t recent[LATENCY_WINDOW];
+    copy(window, window + count, recent);
+    const size_t rank = count * 95 / 100;
+    nth_element(recent, recent + rank, recent + count);
+    return max(recent[rank], (uint64_t)MIN_HEDGE_DELAY_US);
+}
+
+void load_balancer::sent(int index)
+{
+    replicas[index].sent++;
+    replicas[index].outstanding++;
+}
+
+// Peak EWMA: a slower answer is taken as is, faster ones pull the average down gradually, so one slow answer is enough to steer away
+void load_balancer::answered(int index, uint64_t latency_us)
+{
+    replica &target = replicas[index];
+    target.outstanding--;
+    target.answered++;
+    target.latency_us = latency_us >= target.latency_us ? latency_us : target.latency_us + LATENCY_SMOOTHING * (latency_us - target.latency_us);
+    window[answers++ % LATENCY_WINDOW] = latency_us;
+}
+
+// The answer would have taken at least elapsed_us, so that becomes the floor of the average (never lowers it)
+void load_balancer::abandoned(int index, uint64_t elapsed_us)
+{
+    replica &target = replicas[index];
+    target.outstanding--;
+    target.latency_us = max(target.latency_us, (double)elapsed_us);
+}
+
+void load_balancer::failed(int index)
+{
+    replica &target = replicas[index];
+    target.outstanding--;
+    target.failed++;
+    target.latency_us += LATENCY_SMOOTHING * ((double)FAILURE_PENALTY_US - target.latency_us);
+}
+
+void load_balancer::finish_request(bool ok, uint64_t latency_us)
+{
+    if (ok)
+    {
+        request_latencies.push_back(latency_us);
+    }
+    else
+    {
+        request_failures++;
+    }
+}
+
+string load_balancer::describe(int index) const
+{
+    char ip[INET_ADDRSTRLEN] = "?";
+    inet_ntop(AF_INET, &replicas[index].address.sin_addr, ip, sizeof(ip));
+    return string(ip) + ":" + to_string(ntohs(replicas[index].address.sin_port));
+}
+
+// Example: 127.0.0.1:13001: 480 sent, 478 answered, 0 failed, 3 hedges won, average 812 us
+void load_balancer::log_summary() const
+{
+    for (size_t i = 0; i < replicas.size(); i++)
+    {
+        const replica &entry = replicas[i];
+        log("INFO", "Replica " + describe((int)i), to_string(entry.sent) + " sent, " + to_string(entry.answered) + " answered, " + to_string(entry.failed) +
+                                                    " failed, " + to_string(entry.hedges_won) + " hedges won, average " + to_string((uint64_t)entry.latency_us) + " us");
+    }
+
+    // Exact percentiles (the log2 histograms of --tcp-info are too coarse to compare tails)
+    vector<uint64_t> sorted = request_latencies;
+    sort(sorted.begin(), sorted.end());
+    auto at = [&](double p) { return sorted.empty() ? 0 : sorted[min(sorted.size() - 1, (size_t)(p / 100 * sorted.size()))]; };
+    char line[256];
+    snprintf(line, sizeof(line), "%zu ok, %llu failed | p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu | %llu hedges (%.1f%% extra load), hedge delay %llu us",
+             sorted.size(), (unsigned long long)request_failures, (unsigned long long)at(50), (unsigned long long)at(90), (unsigned long long)at(99),
+             (unsigned long long)at(99.9), (unsigned long long)(sorted.empty() ? 0 : sorted.back()), (unsigned long long)hedges,
+             requests == 0 ? 0.0 : 100.0 * hedges / requests, (unsigned long long)hedge_delay_us());
+    log("INFO", "Request latency (us)", line);
+}
+
+// Split list on commas and add every entry
+// Return 0 on success, -1 if an entry is invalid
+int load_replicas(const string &list, load_balancer &balancer)
+{
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        size_t comma = list.find(',', start);
+        if (comma == string::npos)
+        {
+            comma = list.size();
+        }
+        string entry = list.substr(start, comma - start);
+        if (entry.empty() || balancer.add(&entry[0]) != 0)
+        {
+            log("ERROR", "Invalid server list", list);
+            return -1; // Fail
+        }
+        start = comma + 1;
+    }
+    return 0; // Success
+}
@@ -0,0 +1,66 @@
+// Replica selection and hedged requests shared by TCPClient and UDPClient
+// - <ip> may be a comma separated list of replicas (<ip>[:<port>],<ip>[:<port>],...), a single address keeps the old behaviour
+// - Every request goes to the better of two randomly picked replicas (power of two choices), scored by a peak moving average of
+//   observed latency times the requests in flight, so a slow replica gets less traffic without the fastest one taking all of it
+// - A request not answered after the hedge delay (p95 of recent latencies) is sent again to a second replica and the first answer wins
+// - The extra load is capped by --hedge-budget: every request earns that fraction of a hedge, a hedge spends a whole one
+#ifndef LOAD_BALANCER_H
+#define LOAD_BALANCER_H
+#include "../network/network_utils.h" // Headers shared by client & server
+
+#include <vector> // Replicas, request latencies
+#include <random> // Replica picks (mt19937_64)
+
+#define MAX_REPLICAS 16                // Entries in a server list
+#define LATENCY_WINDOW 256             // Recent answer latencies the hedge delay is taken from
+#define MIN_HEDGE_SAMPLES 20           // Answers needed before the p95 is trusted, DEFAULT_HEDGE_DELAY_US until then
+#define DEFAULT_HEDGE_DELAY_US 100000  // Hedge delay before any latency was observed (100 ms)
+#define MIN_HEDGE_DELAY_US 1000        // Never hedge sooner than this, even when every answer is faster
+#define FAILURE_PENALTY_US 1000000     // A failed or timed out attempt counts as this latency (one client retry interval)
+#define MAX_HEDGE_TOKENS 10            // Hedges saved up for a burst of slow requests
+
+const double DEFAULT_HEDGE_BUDGET = 0.05; // Extra requests per request (5%, matching hedging at the p95)
+const double LATENCY_SMOOTHING = 0.2;     // Weight of a faster answer in a replica's moving average (a slower one replaces it)
+const double PROBE_DECAY = 0.95;          // A replica losing a pick looks this much faster afterwards, so a slow one is probed again now and then
+
+struct replica
+{
+    sockaddr_in address{};   // Where requests go
+    double latency_us = 0;   // Peak moving average of answer latency, 0 until the first answer (an unmeasured replica wins every pick)
+    int outstanding = 0;     // Requests and hedges in flight
+    uint64_t sent = 0;       // Requests and hedges sent
+    uint64_t answered = 0;   // Answers used
+    uint64_t failed = 0;     // Refused, BUSY, OVERLOADED, no valid answer or timed out
+    uint64_t hedges_won = 0; // Answers that came from a hedge sent to this replica
+};
+
+struct load_balancer
+{
+    vector<replica> replicas;                   // At least one
+    double hedge_budget = DEFAULT_HEDGE_BUDGET; // --hedge-budget, 0 disables hedging
+    double hedge_tokens = 0;                    // Hedges that may be sent now
+    uint64_t window[LATENCY_WINDOW] = {};       // Recent answer latencies (ring)
+    uint64_t answers = 0;                       // Answers recorded, window position
+    uint64_t requests = 0;                      // Requests started
+    uint64_t hedges = 0;                        // Hedges sent
+    vector<uint64_t> request_latencies;         // Whole request latency of every successful request, for the summary
+    uint64_t request_failures = 0;              // Requests without any answer
+    mt19937_64 random{random_device{}()};       // Picks
+
+    int add(char *address);                              // Resolve <ip>[:<port>] and append a replica, -1 if invalid
+    int pick(int exclude = -1);                          // Power of two choices among the replicas except exclude, -1 if none is left
+    void start_request();                                // Earn budget for one request
+    bool take_hedge();                                   // Spend a hedge if the budget allows one
+    uint64_t hedge_delay_us() const;                     // p95 of recent answers (DEFAULT_HEDGE_DELAY_US until MIN_HEDGE_SAMPLES)
+    void sent(int index);                                // A request or hedge went out to a replica
+    void answered(int index, uint64_t latency_us);       // Its answer was used
+    void abandoned(int index, uint64_t elapsed_us);      // Another replica answered first, elapsed is a lower bound of this one's latency
+    void failed(int index);                              // No usable answer
+    void finish_request(bool ok, uint64_t latency_us);   // Whole request done (hedges and retries included)
+    string describe(int index) const;                    // "ip:port" of a replica
+    void log_summary() const;                            // Per replica counts and request latency percentiles
+};
+
+int load_replicas(const string &list, load_balancer &balancer); // Add every comma separated <ip>[:<port>] of list, -1 if one is invalid
+
+#endif // LOAD_BALANCER_H
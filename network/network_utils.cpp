@@ -8,107 +8,335 @@
 #include <netinet/in.h>    // Internet address structs (sockaddr_in)
 #include <arpa/inet.h>     // IP address conversion (inet_pton, htons)
 #include <algorithm>       // For removing commas from string (validate_amount)
+#include <sstream>         // Split grid ranges (parse_grid_message)
+#include <cmath>           // Round grid range counts (floor)
+#include <climits>         // Largest amount/years that fit in an int (INT_MAX)
+#include <sys/uio.h>       // Write a log line in one system call (writev)
+#include <cstdio>          // Parse segment headers (sscanf)
+#include <random>          // Retry jitter (mt19937)
 
 using namespace std;
 
+// Copy a number into a null-terminated buffer for strtod()/strtol(), dropping any commas
+// - Numbers are validated on every request so this avoids allocating a std::string each time
+// Return 0 on success, -1 if the number is too long for the buffer
+static int copy_number(string_view number_str, char (&output)[MAX_NUMBER_LENGTH])
+{
+    size_t length = 0;
+    for (char c : number_str)
+    {
+        if (c == ',')
+            continue; // Remove commas
+        if (length + 1 >= MAX_NUMBER_LENGTH)
+            return -1; // Fail
+        output[length++] = c;
+    }
+    output[length] = '\0';
+    return 0; // Success
+}
+
 // Validate <amount> (don't use $ sign in command line it cuts the input short)
-int validate_amount(string amount_str)
+// - If amount is given it receives the parsed value
+int validate_amount(string_view amount_view, double *amount_out)
 {
-    amount_str.erase(remove(amount_str.begin(), amount_str.end(), ','), amount_str.end()); // Remove commas
-    double amount;
-    try
+    char amount_str[MAX_NUMBER_LENGTH];
+    if (copy_number(amount_view, amount_str) != 0)
     {
-        amount = stod(amount_str);
-        if (amount <= 0)
-        {
-            log("ERROR", "Invalid amount", "Must be positive");
-            return 1;
-        }
+        log("ERROR", "Invalid amount", "Too long");
+        return 1;
+    }
+    // Documentation on strtod - https://en.cppreference.com/w/cpp/string/byte/strtof
+    char *end;
+    errno = 0;
+    double amount = strtod(amount_str, &end);
+    if (end == amount_str || errno == ERANGE)
+    {
+        log("ERROR", "Invalid amount", string(amount_str) + " is not a number");
+        return 1;
     }
-    catch (const exception &e)
+    if (!(amount > 0))
     {
-        log("ERROR", "Invalid amount", amount_str + " is not a number");
+        log("ERROR", "Invalid amount", "Must be positive");
+        return 1;
+    }
+    if (amount > INT_MAX)
+    {
+        // The server calculates with an int amount
+        log("ERROR", "Invalid amount", "Must be at most " + to_string(INT_MAX));
         return 1;
     }
     log("INFO", "Amount is valid", amount_str);
+    if (amount_out != nullptr)
+    {
+        *amount_out = amount;
+    }
     return 0; // Amount is valid
 }
 
-// Valid <years> (no negative, no decimal)
-int validate_years(string years_str)
+// Valid <years> (positive, no decimal, at most MAX_LOAN_YEARS)
+// - If years is given it receives the parsed value
+int validate_years(string_view years_view, int *years_out)
 {
+    char years_str[MAX_NUMBER_LENGTH];
+    if (copy_number(years_view, years_str) != 0)
+    {
+        log("ERROR", "Invalid years", "Too long");
+        return 1;
+    }
     // Check for decimal point
-    if (years_str.find('.') != string::npos)
+    if (strchr(years_str, '.') != nullptr)
     {
-        log("ERROR", "Invalid years", years_str + " is not an integer (has decimal)");
+        log("ERROR", "Invalid years", string(years_str) + " is not an integer (has decimal)");
         return 1;
     }
-    try
+    char *end;
+    errno = 0;
+    long years = strtol(years_str, &end, 10);
+    if (end == years_str || errno == ERANGE || years > INT_MAX || years < INT_MIN)
     {
-        int years = stoi(years_str);
-        if (years <= 0)
-        {
-            log("ERROR", "Invalid years", "Must be positive");
-            return 1;
-        }
+        log("ERROR", "Invalid years", string(years_str) + " is not an integer");
+        return 1;
+    }
+    if (years <= 0)
+    {
+        log("ERROR", "Invalid years", "Must be positive");
+        return 1;
     }
-    catch (const exception &e)
+    if (years > MAX_LOAN_YEARS)
     {
-        log("ERROR", "Invalid years", years_str + " is not an integer");
+        log("ERROR", "Invalid years", "Up to " + to_string(MAX_LOAN_YEARS) + " years");
         return 1;
     }
     log("INFO", "Years are valid", years_str);
+    if (years_out != nullptr)
+    {
+        *years_out = (int)years;
+    }
     return 0; // Years is valid
 }
 
 // Validate <rate> (no negative, can have % sign)
-int validate_rate(string rate_str)
+// - If rate is given it receives the parsed value
+int validate_rate(string_view rate_view, double *rate_out)
 {
     // Remove % if present
-    if (!rate_str.empty() && rate_str.back() == '%')
+    if (!rate_view.empty() && rate_view.back() == '%')
     {
-        rate_str.pop_back();
+        rate_view.remove_suffix(1);
     }
 
-    float rate;
-    try
+    char rate_str[MAX_NUMBER_LENGTH];
+    if (copy_number(rate_view, rate_str) != 0)
     {
-        rate = stof(rate_str);
-        if (rate < 0)
-        {
-            log("ERROR", "Invalid rate", "Must be positive");
-            return 1;
-        }
+        log("ERROR", "Invalid rate", "Too long");
+        return 1;
     }
-    catch (const exception &e)
+    char *end;
+    errno = 0;
+    double rate = strtod(rate_str, &end);
+    if (end == rate_str || errno == ERANGE)
     {
-        log("ERROR", "Invalid rate", rate_str + " is not a number");
+        log("ERROR", "Invalid rate", string(rate_str) + " is not a number");
+        return 1;
+    }
+    if (rate < 0)
+    {
+        log("ERROR", "Invalid rate", "Must be positive");
         return 1;
     }
     log("INFO", "Rate is valid", rate_str);
+    if (rate_out != nullptr)
+    {
+        *rate_out = rate;
+    }
     return 0; // Rate is valid
 }
 
+// Number of values in a min:max:step range, a tiny epsilon keeps 3:8:0.1 from losing its last value to float error
+static long range_count(double min, double max, double step)
+{
+    return (long)floor((max - min) / step + 1e-9) + 1;
+}
+
+long grid_request::amount_count() const
+{
+    return (amount_max - amount_min) / amount_step + 1;
+}
+
+long grid_request::rate_count() const
+{
+    return range_count(rate_min, rate_max, rate_step);
+}
+
+double grid_request::rate_at(long index) const
+{
+    return rate_min + index * rate_step;
+}
+
+// Parse a <min:max:step> range into 3 doubles
+// Return 0 on success, -1 on fail
+static int parse_range(string range_str, double &min, double &max, double &step)
+{
+    range_str.erase(remove(range_str.begin(), range_str.end(), ','), range_str.end()); // Remove commas
+    range_str.erase(remove(range_str.begin(), range_str.end(), '%'), range_str.end()); // Remove % signs
+    replace(range_str.begin(), range_str.end(), ':', ' ');                             // Split on ':'
+    stringstream ss(range_str);
+    string extra;
+    if (!(ss >> min >> max >> step) || (ss >> extra))
+    {
+        log("ERROR", "Invalid range", "Expected <min:max:step>");
+        return -1; // Fail
+    }
+    if (min < 0 || max < min || step <= 0)
+    {
+        log("ERROR", "Invalid range", "Expected 0 <= min <= max and step > 0");
+        return -1; // Fail
+    }
+    return 0; // Success
+}
+
+// Check the request type of a message, e.g. is_command("GRID 1:2:1 3:4:1 30", GRID_COMMAND)
+// Return true if message starts with command followed by a space
+bool is_command(string_view message, string_view command)
+{
+    return message.size() > command.size() && message.compare(0, command.size(), command) == 0 && message[command.size()] == ' ';
+}
+
+// Split "SEG <request_id> <seq> <total>\n<payload>" (see SEGMENT_COMMAND), the payload is a view into the datagram
+// Return 0 on success, -1 if the datagram isn't a well formed segment
+int parse_segment_header(string_view datagram, uint32_t &request_id, int &sequence, int &total, string_view &payload)
+{
+    const size_t header_end = datagram.find('\n');
+    if (!is_command(datagram, SEGMENT_COMMAND) || header_end == string_view::npos || header_end >= MAX_NUMBER_LENGTH)
+    {
+        return -1; // Fail
+    }
+    char header[MAX_NUMBER_LENGTH];
+    memcpy(header, datagram.data(), header_end);
+    header[header_end] = '\0';
+
+    unsigned long id;
+    if (sscanf(header + SEGMENT_COMMAND.size(), " %lu %d %d", &id, &sequence, &total) != 3 ||
+        id > UINT32_MAX || total < 1 || total > MAX_SEGMENTS || sequence < 0 || sequence >= total)
+    {
+        return -1; // Fail
+    }
+    request_id = (uint32_t)id;
+    payload = datagram.substr(header_end + 1);
+    return 0; // Success
+}
+
+// Read OVERLOADED <ms>, the hint is clamped to MIN_RETRY_AFTER_MS..MAX_RETRY_AFTER_MS whatever the server sent
+// Return 0 if response is an OVERLOADED response, 1 otherwise
+int parse_overloaded(string_view response, int &retry_after_ms)
+{
+    if (!is_command(response, OVERLOADED_RESPONSE))
+    {
+        return 1; // Not shed
+    }
+    long value = 0;
+    for (char c : response.substr(OVERLOADED_RESPONSE.size() + 1))
+    {
+        if (c < '0' || c > '9')
+            break;
+        value = min(value * 10 + (c - '0'), (long)MAX_RETRY_AFTER_MS);
+    }
+    retry_after_ms = (int)max(value, (long)MIN_RETRY_AFTER_MS);
+    return 0;
+}
+
+// Full hint plus up to the same again, a burst of requests shed together comes back spread over the next interval
+// - A request that would come back with less than one more hint before its deadline gives up instead: under a sustained overload it is
+//   shed again, or admitted so late that it times out while the server computes it, either way it only takes room from fresh requests
+// Return milliseconds to wait, -1 to give up (left_us: time until the request's deadline)
+int retry_wait_ms(int retry_after_ms, uint64_t left_us)
+{
+    static thread_local mt19937 random{random_device{}()};
+    const int wait_ms = retry_after_ms + (int)(random() % (unsigned)(retry_after_ms + 1));
+    return (uint64_t)(wait_ms + retry_after_ms) * 1000 > left_us ? -1 : wait_ms;
+}
+
+// Validate and parse GRID <amount_min:amount_max:amount_step> <rate_min:rate_max:rate_step> <years/years/...>
+// - Example: GRID 100000:1000000:50000 3:8:0.25 15/20/30
+// Return 0 on success, -1 on fail
+int parse_grid_message(const string &message, grid_request &grid)
+{
+    const long MAX_GRID_COLUMNS = 10000; // Limit on rates * terms, keeps every streamed row (and server memory) bounded
+
+    stringstream ss(message);
+    string command, amounts_str, rates_str, years_str, extra;
+    if (!(ss >> command >> amounts_str >> rates_str >> years_str) || command != GRID_COMMAND || (ss >> extra))
+    {
+        log("ERROR", "Invalid grid request", "Usage: GRID <amount_min:amount_max:amount_step> <rate_min:rate_max:rate_step> <years/years/...>");
+        return -1; // Fail
+    }
+
+    double amount_min, amount_max, amount_step;
+    if (parse_range(amounts_str, amount_min, amount_max, amount_step) != 0 || parse_range(rates_str, grid.rate_min, grid.rate_max, grid.rate_step) != 0)
+    {
+        return -1; // Fail
+    }
+    // Checked before the casts below, a step like 1e12 doesn't fit an int
+    if (amount_min <= 0 || amount_max > 2147483647 || amount_step > 2147483647 || amount_min != floor(amount_min) || amount_max != floor(amount_max) || amount_step != floor(amount_step))
+    {
+        log("ERROR", "Invalid grid amounts", "Must be positive integers up to 2147483647");
+        return -1; // Fail
+    }
+    grid.amount_min = (int)amount_min;
+    grid.amount_max = (int)amount_max;
+    grid.amount_step = (int)amount_step;
+
+    // Years are separated by '/' since commas are stripped from messages
+    grid.term_count = 0;
+    replace(years_str.begin(), years_str.end(), '/', ' ');
+    stringstream years_ss(years_str);
+    string year;
+    while (years_ss >> year)
+    {
+        if (grid.term_count == MAX_GRID_TERMS || validate_years(year, &grid.years[grid.term_count]) != 0)
+        {
+            log("ERROR", "Invalid grid years", "Up to " + to_string(MAX_GRID_TERMS) + " positive integers separated by /");
+            return -1; // Fail
+        }
+        grid.term_count++;
+    }
+    if (grid.term_count == 0)
+    {
+        log("ERROR", "Invalid grid years", "At least one term is required");
+        return -1; // Fail
+    }
+
+    if (grid.rate_count() * grid.term_count > MAX_GRID_COLUMNS)
+    {
+        log("ERROR", "Grid too wide", "rates * terms must be at most " + to_string(MAX_GRID_COLUMNS));
+        return -1; // Fail
+    }
+
+    log("INFO", "Grid is valid", to_string(grid.amount_count()) + " amounts x " + to_string(grid.term_count) + " terms x " + to_string(grid.rate_count()) + " rates");
+    return 0; // Success
+}
+
 // Extra: Consistent formatting for cout messages
-void log(const string &level, const string &msg, const string &detail)
+// - Written with a single writev() so lines from different threads don't interleave, and so logging a request
+//   doesn't allocate (messages are string_views into the caller's buffers)
+void log(string_view level, string_view msg, string_view detail)
 {
     // Extra: This is just a stylistic way to consistently log all messages with timestamps
 
     // Get current time
     time_t now = time(nullptr);
-    struct tm *local_time = localtime(&now);
+    struct tm local_time;
+    localtime_r(&now, &local_time);
 
     // Format timestamp as HH:MM:SS
-    stringstream ss;
-    ss << setfill('0') << setw(2) << local_time->tm_hour << ":"
-       << setfill('0') << setw(2) << local_time->tm_min << ":"
-       << setfill('0') << setw(2) << local_time->tm_sec;
+    char timestamp[16];
+    size_t timestamp_length = strftime(timestamp, sizeof(timestamp), "[%H:%M:%S] ", &local_time);
 
     // I'm color coding INFO vs WARNING vs ERROR
-    const string RESET = "\033[0m";
-    const string GRAY = "\033[90m";
-    const string TIMESTAMP_COLOR = "\033[36m";
-    string color;
+    static const string_view RESET = "\033[0m";
+    static const string_view GRAY = "\033[90m";
+    static const string_view TIMESTAMP_COLOR = "\033[36m";
+    string_view color;
     if (level == "ERROR")
     {
         color = "\033[31m"; // Red
@@ -125,10 +353,15 @@ void log(const string &level, const string &msg, const string &detail)
     {
         color = RESET;
     }
-    cerr << TIMESTAMP_COLOR << "[" << ss.str() << "] " << color << "[" << level << "] " << RESET << msg << GRAY;
-    if (!detail.empty())
-    {
-        cerr << ": " << detail;
-    }
-    cerr << RESET << endl;
+
+    // Same layout as before: <cyan>[time] <color>[level] <reset>msg<gray>: detail<reset>
+    // Documentation on writev - https://man7.org/linux/man-pages/man2/writev.2.html
+    auto piece = [](string_view text)
+    { return iovec{(void *)text.data(), text.size()}; };
+    iovec pieces[] = {
+        piece(TIMESTAMP_COLOR), piece(string_view(timestamp, timestamp_length)), piece(color),
+        piece("["), piece(level), piece("] "), piece(RESET), piece(msg), piece(GRAY),
+        piece(detail.empty() ? "" : ": "), piece(detail), piece(RESET), piece("\n")};
+    ssize_t written = writev(STDERR_FILENO, pieces, sizeof(pieces) / sizeof(pieces[0]));
+    (void)written; // Nothing sensible to do if stderr is gone
 }
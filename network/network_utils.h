@@ -3,6 +3,13 @@
 #ifndef NETWORK_UTILS_H
 #define NETWORK_UTILS_H
 #define SERVER_PORT 13000 // Default server port for TCP and UDP
+#define MAX_GRID_TERMS 8   // Max number of <years> in one grid request
+#define MAX_LOAN_YEARS 40  // Longest <years> accepted by any request (keeps years * 12 months small)
+#define MAX_NUMBER_LENGTH 64 // Longest <amount> <years> or <rate> accepted (validation copies numbers into a stack buffer of this size)
+#define SEGMENT_PAYLOAD_SIZE 1200 // Response bytes per segmented UDP datagram (header included it stays well under a 1500 byte MTU)
+#define MAX_SEGMENTS 64           // Segments per UDP response, one bit each in the segment bitmap
+#define MIN_RETRY_AFTER_MS 5      // Shortest retry hint in an OVERLOADED response
+#define MAX_RETRY_AFTER_MS 1000   // Longest retry hint in an OVERLOADED response (the clients' old fixed retry interval)
 
 #include <iostream>     // For terminal input/output
 #include <cstring>      // CLIENT: String length (strlen()) SERVER: memset
@@ -12,12 +19,45 @@
 #include <unistd.h>     // Close socket (close())
 #include <netinet/in.h> // Internet address structs (sockaddr_in)
 #include <arpa/inet.h>  // IP address conversion (inet_pton, htons)
+#include <string_view>  // Read numbers and log messages straight from receive buffers without copying
+#include <cstdint>      // Fixed size segment request ids (uint32_t)
 
 using namespace std; // Probably not best practice but I don't like typeing std::[name] everywhere
 
-int validate_amount(string prevalidated_amount);                             // Validate <amount> (no negative, no decimal, must be a number) (don't use $ sign in command line it cuts the input short)
-int validate_years(string prevalidated_years);                               // Validate <years> (no negative, no decimal, must be a number)
-int validate_rate(string prevalidated_rate);                                 // Validate <rate> (no negative, must be a number, can have % sign)
-void log(const string &level, const string &msg, const string &detail = ""); // Extra: Consistent formatting for cout messages
+const string BUSY_RESPONSE = "BUSY";                      // Compact reply to a client that is over its rate limit
+const string OVERLOADED_RESPONSE = "OVERLOADED";          // Server shedding load (--admission): OVERLOADED <retry_after_ms>, the client waits that long before retrying
+const char MESSAGE_TERMINATOR = '\n';                     // Ends every TCP request so the server knows the whole message arrived
+const string GRID_COMMAND = "GRID";                       // Grid request prefix: GRID <amount_min:amount_max:amount_step> <rate_min:rate_max:rate_step> <years/years/...>
+const string PRINCIPAL_COMMAND = "PRINCIPAL";             // Largest affordable loan: PRINCIPAL <payment> <years> <rate>
+const string RATE_COMMAND = "RATE";                       // Rate implied by a payment: RATE <payment> <amount> <years>
+const string PRINCIPAL_BATCH_COMMAND = "PRINCIPAL_BATCH"; // Many principal solves: PRINCIPAL_BATCH <payment:years:rate> ...
+const string RATE_BATCH_COMMAND = "RATE_BATCH";           // Many rate solves: RATE_BATCH <payment:amount:years> ...
+const string SCHEDULE_COMMAND = "SCHEDULE";               // Amortization schedule: SCHEDULE <amount> <years> <rate>
+const string SCENARIO_COMMAND = "SCENARIO";               // What-if scenarios: SCENARIO <amount> <years> <rate> <event>+<event>... ...
+const string SEGMENT_COMMAND = "SEG";                     // Segmented UDP request SEG <request_id> <message>, every response datagram starts with SEG <request_id> <seq> <total>\n
+const string NACK_COMMAND = "NACK";                       // Resend missing segments: NACK <request_id> <missing segment bitmap in hex>
+const string FIN_COMMAND = "FIN";                         // Every segment arrived: FIN <request_id> (server forgets the response)
+
+// Payment grid requested by a client, every amount is combined with every term and every rate
+struct grid_request
+{
+    int amount_min, amount_max, amount_step;      // Loan amounts (no decimals, same as <amount>)
+    double rate_min, rate_max, rate_step;         // Annual rates in percent (same as <rate>)
+    int years[MAX_GRID_TERMS];                    // Loan terms in years (same as <years>)
+    int term_count;                               // Number of entries used in years[]
+    long amount_count() const;                    // Number of amounts in the range
+    long rate_count() const;                      // Number of rates in the range
+    double rate_at(long index) const;             // Rate for a column index (computed from rate_min to avoid adding up float error)
+};
+
+int validate_amount(string_view prevalidated_amount, double *amount = nullptr); // Validate <amount> (no negative, no decimal, must be a number) (don't use $ sign in command line it cuts the input short)
+int validate_years(string_view prevalidated_years, int *years = nullptr);       // Validate <years> (no negative, no decimal, must be a number)
+int validate_rate(string_view prevalidated_rate, double *rate = nullptr);       // Validate <rate> (no negative, must be a number, can have % sign)
+bool is_command(string_view message, string_view command);                      // True if message starts with command followed by a space (e.g. "GRID ...")
+int parse_grid_message(const string &message, grid_request &grid);              // Validate and parse a GRID message (used by client before sending and by server on receive)
+int parse_segment_header(string_view datagram, uint32_t &request_id, int &sequence, int &total, string_view &payload); // Split a segmented UDP response datagram into header fields and payload
+int parse_overloaded(string_view response, int &retry_after_ms);                 // Read the hint of an OVERLOADED <ms> response, 1 if response is something else
+int retry_wait_ms(int retry_after_ms, uint64_t left_us);                        // Hint plus a random share of it (shed clients don't all come back at once), -1 if the deadline is too close
+void log(string_view level, string_view msg, string_view detail = "");          // Extra: Consistent formatting for cout messages
 
 #endif // NETWORK_UTILS_H
@@ -0,0 +1,160 @@
+#include "tcp_stats.h" // TCP_INFO sampling and histograms
+
+#include <linux/tcp.h> // struct tcp_info with busy/rwnd_limited times (the glibc copy stops before them)
+#include <cstdio>      // Summaries (snprintf)
+#include <cstdlib>     // Parse request ids (strtoull)
+#include <algorithm>   // min
+
+void log2_histogram::add(uint64_t value)
+{
+    const int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value); // Bit length of the value
+    buckets[bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1]++;
+    count++;
+    sum += value;
+    if (value > max)
+    {
+        max = value;
+    }
+}
+
+uint64_t log2_histogram::percentile(double p) const
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    const uint64_t rank = (uint64_t)(p / 100 * count + 0.5); // Values at or below the percentile
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+    {
+        seen += buckets[bucket];
+        if (seen >= rank && seen > 0)
+        {
+            const uint64_t upper = bucket == 0 ? 0 : (bucket >= 63 ? UINT64_MAX : (1ULL << bucket) - 1);
+            return upper < max ? upper : max; // Never report more than was seen
+        }
+    }
+    return max;
+}
+
+// Outliers are judged against the histograms before the sample is added, so one slow request stands out on its own
+bool tcp_stats::add(const tcp_sample &sample)
+{
+    bool outlier = sample.retransmits > 0 || sample.rwnd_limited_us > 0;
+    if (samples >= MIN_OUTLIER_SAMPLES)
+    {
+        outlier = outlier || sample.rtt_us > rtt.percentile(99) || sample.total_us > total.percentile(99);
+    }
+
+    rtt.add(sample.rtt_us);
+    rttvar.add(sample.rttvar_us);
+    cwnd.add(sample.cwnd);
+    busy.add(sample.busy_us);
+    rwnd_limited.add(sample.rwnd_limited_us);
+    wait.add(sample.wait_us);
+    total.add(sample.total_us);
+    samples++;
+    retransmits += sample.retransmits;
+    retransmitting += sample.retransmits > 0;
+    outliers += outlier;
+    return outlier;
+}
+
+string tcp_stats::summary() const
+{
+    char line[TCP_SUMMARY_SIZE];
+    return string(line, format_summary(line, sizeof(line)));
+}
+
+// Example: 1000 samples, rtt us p50 64 p99 255 max 412, ...
+// Return length written (without the terminating 0)
+size_t tcp_stats::format_summary(char *output, size_t capacity) const
+{
+    int length = snprintf(output, capacity,
+                          "%llu samples, %llu outliers | rtt us p50 %llu p99 %llu max %llu | rttvar us p50 %llu p99 %llu | "
+                          "retransmits %llu in %llu samples | cwnd p1 %llu p50 %llu | busy us p99 %llu | rwnd limited us p99 %llu max %llu | "
+                          "wait us p50 %llu p99 %llu | total us p50 %llu p99 %llu max %llu",
+                          (unsigned long long)samples, (unsigned long long)outliers,
+                          (unsigned long long)rtt.percentile(50), (unsigned long long)rtt.percentile(99), (unsigned long long)rtt.max,
+                          (unsigned long long)rttvar.percentile(50), (unsigned long long)rttvar.percentile(99),
+                          (unsigned long long)retransmits, (unsigned long long)retransmitting,
+                          (unsigned long long)cwnd.percentile(1), (unsigned long long)cwnd.percentile(50),
+                          (unsigned long long)busy.percentile(99),
+                          (unsigned long long)rwnd_limited.percentile(99), (unsigned long long)rwnd_limited.max,
+                          (unsigned long long)wait.percentile(50), (unsigned long long)wait.percentile(99),
+                          (unsigned long long)total.percentile(50), (unsigned long long)total.percentile(99), (unsigned long long)total.max);
+    return length < 0 ? 0 : min((size_t)length, capacity - 1);
+}
+
+// Documentation on TCP_INFO - https://man7.org/linux/man-pages/man7/tcp.7.html
+// Return 0 on success, -1 on fail
+int sample_tcp_info(int socket, tcp_sample &sample)
+{
+    tcp_info info{}; // Older kernels fill fewer fields, the rest stay 0
+    socklen_t length = sizeof(info);
+    if (getsockopt(socket, IPPROTO_TCP, TCP_INFO, &info, &length) == -1)
+    {
+        return -1; // Fail
+    }
+    sample.rtt_us = info.tcpi_rtt;
+    sample.rttvar_us = info.tcpi_rttvar;
+    sample.retransmits = info.tcpi_total_retrans;
+    sample.cwnd = info.tcpi_snd_cwnd;
+    sample.unacked = info.tcpi_unacked;
+    sample.busy_us = info.tcpi_busy_time;
+    sample.rwnd_limited_us = info.tcpi_rwnd_limited;
+    sample.sndbuf_limited_us = info.tcpi_sndbuf_limited;
+    return 0; // Success
+}
+
+string describe_sample(const tcp_sample &sample)
+{
+    char line[TCP_SAMPLE_SIZE];
+    return string(line, format_sample(sample, line, sizeof(line)));
+}
+
+// Return length written (without the terminating 0)
+size_t format_sample(const tcp_sample &sample, char *output, size_t capacity)
+{
+    int length = snprintf(output, capacity,
+                          "request %llu | rtt %u us, rttvar %u us, retransmits %u, cwnd %u, unacked %u | busy %llu us, rwnd limited %llu us, sndbuf limited %llu us | wait %llu us, total %llu us",
+                          (unsigned long long)sample.request_id, sample.rtt_us, sample.rttvar_us, sample.retransmits, sample.cwnd, sample.unacked,
+                          (unsigned long long)sample.busy_us, (unsigned long long)sample.rwnd_limited_us, (unsigned long long)sample.sndbuf_limited_us,
+                          (unsigned long long)sample.wait_us, (unsigned long long)sample.total_us);
+    return length < 0 ? 0 : min((size_t)length, capacity - 1);
+}
+
+uint64_t monotonic_us()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Split ID <request_id> <message>
+// Return 0 with request_id and request filled in, 1 if message has no ID prefix, -1 if the id is malformed
+int parse_request_id(string_view message, uint64_t &request_id, string_view &request)
+{
+    if (!is_command(message, REQUEST_ID_COMMAND))
+    {
+        return 1; // No id
+    }
+    message = message.substr(REQUEST_ID_COMMAND.size() + 1);
+    const size_t space = message.find(' ');
+    char digits[MAX_NUMBER_LENGTH];
+    if (space == string_view::npos || space == 0 || space >= sizeof(digits))
+    {
+        return -1; // Fail
+    }
+    memcpy(digits, message.data(), space);
+    digits[space] = '\0';
+    char *end;
+    errno = 0;
+    request_id = strtoull(digits, &end, 10);
+    if (*end != '\0' || errno != 0 || digits[0] == '-')
+    {
+        return -1; // Fail
+    }
+    request = message.substr(space + 1);
+    return 0; // Success
+}
@@ -0,0 +1,66 @@
+// Kernel-level TCP statistics (getsockopt TCP_INFO) shared by TCPServer and TCPClient
+// A sample is taken once per request just before the connection closes, next to the application's own timings,
+// so a slow request can be blamed on the network (RTT, retransmits), the kernel queues (receive window, unacked data) or the handler
+// Samples go into log2 histograms (fixed memory, one increment per value) and unusual ones are logged in full with their request id
+#ifndef TCP_STATS_H
+#define TCP_STATS_H
+#include "network_utils.h" // Headers shared by client & server
+
+#include <string> // Summaries are logged as strings
+
+#define HISTOGRAM_BUCKETS 64    // Bucket i counts values in [2^(i-1), 2^i), bucket 0 counts zeros
+#define MIN_OUTLIER_SAMPLES 100 // Percentile based outliers are only reported once the histograms mean something
+#define TCP_SUMMARY_SIZE 640    // Fits one summary line
+#define TCP_SAMPLE_SIZE 320     // Fits one sample description
+
+const string REQUEST_ID_COMMAND = "ID"; // Optional TCP request prefix: ID <request_id> <message>, the server logs the same id with its samples
+
+// Powers of two histogram, percentiles are the upper bound of the bucket they fall in (within 2x)
+struct log2_histogram
+{
+    uint64_t buckets[HISTOGRAM_BUCKETS] = {}; // Value counts per bucket
+    uint64_t count = 0;                       // Values added
+    uint64_t sum = 0;                         // For the mean
+    uint64_t max = 0;                         // Largest value added
+
+    void add(uint64_t value);
+    uint64_t percentile(double p) const; // Upper bound of the bucket holding percentile p, 0 if empty
+};
+
+// One TCP_INFO sample plus the application timings of the same request
+struct tcp_sample
+{
+    uint64_t request_id = 0;        // Client chosen (ID prefix) or assigned by the server
+    uint32_t rtt_us = 0;            // Smoothed round trip time
+    uint32_t rttvar_us = 0;         // Round trip time variance
+    uint32_t retransmits = 0;       // Segments retransmitted over the whole connection
+    uint32_t cwnd = 0;              // Congestion window (segments)
+    uint32_t unacked = 0;           // Segments sent and not acknowledged yet
+    uint64_t busy_us = 0;           // Time with unacknowledged data in flight
+    uint64_t rwnd_limited_us = 0;   // Time sending was stalled by the peer's receive window
+    uint64_t sndbuf_limited_us = 0; // Time sending was stalled by our send buffer
+    uint64_t wait_us = 0;           // Server: accept to complete request, client: connect()
+    uint64_t total_us = 0;          // Server: accept to response sent, client: connect() to response received
+};
+
+// Aggregate of every sample taken by one process
+struct tcp_stats
+{
+    log2_histogram rtt, rttvar, cwnd, busy, rwnd_limited, wait, total; // Microseconds (cwnd in segments)
+    uint64_t samples = 0;                                              // Samples added
+    uint64_t retransmits = 0;                                          // Sum over every sample
+    uint64_t retransmitting = 0;                                       // Samples with at least one retransmit
+    uint64_t outliers = 0;                                             // Samples reported by add()
+
+    bool add(const tcp_sample &sample);                         // Add a sample, true if it is an outlier (retransmits, receive window stalls or above the p99 RTT/latency so far)
+    string summary() const;                                     // One line with percentiles of every histogram
+    size_t format_summary(char *output, size_t capacity) const; // summary() without allocating (request path), returns length written
+};
+
+int sample_tcp_info(int socket, tcp_sample &sample);                                   // Fill the kernel fields of sample, -1 if TCP_INFO isn't available
+string describe_sample(const tcp_sample &sample);                                      // Every field of one sample for outlier dumps
+size_t format_sample(const tcp_sample &sample, char *output, size_t capacity);         // describe_sample() without allocating, returns length written
+uint64_t monotonic_us();                                                               // Microseconds from CLOCK_MONOTONIC for the application timings
+int parse_request_id(string_view message, uint64_t &request_id, string_view &request); // Split ID <request_id> <message>, 1 if there is no ID prefix, -1 if malformed
+
+#endif // TCP_STATS_H
@@ -1,19 +1,466 @@
-#include "server_utils.h" // Server specific headers
+#include "server_utils.h"         // Server specific headers
+#include "hot_restart.h"          // Socket handoff between old and new server process
+#include "grid.h"                 // Payment grid requests
+#include "rate_limiter.h"         // Per-client token buckets
+#include "alloc_counter.h"        // Allocation counting test hook
+#include "solvers.h"              // Inverse solvers (PRINCIPAL, RATE and batches)
+#include "scenarios.h"            // What-if scenarios (SCENARIO)
+#include "timer_wheel.h"          // Per-connection deadlines
+#include "recorder.h"             // --record traffic recording
+#include "work_pool.h"            // Compute pool for heavy requests (--workers)
+#include "admission.h"            // --admission concurrency limit and load shedding
+#include "../network/tcp_stats.h" // --tcp-info sampling
 
-#define MAX_PENDING_CONNECTIONS 5 // Max pending connections
+#include <sys/epoll.h>    // Wait on the listening socket, the hot restart socket and every client connection at once (epoll)
+#include <sys/resource.h> // Raise the open file limit to fit every connection (setrlimit)
+#include <fcntl.h>        // Non-blocking sockets (fcntl)
+#include <thread>         // I/O threads, grid streams run on their own thread
+#include <atomic>         // Count running grid streams across threads
+#include <memory>         // One event loop per I/O thread (unique_ptr)
+#include <vector>         // Event loops and their threads
 
-const int MESSAGE_BUFFER_SIZE = 1024; // Client message buffer size in bytes
+#define MAX_PENDING_CONNECTIONS 4096 // Max pending connections (queues clients through a hot restart, and through a batch on the loop until accept-time shedding answers them)
+#define MAX_CONNECTIONS 1024         // Connections served at once, accepting pauses (new clients wait in the backlog) while all are open
+#define MAX_EPOLL_EVENTS 64          // Events handled per epoll_wait() call
+#define TCP_STATS_INTERVAL 1000      // TCP_INFO samples between summaries (with --tcp-info)
+#define MAX_ACCEPT_BATCH 64          // Connections accepted per listening socket event, the rest wait for the next epoll_wait()
+#define MAX_ACTIVE_GRIDS 4           // Grid streams running at once (each starts a worker per core), more are answered OVERLOADED
 
-int respond(int c_socket, string &validated_client_message); // Send response to client
+const string HANDOFF_PATH = "/tmp/TCPServer.handoff"; // Unix socket used for hot restart
+const uint64_t LISTEN_EVENT = UINT32_MAX;             // epoll tag of the listening socket (connections use their slot index)
+const uint64_t CONTROL_EVENT = UINT32_MAX - 1;        // epoll tag of the hot restart socket
+const uint64_t COMPLETION_EVENT = UINT32_MAX - 2;     // epoll tag of the I/O thread's completion port (finished compute work, drain requests)
+const int DRAIN_POLL_INTERVAL = 100;                  // Milliseconds between checks for finished grid streams while draining
+
+// Where a connection is in its single request/response exchange, decides which deadline applies
+enum connection_stage
+{
+    STAGE_IDLE,     // Connected, no byte of the request yet (idle deadline)
+    STAGE_READING,  // Part of the request arrived, waiting for the terminator (read deadline, restarts with every chunk)
+    STAGE_WRITING,  // Response built, waiting for the client to take the rest of it (idle deadline)
+    STAGE_COMPUTING // Request handed to the compute pool, no socket events or deadlines until it comes back (request deadline checked then)
+};
+
+// One client connection, every connection lives in a fixed pool so accepting never allocates
+struct connection
+{
+    int c_socket = -1;                     // Client socket, -1 while the slot is free
+    int slot = 0;                          // Index in the pool
+    uint32_t generation = 0;               // Bumped on every reuse so late epoll events for a closed connection are ignored
+    connection_stage stage = STAGE_IDLE;   // Current stage
+    uint64_t request_deadline = 0;         // Absolute ms by which the response must be sent, 0 without --request-timeout
+    size_t bytes_sent = 0;                 // Bytes of the response already sent
+    uint64_t request_id = 0;               // Client chosen (ID prefix) or assigned, 0 until the request arrived
+    uint64_t accepted_us = 0;              // Microseconds at accept (with --tcp-info)
+    uint64_t request_us = 0;               // Microseconds when the whole request arrived (with --tcp-info)
+    bool admitted = false;                 // Holds one of the loop's admission slots (with --admission)
+    uint64_t arrived_us = 0;               // Microseconds when the request's last bytes reached the socket (with --admission)
+    sockaddr_in address{};                 // Client address (recorded with --record)
+    char client_name[INET_ADDRSTRLEN + 8]; // "ip:port" for logging
+    size_t client_name_length = 0;         // Bytes of client_name in use
+    timer_node timer;                      // Fires at the earliest of the stage deadline and the request deadline
+    work_item work;                        // Handed to the compute pool for heavy requests (with --workers)
+    request_arena arena;                   // This connection's receive/transmit buffers
+};
+
+// Connections closed by each kind of deadline, logged with every expiry
+struct deadline_counters
+{
+    uint64_t idle = 0;    // Nothing sent within --idle-timeout
+    uint64_t read = 0;    // Request stalled for --read-timeout
+    uint64_t write = 0;   // Response not taken within --idle-timeout
+    uint64_t request = 0; // Whole exchange took longer than --request-timeout
+};
+
+// Everything one I/O thread works on, one instance per --io-threads
+// Loops share only the listening socket, the rate limiter and the compute pool, a connection stays on the loop that accepted it
+struct event_loop
+{
+    server_options options;                  // Deadlines etc.
+    int index = 0;                           // I/O thread number, loop 0 runs on the main thread and owns the hot restart socket
+    int epoll_fd = -1;                       // epoll instance
+    int s_socket = -1;                       // Listening socket (shared by every loop)
+    int control_socket = -1;                 // Hot restart socket (loop 0 only), -1 after the handoff
+    bool accepting = false;                  // Listening socket is in epoll (false while the pool is full or out of descriptors)
+    bool draining = false;                   // Socket handed to a new process, exit once open connections finish
+    rate_limiter *limiter = nullptr;         // Shared by every loop (lock-free)
+    work_pool *pool = nullptr;               // Compute pool, nullptr without --workers
+    completion_port completions;             // Finished compute work comes back here
+    uint32_t next_queue = 0;                 // Round-robin cursor over the pool's queues
+    uint64_t offloaded = 0;                  // Requests computed by the pool
+    uint64_t pool_full = 0;                  // Heavy requests computed here because every pool queue was full
+    timer_wheel wheel;                       // Connection deadlines
+    deadline_counters expired;               // Expiry metrics
+    traffic_recorder recorder;               // Requests recorded for replay (only with --record, every loop appends to the same file)
+    tcp_stats tcp;                           // TCP_INFO histograms (only with --tcp-info)
+    admission_control admission;             // Concurrency limit of this loop's requests (only with --admission)
+    connection connections[MAX_CONNECTIONS]; // Connection pool
+    int free_slots[MAX_CONNECTIONS];         // Stack of unused pool slots
+    int free_count = 0;                      // Entries in free_slots
+    int active = 0;                          // Open connections
+
+    event_loop(const server_options &options, int index);
+};
+
+static_assert(WORK_QUEUE_CAPACITY >= MAX_CONNECTIONS, "A completion port must hold every connection of its loop");
+
+static atomic<int> active_grids{0};          // Grid streams still running on their own thread
+static atomic<uint64_t> next_request_id{1};  // Assigned to requests without an ID prefix (unique across loops)
+static atomic<bool> handed_off{false};       // Loop 0 handed the listening socket to a new process, every loop drains
+static vector<unique_ptr<event_loop>> loops; // One per I/O thread, allocated at startup (each holds a large connection pool)
+
+int create_listening_socket(int port);                                                // Create, bind and listen on the server socket
+void raise_file_limit(int connections);                                               // Allow one descriptor per connection
+int open_event_loop(event_loop &loop);                                                // Create the loop's epoll and completion port
+void run_event_loop(event_loop &loop);                                                // Serve connections until drained after a hot restart
+void start_draining(event_loop &loop, uint64_t now);                                  // Stop accepting, exit once open connections finish
+void set_accepting(event_loop &loop, bool accepting);                                 // Add or remove the listening socket from epoll
+void accept_connections(event_loop &loop, rate_limiter &limiter, uint64_t now);       // Accept every pending client
+void schedule_deadline(event_loop &loop, connection &conn, uint64_t now);             // Arm the connection's timer for its current stage
+void read_request(event_loop &loop, connection &conn, uint64_t now);                  // Receive until the message terminator arrives
+void process_request(event_loop &loop, connection &conn, uint64_t now);               // Dispatch a complete message
+int admit_request(event_loop &loop, connection &conn);                                // Take an admission slot or answer OVERLOADED <ms> (with --admission)
+bool shed_connection(event_loop &loop, int c_socket);                                 // Answer OVERLOADED <ms> at accept while the loop is over its limit (with --admission)
+void refuse_connection(int c_socket, string_view response);                           // Send a short refusal (BUSY, OVERLOADED <ms>) and close without reading the request
+int compute_response(string_view message, request_arena &arena);                      // Build the response for a quote, solver, schedule or scenario message
+int compute_work(work_item &item);                                                    // compute_response() on a pool worker
+void finish_work(event_loop &loop, connection &conn, uint64_t now);                   // Send the response the compute pool built
+void start_grid_stream(event_loop &loop, connection &conn, const grid_request &grid); // Hand the connection to a grid streaming thread
+int respond(event_loop &loop, connection &conn, uint64_t now);                        // Send (the rest of) the response built in the arena
+void expire_connection(event_loop &loop, connection &conn, uint64_t now);             // Close a connection whose deadline passed (answer an unterminated message)
+void sample_connection(event_loop &loop, connection &conn);                           // Add the connection's TCP_INFO to the histograms (with --tcp-info)
+void release_connection(event_loop &loop, connection &conn);                          // Return a slot to the pool (socket not closed)
+void close_connection(event_loop &loop, connection &conn);                            // Close the socket and return the slot to the pool
+
+// Tag stored in epoll_event.data: generation in the high half, slot index in the low half
+static inline uint64_t connection_tag(const connection &conn)
+{
+    return ((uint64_t)conn.generation << 32) | (uint32_t)conn.slot;
+}
+
+event_loop::event_loop(const server_options &options, int index)
+    : options(options), index(index), wheel(monotonic_ms()), admission(options.target_latency, ADMISSION_MAX_LIMIT)
+{
+    for (int i = MAX_CONNECTIONS - 1; i >= 0; i--)
+    {
+        connections[i].slot = i;
+        connections[i].timer.owner = &connections[i];
+        connections[i].work.arena = &connections[i].arena;
+        connections[i].work.port = &completions;
+        connections[i].work.owner = &connections[i];
+        free_slots[free_count++] = i;
+    }
+}
 
 int main(int argc, char *argv[])
+{
+    server_options options;
+    if (parse_server_options(argc, argv, options) != 0)
+    {
+        return 1; // Exit program
+    }
+
+    // Event loops (connection pools, deadlines, recording and epoll state) and the compute pool are set up
+    // before a hot restart takes over the socket so a recording or thread that can't be created never causes an outage
+    static work_pool pool; // Compute threads shared by every loop (only with --workers)
+    if (options.workers > 0 && pool.start(options.workers, compute_work) != 0)
+    {
+        return 1; // Exit program
+    }
+    for (int i = 0; i < options.io_threads; i++)
+    {
+        loops.push_back(make_unique<event_loop>(options, i)); // Heap since the connection pool is large and should not live on the stack
+        event_loop &loop = *loops.back();
+        loop.pool = options.workers > 0 ? &pool : nullptr;
+        if (open_event_loop(loop) != 0 || (!options.record_path.empty() && loop.recorder.open(options.record_path, TRANSPORT_TCP) != 0))
+        {
+            return 1; // Exit program
+        }
+    }
+
+    // With hot restart, take over the listening socket of a running server instead of binding a new one
+    // The socket never closes so connections queued in the backlog are simply accepted by this process
+    // A replica on another port hands off to its own successor only
+    const string handoff_path = options.port == SERVER_PORT ? HANDOFF_PATH : HANDOFF_PATH + "." + to_string(options.port);
+    int s_socket = -1;
+    if (options.hot_restart)
+    {
+        int sockets[MAX_HANDOFF_SOCKETS];
+        int socket_count = 0;
+        string warm_state; // No warm state for TCP yet
+        int handoff = request_handoff(handoff_path, sockets, socket_count, warm_state);
+        if (handoff == -1)
+        {
+            return 1; // Exit program
+        }
+        if (handoff == 0)
+        {
+            s_socket = sockets[0]; // Already bound and listening
+        }
+    }
+    if (s_socket == -1)
+    {
+        s_socket = create_listening_socket(options.port);
+        if (s_socket == -1)
+        {
+            return 1; // Exit program
+        }
+    }
+    fcntl(s_socket, F_SETFL, fcntl(s_socket, F_GETFL) | O_NONBLOCK); // accept() until EAGAIN without ever blocking the loop
+    if (options.admission && set_receive_timestamps(s_socket) != 0)
+    {
+        close(s_socket);
+        return 1; // Exit program
+    }
+
+    // Listen for a future replacement process (only with hot restart)
+    int control_socket = -1;
+    if (options.hot_restart)
+    {
+        control_socket = open_handoff_listener(handoff_path);
+        if (control_socket == -1)
+        {
+            close(s_socket);
+            return 1; // Exit program
+        }
+    }
+
+    // Static since the peer table is large and should not live on the stack
+    static rate_limiter limiter(options.rate_limit, options.rate_burst); // Per-client rate limiting (disabled unless --rate-limit is given)
+    raise_file_limit(options.io_threads * MAX_CONNECTIONS);
+
+    // Every loop waits on the same listening socket, EPOLLEXCLUSIVE wakes one of them per new connection
+    for (unique_ptr<event_loop> &loop : loops)
+    {
+        loop->s_socket = s_socket;
+        loop->limiter = &limiter;
+        set_accepting(*loop, true);
+    }
+    if (control_socket != -1)
+    {
+        loops[0]->control_socket = control_socket;
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = CONTROL_EVENT;
+        epoll_ctl(loops[0]->epoll_fd, EPOLL_CTL_ADD, control_socket, &event);
+    }
+
+    log("INFO", "Server listening on port", to_string(options.port)); // Log that server is ready to listen
+    log("INFO", "Deadlines (ms)", "idle " + to_string(options.idle_timeout) + ", read " + to_string(options.read_timeout) + ", request " + to_string(options.request_timeout));
+    log("INFO", "Threads", to_string(options.io_threads) + " I/O, " + (options.workers > 0 ? to_string(options.workers) + " compute (SCHEDULE and *_BATCH requests)" : string("no compute pool")));
+    if (options.tcp_info)
+    {
+        log("INFO", "Sampling TCP_INFO", "summary every " + to_string(TCP_STATS_INTERVAL) + " connections");
+    }
+    if (options.admission)
+    {
+        log("INFO", "Admission control", "target latency " + to_string(options.target_latency) + " ms, limit starts at " + to_string(ADMISSION_INITIAL_LIMIT) + " requests per I/O thread");
+    }
+
+    // Loop 0 runs on this thread, the others on their own
+    vector<thread> io_threads;
+    for (size_t i = 1; i < loops.size(); i++)
+    {
+        io_threads.emplace_back(run_event_loop, ref(*loops[i]));
+    }
+    run_event_loop(*loops[0]);
+    for (thread &io_thread : io_threads)
+    {
+        io_thread.join();
+    }
+    if (options.workers > 0)
+    {
+        log("INFO", "Compute pool", to_string(pool.stolen.load()) + " item(s) stolen");
+        pool.stop();
+    }
+
+    // Close all sockets for cleanup
+    for (unique_ptr<event_loop> &loop : loops)
+    {
+        for (connection &conn : loop->connections)
+        {
+            if (conn.c_socket != -1)
+            {
+                close(conn.c_socket);
+            }
+        }
+        if (loop->control_socket != -1)
+        {
+            close(loop->control_socket);
+        }
+        close(loop->completions.event_fd);
+        close(loop->epoll_fd);
+    }
+    close(s_socket);
+
+    return 0; // Exit program
+}
+
+// Create the loop's epoll instance and the completion port workers (and a hot restart on loop 0) wake it through
+// Return 0 on success, -1 on fail
+int open_event_loop(event_loop &loop)
+{
+    // Documentation on epoll - https://man7.org/linux/man-pages/man7/epoll.7.html
+    loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop.epoll_fd == -1)
+    {
+        log("ERROR", "epoll_create1() failed", strerror(errno));
+        return -1; // Fail
+    }
+    if (loop.completions.open() != 0)
+    {
+        return -1; // Fail
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = COMPLETION_EVENT;
+    epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, loop.completions.event_fd, &event);
+    return 0; // Success
+}
+
+// One I/O thread serves every connection it accepted: wait for socket events, finished compute work or the next deadline, whichever comes first
+void run_event_loop(event_loop &loop)
+{
+    epoll_event events[MAX_EPOLL_EVENTS];
+    while (true)
+    {
+        if (loop.draining && loop.active == 0 && (loop.index != 0 || active_grids == 0))
+        {
+            log("INFO", "Drained, exiting after hot restart", "I/O thread " + to_string(loop.index));
+            break;
+        }
+
+        const uint64_t before = monotonic_ms();
+        int timeout = loop.wheel.next_timeout(before);
+        const int flush_timeout = loop.recorder.next_timeout(before);
+        if (flush_timeout != -1 && (timeout == -1 || flush_timeout < timeout))
+        {
+            timeout = flush_timeout; // Buffered records are written within RECORD_FLUSH_INTERVAL even when no request arrives
+        }
+        if (loop.draining && loop.index == 0 && active_grids > 0 && (timeout == -1 || timeout > DRAIN_POLL_INTERVAL))
+        {
+            timeout = DRAIN_POLL_INTERVAL; // Grid threads don't wake the loop, check on them periodically
+        }
+
+        int ready = epoll_wait(loop.epoll_fd, events, MAX_EPOLL_EVENTS, timeout);
+        if (ready == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            log("ERROR", "epoll_wait() failed", strerror(errno));
+            break;
+        }
+
+        const uint64_t now = monotonic_ms(); // One clock read per iteration serves every deadline below
+        for (int i = 0; i < ready; i++)
+        {
+            const uint64_t tag = events[i].data.u64;
+            if (tag == LISTEN_EVENT)
+            {
+                accept_connections(loop, *loop.limiter, now);
+            }
+            else if (tag == COMPLETION_EVENT)
+            {
+                // Responses built by the compute pool, sent from here like any other
+                loop.completions.acknowledge();
+                work_item *item;
+                while ((item = loop.completions.queue.pop()) != nullptr)
+                {
+                    finish_work(loop, *(connection *)item->owner, now);
+                }
+                if (handed_off && !loop.draining)
+                {
+                    start_draining(loop, now); // Loop 0 handed the socket off
+                }
+            }
+            else if (tag == CONTROL_EVENT)
+            {
+                // A new server process wants our socket, once it owns it every loop stops accepting and finishes its open connections
+                // Pending connections stay queued on the shared socket for the new process
+                if (serve_handoff(loop.control_socket, &loop.s_socket, 1, "") == 0)
+                {
+                    epoll_ctl(loop.epoll_fd, EPOLL_CTL_DEL, loop.control_socket, nullptr);
+                    close(loop.control_socket);
+                    loop.control_socket = -1;
+                    handed_off = true;
+                    start_draining(loop, now);
+                    for (unique_ptr<event_loop> &other : loops)
+                    {
+                        if (other.get() != &loop)
+                        {
+                            other->completions.wake();
+                        }
+                    }
+                }
+            }
+            else
+            {
+                connection &conn = loop.connections[(uint32_t)tag];
+                if (conn.c_socket == -1 || conn.generation != (uint32_t)(tag >> 32) || conn.stage == STAGE_COMPUTING)
+                {
+                    continue; // Connection closed earlier in this batch, or a hangup while the pool works on it (reported once)
+                }
+                if (conn.stage == STAGE_WRITING)
+                {
+                    respond(loop, conn, now);
+                }
+                else
+                {
+                    read_request(loop, conn, now);
+                }
+            }
+        }
+
+        // Close every connection whose deadline passed, others are not affected
+        timer_node *timer = loop.wheel.advance(now);
+        while (timer != nullptr)
+        {
+            timer_node *next = timer->next; // Read before the connection is closed
+            expire_connection(loop, *(connection *)timer->owner, now);
+            timer = next;
+        }
+        loop.recorder.flush_due(now);
+    }
+    loop.recorder.flush(monotonic_ms());
+    if (loop.options.tcp_info)
+    {
+        log("INFO", "TCP_INFO summary", loop.tcp.summary());
+    }
+    if (loop.options.admission)
+    {
+        log("INFO", "Admission summary", loop.admission.summary());
+    }
+}
+
+// The listening socket stays open until the process exits, the new process accepts from the same backlog
+void start_draining(event_loop &loop, uint64_t now)
+{
+    set_accepting(loop, false);
+    loop.draining = true;
+    loop.recorder.flush(now); // The new process appends after these records
+    if (loop.options.tcp_info)
+    {
+        log("INFO", "TCP_INFO summary", loop.tcp.summary());
+    }
+    if (loop.options.admission)
+    {
+        log("INFO", "Admission summary", loop.admission.summary());
+    }
+    log("INFO", "Draining after hot restart", "I/O thread " + to_string(loop.index) + ": " + to_string(loop.active) + " connection(s)" +
+                                                  (loop.index == 0 ? ", " + to_string(active_grids.load()) + " grid stream(s)" : string()) +
+                                                  (loop.pool != nullptr ? ", " + to_string(loop.offloaded) + " request(s) computed by the pool, " + to_string(loop.pool_full) + " with the pool full" : string()));
+}
+
+// Create the TCP server socket, bind it to port (SERVER_PORT unless --port) and start listening
+// Return listening socket on success, -1 on fail
+int create_listening_socket(int port)
 {
     // Create the server socket
     int s_socket = socket(AF_INET, SOCK_STREAM, 0); // Make a new socket using SOCK_STREAM for TCP
     if (s_socket == -1)
     {
         log("ERROR", "Socket creation failed", strerror(errno));
-        return 1; // Exit program
+        return -1; // Fail
     }
 
     // Allow port reuse to allow quick rebind to the same port
@@ -28,7 +475,7 @@ int main(int argc, char *argv[])
     // Documentation on INADDR_ANY - https://man7.org/linux/man-pages/man7/ip.7.html
     sockaddr_in serverAddr{};                 // Initialize server address
     serverAddr.sin_family = AF_INET;          // Set address family to IPv4
-    serverAddr.sin_port = htons(SERVER_PORT); // Assign port number in network byte order
+    serverAddr.sin_port = htons(port);        // Assign port number in network byte order
     serverAddr.sin_addr.s_addr = INADDR_ANY;  // Listine to incoming connections from any source
 
     // Bind the socket to the configured server address and port
@@ -36,7 +483,7 @@ int main(int argc, char *argv[])
     {
         log("ERROR", "Bind failed");
         close(s_socket);
-        return 1; // Exit program
+        return -1; // Fail
     }
 
     // Listen for incoming connections
@@ -44,86 +491,591 @@ int main(int argc, char *argv[])
     {
         log("ERROR", "Listen failed");
         close(s_socket);
-        return 1; // Exit program
+        return -1; // Fail
     }
 
-    log("INFO", "Server listening on port", to_string(SERVER_PORT)); // Log that server is ready to listen
+    return s_socket; // Success
+}
 
-    int c_socket = -1; // Initialize socket variable for access outside while loop
+// Allow one descriptor per connection plus a few for the server itself (the default soft limit is often 1024)
+// Documentation on setrlimit - https://man7.org/linux/man-pages/man2/getrlimit.2.html
+void raise_file_limit(int connections)
+{
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)connections + 64)
+    {
+        limit.rlim_cur = min(limit.rlim_max, (rlim_t)connections + 64);
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
 
-    // Infinite loop to listen to new request after each client socket connection closes
-    while (true)
+// Stop or resume accepting by removing or adding the listening socket in epoll
+// - While paused new clients wait in the kernel backlog instead of being refused (or taken by another I/O thread)
+// - EPOLLEXCLUSIVE: with several I/O threads on the same socket only one is woken per connection instead of all of them
+// Documentation on EPOLLEXCLUSIVE - https://man7.org/linux/man-pages/man2/epoll_ctl.2.html
+void set_accepting(event_loop &loop, bool accepting)
+{
+    if (loop.accepting == accepting || loop.s_socket == -1 || (accepting && loop.draining))
+    {
+        return;
+    }
+    if (accepting)
+    {
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        event.data.u64 = LISTEN_EVENT;
+        epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, loop.s_socket, &event);
+    }
+    else
     {
-        // Accept incoming client connections in an infinite loop
-        sockaddr_in clientAddress{};                                                   // Initialize client address struct
-        socklen_t clientAddressLength = sizeof(clientAddress);                         // Set size of client address struct
-        c_socket = accept(s_socket, (sockaddr *)&clientAddress, &clientAddressLength); // Accept new client connection
+        epoll_ctl(loop.epoll_fd, EPOLL_CTL_DEL, loop.s_socket, nullptr);
+    }
+    loop.accepting = accepting;
+}
+
+// Accept pending clients into free pool slots and start their idle deadlines
+// - At most MAX_ACCEPT_BATCH per call: the listening socket stays ready, so a flood of new connections takes turns with the connections
+//   already accepted instead of starving them until the backlog is empty
+void accept_connections(event_loop &loop, rate_limiter &limiter, uint64_t now)
+{
+    for (int accepted = 0; accepted < MAX_ACCEPT_BATCH; accepted++)
+    {
+        if (loop.free_count == 0)
+        {
+            // Pool full: leave the rest in the backlog until a connection closes
+            log("WARNING", "Connection limit reached, pausing accept", to_string(MAX_CONNECTIONS) + " open connections");
+            set_accepting(loop, false);
+            return;
+        }
+
+        sockaddr_in clientAddress{};                           // Initialize client address struct
+        socklen_t clientAddressLength = sizeof(clientAddress); // Set size of client address struct
+        int c_socket = accept4(loop.s_socket, (sockaddr *)&clientAddress, &clientAddressLength, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (c_socket == -1)
         {
-            // Fail
-            log("ERROR", "Accept failed");
-            close(s_socket); // Close server socket on fail
-            return 1;        // Exit program
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno == EMFILE || errno == ENFILE)
+            {
+                // Resumes when a connection closes
+                log("WARNING", "Out of file descriptors, pausing accept", strerror(errno));
+                set_accepting(loop, false);
+            }
+            else if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                log("ERROR", "Accept failed", strerror(errno));
+            }
+            return;
+        }
+
+        // Reject clients over their rate limit before reading or parsing anything
+        if (!limiter.allow(clientAddress))
+        {
+            if (!loop.options.drop_throttled)
+            {
+                refuse_connection(c_socket, BUSY_RESPONSE); // Compact reply, client retries later
+                continue;
+            }
+            close(c_socket);
+            continue;
+        }
+
+        // Over the loop's limit already: answered before the connection costs a log line, an epoll registration or a read
+        if (loop.options.admission && shed_connection(loop, c_socket))
+        {
+            continue;
         }
 
+        connection &conn = loop.connections[loop.free_slots[--loop.free_count]];
+        conn.c_socket = c_socket;
+        conn.generation++;
+        conn.stage = STAGE_IDLE;
+        conn.bytes_sent = 0;
+        conn.request_deadline = loop.options.request_timeout > 0 ? now + loop.options.request_timeout : 0;
+        conn.arena.reset(); // Reuse the slot's buffers
+        conn.address = clientAddress;
+        conn.request_id = 0;
+        conn.accepted_us = loop.options.tcp_info ? monotonic_us() : 0;
+        conn.admitted = false;
+        loop.active++;
+
         // Log the address which the client socket connected from
-        // Documentation on inet_ntoa - https://linux.die.net/man/3/inet_ntoa
-        log("INFO", "Client connected from", inet_ntoa(clientAddress.sin_addr) + string(":") + to_string(ntohs(clientAddress.sin_port))); // Log client info
+        conn.client_name_length = format_address(clientAddress, conn.client_name, sizeof(conn.client_name));
+        log("INFO", "Client connected from", string_view(conn.client_name, conn.client_name_length)); // Log client info
 
-        char buffer[MESSAGE_BUFFER_SIZE] = {0};                            // Initialize buffer to receive client message
-        int bytesReceived = recv(c_socket, buffer, sizeof(buffer) - 1, 0); // Store received cliet message in buffer
-        if (bytesReceived > 0)
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = connection_tag(conn);
+        if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, c_socket, &event) == -1)
         {
-            buffer[bytesReceived] = '\0'; // Null-terminate to make a valid C-string when converting to string
-            log("INFO", "Message from client", string(buffer));
+            log("ERROR", "epoll_ctl() failed", strerror(errno));
+            close_connection(loop, conn);
+            continue;
+        }
+        schedule_deadline(loop, conn, now);
+    }
+}
 
-            // Validate client message
-            string client_message = string(buffer);
-            if (!client_message.empty() && validate_message(client_message) == 0)
+// The timer fires at the stage deadline (idle or read) or the request deadline, whichever is earlier
+// - Rescheduling is two pointer updates in the wheel, there is no timer syscall per connection
+void schedule_deadline(event_loop &loop, connection &conn, uint64_t now)
+{
+    const int stage_timeout = conn.stage == STAGE_READING ? loop.options.read_timeout : loop.options.idle_timeout;
+    uint64_t deadline = stage_timeout > 0 ? now + stage_timeout : UINT64_MAX;
+    if (conn.request_deadline != 0 && conn.request_deadline < deadline)
+    {
+        deadline = conn.request_deadline;
+    }
+
+    if (deadline == UINT64_MAX)
+    {
+        loop.wheel.cancel(conn.timer); // Every deadline disabled
+    }
+    else
+    {
+        loop.wheel.schedule(conn.timer, deadline);
+    }
+}
+
+// Receive whatever the client sent so far, the message is complete at MESSAGE_TERMINATOR
+// (or when the client shuts down its side, for clients that don't send a terminator)
+// - Clients from before MESSAGE_TERMINATOR send a bare quote in one segment and wait for the answer: a first read that is all there is
+//   and doesn't start with a command word is taken as the whole message, anything else without a terminator is answered at the read deadline
+void read_request(event_loop &loop, connection &conn, uint64_t now)
+{
+    request_arena &arena = conn.arena;
+    const bool first_read = arena.receive_length == 0;
+    bool progressed = false;
+    while (true)
+    {
+        const size_t capacity = sizeof(arena.receive_buffer) - 1 - arena.receive_length;
+        if (capacity == 0)
+        {
+            log("ERROR", "Message too long", string_view(conn.client_name, conn.client_name_length));
+            close_connection(loop, conn);
+            return;
+        }
+
+        ssize_t bytesReceived = loop.options.admission ? receive_stamped(conn.c_socket, arena.receive_buffer + arena.receive_length, capacity, conn.arrived_us)
+                                                       : recv(conn.c_socket, arena.receive_buffer + arena.receive_length, capacity, 0); // Append to the message received so far
+        if (bytesReceived > 0)
+        {
+            const char *chunk = arena.receive_buffer + arena.receive_length;
+            arena.receive_length += bytesReceived;
+            progressed = true;
+            if (memchr(chunk, MESSAGE_TERMINATOR, bytesReceived) != nullptr)
             {
-                // Handle a succesfully received message that has also been validated
-                if (respond(c_socket, client_message) != 0)
-                {
-                    // Fail if response doesn't get sent
-                    return 1; // Exit program
-                }
+                process_request(loop, conn, now);
+                return;
             }
+            continue;
+        }
+        if (bytesReceived == 0)
+        {
+            // Client closed its side, anything received is the whole message
+            if (arena.receive_length > 0)
+            {
+                process_request(loop, conn, now);
+            }
+            else
+            {
+                close_connection(loop, conn);
+            }
+            return;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break; // Nothing more for now
+        log("ERROR", "Receive failed", strerror(errno));
+        close_connection(loop, conn);
+        return;
+    }
+
+    if (progressed && first_read && !isalpha((unsigned char)arena.receive_buffer[0]))
+    {
+        process_request(loop, conn, now); // Unterminated quote
+        return;
+    }
+
+    // Partial message: the read deadline restarts with every chunk, the request deadline still bounds a trickling client
+    if (progressed)
+    {
+        conn.stage = STAGE_READING;
+        schedule_deadline(loop, conn, now);
+    }
+}
+
+// Dispatch a complete message, invalid messages get no response just like before
+void process_request(event_loop &loop, connection &conn, uint64_t now)
+{
+    begin_request_allocations(); // Test hook, see alloc_counter.h
+
+    // View of the message without the terminator (and a \r sent by telnet-style clients), no copy
+    string_view client_message = conn.arena.received();
+    client_message = client_message.substr(0, client_message.find(MESSAGE_TERMINATOR));
+    if (!client_message.empty() && client_message.back() == '\r')
+    {
+        client_message.remove_suffix(1);
+    }
+    loop.recorder.record(client_message, conn.address, now);
+    if (loop.options.admission && admit_request(loop, conn) != 0)
+    {
+        end_request_allocations(client_message);
+        return; // Shed
+    }
+    log("INFO", "Message from client", client_message);
+
+    // ID <request_id> <message> lets the client find this request in our TCP_INFO outliers, others get the next id
+    const int has_id = parse_request_id(client_message, conn.request_id, client_message);
+    if (has_id == -1)
+    {
+        log("ERROR", "Invalid request id", string_view(conn.client_name, conn.client_name_length));
+        close_connection(loop, conn);
+        return;
+    }
+    if (has_id == 1)
+    {
+        conn.request_id = next_request_id.fetch_add(1, memory_order_relaxed);
+    }
+    if (loop.options.tcp_info)
+    {
+        conn.request_us = monotonic_us();
+    }
+
+    if (is_command(client_message, GRID_COMMAND))
+    {
+        // Handle a payment grid request, streamed on its own thread so the loop keeps serving other clients
+        grid_request grid;
+        if (parse_grid_message(string(client_message), grid) == 0)
+        {
+            start_grid_stream(loop, conn, grid);
         }
         else
         {
-            log("ERROR", "No response from client");
-            break;
+            close_connection(loop, conn);
         }
-        close(c_socket); // Close the client socket each iteration
+        return;
     }
 
-    // Close all sockets for cleanup
-    close(s_socket);
+    // Schedules, scenarios and batches take tens to hundreds of times longer than a quote, with --workers they go to the compute pool
+    // so the quotes queued behind them on this loop aren't held up, everything else is answered right here without a thread hop
+    if (loop.pool != nullptr && (is_command(client_message, SCHEDULE_COMMAND) || is_command(client_message, SCENARIO_COMMAND) ||
+                                 is_command(client_message, PRINCIPAL_BATCH_COMMAND) || is_command(client_message, RATE_BATCH_COMMAND)))
+    {
+        conn.work.message = client_message;
+        if (loop.pool->submit(&conn.work, loop.next_queue) == 0)
+        {
+            // No EPOLLIN while a worker owns the arena (a client that shut down its side would stay readable), a hangup is reported once
+            epoll_event event{};
+            event.events = EPOLLONESHOT;
+            event.data.u64 = connection_tag(conn);
+            epoll_ctl(loop.epoll_fd, EPOLL_CTL_MOD, conn.c_socket, &event);
+            loop.wheel.cancel(conn.timer); // The request deadline is checked when the response comes back
+            conn.stage = STAGE_COMPUTING;
+            loop.offloaded++;
+            end_request_allocations(client_message);
+            return;
+        }
+        loop.pool_full++; // Every queue is full, answering here is slower for the loop but never refuses the request
+    }
+
+    if (compute_response(client_message, conn.arena) != 0)
+    {
+        close_connection(loop, conn);
+        return;
+    }
+    conn.stage = STAGE_WRITING;
+    conn.bytes_sent = 0;
+    respond(loop, conn, now);
+    end_request_allocations(client_message); // The view stays valid, the arena is only reset when the slot is reused
+}
+
+// Requests ahead of this one are those admitted and not answered yet (compute pool, slow readers, grid streams) plus the ones still queued on the loop,
+// estimated from how long this one waited since it reached the socket
+// - A shed request costs one send and a close: no logging per request, no parsing, no response built in the arena
+// - The hint also covers the connections waiting in the accept queue, they will be ahead of the retry
+// Return 0 if admitted (released with the connection), 1 if shed (connection closed)
+int admit_request(event_loop &loop, connection &conn)
+{
+    const uint64_t now_us = monotonic_us();
+    const uint64_t queue_us = now_us > conn.arrived_us ? now_us - conn.arrived_us : 0;
+    loop.admission.queued(queue_us, now_us);
+    const int ahead = loop.admission.pending() + loop.admission.queued_ahead(queue_us);
+    if (loop.admission.admit(ahead, now_us))
+    {
+        conn.admitted = true;
+        return 0;
+    }
+    char response[OVERLOADED_RESPONSE_SIZE];
+    const size_t length = format_overloaded(loop.admission.retry_after_ms(ahead + listen_backlog(loop.s_socket), now_us), response, sizeof(response));
+    send(conn.c_socket, response, length, MSG_NOSIGNAL); // A few bytes always fit the empty send buffer
+    close_connection(loop, conn);
+    return 1;
+}
+
+// The queue a new connection would join is the wait of the last request read, minus what drained since, plus the admitted requests
+// Return true if the connection was shed (closed), false to accept it normally
+bool shed_connection(event_loop &loop, int c_socket)
+{
+    begin_request_allocations(); // Test hook, a connection shed here never reaches process_request()
+    const uint64_t now_us = monotonic_us();
+    const int ahead = loop.admission.pending() + loop.admission.queued_ahead(loop.admission.queue_left_us(now_us));
+    if (!loop.admission.refuse(ahead, now_us))
+    {
+        return false;
+    }
+    char response[OVERLOADED_RESPONSE_SIZE];
+    const size_t length = format_overloaded(loop.admission.retry_after_ms(ahead + listen_backlog(loop.s_socket), now_us), response, sizeof(response));
+    refuse_connection(c_socket, string_view(response, length));
+    end_request_allocations("connection shed at accept");
+    return true;
+}
+
+// Nothing is read or parsed, but bytes already received are discarded before closing: close() with unread data sends a reset,
+// which makes the client's kernel throw away the answer it was about to read
+void refuse_connection(int c_socket, string_view response)
+{
+    send(c_socket, response.data(), response.size(), MSG_NOSIGNAL);
+    char discard[MESSAGE_BUFFER_SIZE];
+    while (recv(c_socket, discard, sizeof(discard), 0) > 0) // Non-blocking (accept4 with SOCK_NONBLOCK)
+        ;
     close(c_socket);
+}
 
-    return 0; // Exit program
+// Validate the message and write its response into the arena, runs on the I/O thread or on a pool worker
+// Return 0 on success, -1 if the message is invalid (it gets no response just like before)
+int compute_response(string_view message, request_arena &arena)
+{
+    loan_request loan;
+    int solver_status = 1; // 1 means not a PRINCIPAL/RATE/*_BATCH/SCHEDULE/SCENARIO message
+    if ((solver_status = handle_solver_message(message, arena)) != 1 ||
+        (solver_status = handle_schedule_message(message, arena)) != 1 ||
+        (solver_status = handle_scenario_message(message, arena)) != 1)
+    {
+        // Handle an inverse solve, a schedule or scenarios, invalid ones get no response just like invalid quotes
+        return solver_status == 0 ? 0 : -1;
+    }
+    if (validate_message(message, loan) == 0)
+    {
+        // Handle a succesfully received message that has also been validated
+        generate_payment_report(loan, arena); // Generate loan payment report into the arena's transmit buffer
+        return 0;                             // Success
+    }
+    return -1; // Fail
 }
 
-// Send load payment report response to client socket
-// Return 0 if message sent succesfully, -1 if failed
-int respond(int c_socket, string &validated_client_message)
+// Only touches the connection's arena, the connection itself stays with its I/O thread
+int compute_work(work_item &item)
 {
-    const int MAX_SIZE = 3;                                   // Max number of arguments
-    string terms[MAX_SIZE];                                   // Array to hold split arguments
-    split_by_space(validated_client_message, terms);          // Populates terms[], no need to check for too many arguments since this message has been validated
-    string response_message = generate_payment_report(terms); // Generate loan payment report
+    begin_request_allocations(); // Counted per worker thread, the I/O thread's count stopped at the hand-off
+    const int status = compute_response(item.message, *item.arena);
+    end_request_allocations(item.message);
+    return status;
+}
 
-    ssize_t bytes_to_send = strlen(response_message.c_str());                        // Get the length of the response (bytes)
-    ssize_t bytes_sent = send(c_socket, response_message.c_str(), bytes_to_send, 0); // Send response to client and store status - Params (connected socket) (buffer) (length) (flags)
-    if (bytes_sent == -1)
+// Back on the owning I/O thread: send what the worker built, unless the request deadline passed in the meantime
+void finish_work(event_loop &loop, connection &conn, uint64_t now)
+{
+    if (conn.work.status != 0)
     {
-        log("ERROR", "Failed to send response");
+        close_connection(loop, conn);
+        return;
+    }
+    if (conn.request_deadline != 0 && now >= conn.request_deadline)
+    {
+        expire_connection(loop, conn, now);
+        return;
+    }
+    conn.stage = STAGE_WRITING;
+    conn.bytes_sent = 0;
+    respond(loop, conn, now); // Re-arms EPOLLOUT if the client isn't reading yet
+}
+
+// Grids stream for as long as the client keeps reading, so they get a blocking socket on their own thread
+// - The connection leaves the loop (and its deadlines), SO_SNDTIMEO drops a client that stops reading for --idle-timeout
+// - At most MAX_ACTIVE_GRIDS at once across every loop, more would only share the same cores and pile up threads
+void start_grid_stream(event_loop &loop, connection &conn, const grid_request &grid)
+{
+    if (active_grids.fetch_add(1) >= MAX_ACTIVE_GRIDS)
+    {
+        active_grids--;
+        log("WARNING", "Grid limit reached", to_string(MAX_ACTIVE_GRIDS) + " grid streams running");
+        char response[OVERLOADED_RESPONSE_SIZE];
+        const size_t length = format_overloaded(MAX_RETRY_AFTER_MS, response, sizeof(response)); // A grid takes far longer than any hint
+        send(conn.c_socket, response, length, MSG_NOSIGNAL);
+        close_connection(loop, conn);
+        return;
+    }
+
+    const int c_socket = conn.c_socket;
+    admission_control *admission = nullptr; // Set if the grid holds an admission slot, released when the stream ends
+    if (conn.admitted)
+    {
+        admission = &loop.admission; // Loops live until the process exits
+        admission->detach();
+        conn.admitted = false;
+    }
+    epoll_ctl(loop.epoll_fd, EPOLL_CTL_DEL, c_socket, nullptr);
+    release_connection(loop, conn); // The socket now belongs to the grid thread
+
+    fcntl(c_socket, F_SETFL, fcntl(c_socket, F_GETFL) & ~O_NONBLOCK);
+    if (loop.options.idle_timeout > 0)
+    {
+        timeval timeout = {loop.options.idle_timeout / 1000, (loop.options.idle_timeout % 1000) * 1000};
+        setsockopt(c_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+
+    try
+    {
+        thread([c_socket, grid, admission]()
+               {
+                   stream_grid(c_socket, grid);
+                   close(c_socket);
+                   if (admission != nullptr)
+                       admission->end_detached();
+                   active_grids--; })
+            .detach();
+    }
+    catch (const exception &e)
+    {
+        log("ERROR", "Failed to start grid stream", e.what());
+        close(c_socket);
+        if (admission != nullptr)
+            admission->end_detached();
+        active_grids--;
+    }
+}
+
+// Send (the rest of) the response built in the arena (payment report or solver result) to the client
+// Return 0 once the whole response was sent (connection closed), 1 if the client isn't reading yet, -1 if failed
+int respond(event_loop &loop, connection &conn, uint64_t now)
+{
+    const string_view response_message = conn.arena.response();
+    const size_t sent_before = conn.bytes_sent;
+
+    while (conn.bytes_sent < response_message.size())
+    {
+        ssize_t bytes_sent = send(conn.c_socket, response_message.data() + conn.bytes_sent, response_message.size() - conn.bytes_sent, MSG_NOSIGNAL); // Send response to client and store status - Params (connected socket) (buffer) (length) (flags)
+        if (bytes_sent > 0)
+        {
+            conn.bytes_sent += bytes_sent;
+            continue;
+        }
+        if (bytes_sent == -1 && errno == EINTR)
+            continue;
+        if (bytes_sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            // Socket buffer full, wait until the client reads (the write deadline restarts whenever it does)
+            if (sent_before == 0 || conn.bytes_sent > sent_before)
+            {
+                epoll_event event{};
+                event.events = EPOLLOUT;
+                event.data.u64 = connection_tag(conn);
+                epoll_ctl(loop.epoll_fd, EPOLL_CTL_MOD, conn.c_socket, &event);
+                schedule_deadline(loop, conn, now);
+            }
+            return 1;
+        }
+        log("ERROR", "Failed to send response", strerror(errno));
+        close_connection(loop, conn);
         return -1; // Fail
     }
+
+    log("INFO", "Response sent to client", response_message);
+    sample_connection(loop, conn);
+    if (conn.admitted)
+    {
+        const uint64_t now_us = monotonic_us();
+        loop.admission.answered(now_us - conn.arrived_us, now_us); // Arrival to response sent, adapts the limit
+    }
+    close_connection(loop, conn); // One request per connection
+    return 0;                     // Success
+}
+
+// Close a connection whose timer fired and count which deadline it missed, a read deadline with part of a message answers it instead
+void expire_connection(event_loop &loop, connection &conn, uint64_t now)
+{
+    const char *reason;
+    if (conn.request_deadline != 0 && now >= conn.request_deadline)
+    {
+        reason = "request";
+        loop.expired.request++;
+    }
+    else if (conn.stage == STAGE_READING)
+    {
+        // No terminator came: answer what arrived as the whole message, like the server did before MESSAGE_TERMINATOR
+        loop.expired.read++;
+        log("WARNING", "No message terminator", string(conn.client_name, conn.client_name_length) + " answering the " + to_string(conn.arena.receive_length) + " bytes received");
+        process_request(loop, conn, now);
+        return;
+    }
+    else if (conn.stage == STAGE_WRITING)
+    {
+        reason = "write";
+        loop.expired.write++;
+    }
     else
     {
-        log("INFO", "Response sent to client", response_message);
-        return 0; // Success
+        reason = "idle";
+        loop.expired.idle++;
     }
-    return -1; // Assume failure
-}
\ No newline at end of file
+
+    log("WARNING", "Connection expired", string(conn.client_name, conn.client_name_length) + " " + reason + " deadline (expired idle: " + to_string(loop.expired.idle) + ", read: " + to_string(loop.expired.read) + ", write: " + to_string(loop.expired.write) + ", request: " + to_string(loop.expired.request) + ")");
+    sample_connection(loop, conn); // A stalled client is exactly what TCP_INFO should explain
+    close_connection(loop, conn);
+}
+
+// Sample TCP_INFO just before closing, the counters then cover the whole exchange
+// - Outliers are logged with the request id and client so they can be matched with the client's own log
+// - A summary of every histogram is logged every TCP_STATS_INTERVAL samples
+// - Both are formatted on the stack: the connection usually closes while its request is still being handled (see alloc_counter.h)
+void sample_connection(event_loop &loop, connection &conn)
+{
+    if (!loop.options.tcp_info)
+    {
+        return;
+    }
+    tcp_sample sample;
+    if (sample_tcp_info(conn.c_socket, sample) != 0)
+    {
+        return;
+    }
+    const uint64_t now_us = monotonic_us();
+    sample.request_id = conn.request_id;
+    sample.total_us = now_us - conn.accepted_us;
+    sample.wait_us = (conn.request_us != 0 && conn.request_id != 0 ? conn.request_us : now_us) - conn.accepted_us;
+    if (loop.tcp.add(sample))
+    {
+        char detail[sizeof(conn.client_name) + 3 + TCP_SAMPLE_SIZE];
+        size_t length = snprintf(detail, sizeof(detail), "%.*s | ", (int)conn.client_name_length, conn.client_name);
+        length += format_sample(sample, detail + length, sizeof(detail) - length);
+        log("WARNING", "TCP outlier", string_view(detail, length));
+    }
+    if (loop.tcp.samples % TCP_STATS_INTERVAL == 0)
+    {
+        char line[TCP_SUMMARY_SIZE];
+        log("INFO", "TCP_INFO summary", string_view(line, loop.tcp.format_summary(line, sizeof(line))));
+    }
+}
+
+void release_connection(event_loop &loop, connection &conn)
+{
+    if (conn.admitted)
+    {
+        loop.admission.release(); // Answered, invalid or expired
+        conn.admitted = false;
+    }
+    loop.wheel.cancel(conn.timer);
+    conn.c_socket = -1;
+    loop.free_slots[loop.free_count++] = conn.slot;
+    loop.active--;
+    set_accepting(loop, true); // Resume if accepting was paused for a full pool
+}
+
+// Closing the socket also removes it from epoll
+void close_connection(event_loop &loop, connection &conn)
+{
+    close(conn.c_socket);
+    release_connection(loop, conn);
+}
@@ -1,21 +1,309 @@
 #include "server_utils.h"
+#include "hot_restart.h"   // Socket handoff between old and new server process
+#include "rate_limiter.h"  // Per-client token buckets
+#include "alloc_counter.h" // Allocation counting test hook
+#include "solvers.h"       // Inverse solvers (PRINCIPAL, RATE and batches)
+#include "scenarios.h"     // What-if scenarios (SCENARIO)
+#include "segments.h"      // Segmented responses larger than one datagram
+#include "recorder.h"      // --record traffic recording
+#include "udp_stats.h"     // --rx-stats receive timestamps and drop counts
+#include "admission.h"     // --admission concurrency limit and load shedding
 
-#include <sstream> // For splitting message by commas
+#include <poll.h> // Wait on the server socket and the hot restart socket together (poll)
 
 const string ACK_START = "\nACK_START"; // Custom protocol ACK
 const string ACK_END = "\nACK_END";   // Custom protocol ACK
+const string HANDOFF_PATH = "/tmp/UDPServer.handoff"; // Unix socket used for hot restart
 
-string await_message(int s_socket, sockaddr_in &clientAddress, const int BUFFER_SIZE = 1024); // Listen for a response from server
-void respond(int c_socket, const string &message, sockaddr_in &clientAddress);                // Fire and forget a response to client
+int create_server_socket(int port);                                                                       // Create and bind the server socket
+ssize_t await_message(int s_socket, sockaddr_in &clientAddress, request_arena &arena, rx_sample &sample); // Listen for a response from server
+void respond(int c_socket, sockaddr_in &clientAddress, request_arena &arena, udp_stats *stats);          // Fire and forget a response to client
 
-int main()
+int main(int argc, char *argv[])
+{
+    server_options options;
+    if (parse_server_options(argc, argv, options) != 0)
+    {
+        return 1; // Exit program
+    }
+
+    // Requests recorded for replay (only with --record), opened before a hot restart takes over the socket
+    // so a recording that can't be opened never causes an outage
+    static traffic_recorder recorder;
+    if (!options.record_path.empty() && recorder.open(options.record_path, TRANSPORT_UDP) != 0)
+    {
+        return 1; // Exit program
+    }
+
+    // With hot restart, take over the UDP socket of a running server instead of binding a new one
+    // Datagrams already queued on the socket are kept and read by this process
+    // A replica on another port hands off to its own successor only
+    const string handoff_path = options.port == SERVER_PORT ? HANDOFF_PATH : HANDOFF_PATH + "." + to_string(options.port);
+    int s_socket = -1;
+    if (options.hot_restart)
+    {
+        int sockets[MAX_HANDOFF_SOCKETS];
+        int socket_count = 0;
+        string warm_state; // No warm state for UDP yet
+        int handoff = request_handoff(handoff_path, sockets, socket_count, warm_state);
+        if (handoff == -1)
+        {
+            return 1; // Exit program
+        }
+        if (handoff == 0)
+        {
+            s_socket = sockets[0]; // Already bound
+        }
+    }
+    if (s_socket == -1)
+    {
+        s_socket = create_server_socket(options.port);
+        if (s_socket == -1)
+        {
+            return 1; // Exit program
+        }
+    }
+
+    // A handed off socket keeps the previous process's options, so timestamps are switched off again without --rx-stats
+    // Admission control reads the queueing delay from the same timestamps
+    if (set_rx_stats(s_socket, options.rx_stats || options.admission) != 0 || ((options.rx_stats || options.receive_buffer > 0) && set_receive_buffer(s_socket, options.receive_buffer) != 0))
+    {
+        close(s_socket);
+        return 1; // Exit program
+    }
+
+    // Listen for a future replacement process (only with hot restart)
+    int control_socket = -1;
+    if (options.hot_restart)
+    {
+        control_socket = open_handoff_listener(handoff_path);
+        if (control_socket == -1)
+        {
+            close(s_socket);
+            return 1; // Exit program
+        }
+    }
+
+    // Per-client rate limiting (disabled unless --rate-limit is given)
+    // Static since the peer table and the segment cache are large and should not live on the stack
+    static rate_limiter limiter(options.rate_limit, options.rate_burst);
+    static request_arena arena;                           // Receive/transmit buffers reused for every datagram
+    static segment_sender segments(options.segment_pace); // Cached segmented responses and their pacing
+    segments.s_socket = s_socket;
+    static udp_stats stats;                               // Queueing, processing and send histograms (only with --rx-stats)
+    udp_stats *timing = options.rx_stats ? &stats : nullptr;
+    if (options.rx_stats)
+    {
+        log("INFO", "Sampling receive timestamps", "summary every " + to_string(UDP_STATS_INTERVAL) + " datagrams");
+    }
+    static admission_control admission(options.target_latency, ADMISSION_MAX_LIMIT); // Limit on the datagrams queued ahead (only with --admission)
+    if (options.admission)
+    {
+        log("INFO", "Admission control", "target latency " + to_string(options.target_latency) + " ms, limit starts at " + to_string(ADMISSION_INITIAL_LIMIT) + " queued datagrams");
+    }
+
+    log("INFO", "Server ready on port", to_string(options.port));
+
+    // Always stay open and await responses
+    while (true)
+    {
+        // Wait for a datagram, a replacement process, the next paced segment or the next recording write, whichever comes first
+        // Documentation on poll - https://man7.org/linux/man-pages/man2/poll.2.html
+        pollfd fds[2] = {{s_socket, POLLIN, 0}, {control_socket, POLLIN, 0}};
+        const uint64_t before = monotonic_ms();
+        int timeout = segments.next_timeout(before);
+        const int flush_timeout = recorder.next_timeout(before);
+        if (flush_timeout != -1 && (timeout == -1 || flush_timeout < timeout))
+        {
+            timeout = flush_timeout;
+        }
+        int ready = poll(fds, control_socket != -1 ? 2 : 1, timeout);
+        if (ready == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            log("ERROR", "poll() failed", strerror(errno));
+            break;
+        }
+        segments.advance(monotonic_ms()); // Paced segments due by now
+        recorder.flush_due(monotonic_ms());
+        if (control_socket != -1 && (fds[1].revents & POLLIN))
+        {
+            // A new server process wants our socket, once it owns it stop reading and exit
+            // Each datagram is answered before the next one is read, only paced segments can still be in flight
+            if (serve_handoff(control_socket, &s_socket, 1, "") == 0)
+            {
+                segments.flush();
+                recorder.flush(monotonic_ms()); // The new process appends after these records
+                if (options.rx_stats)
+                {
+                    log("INFO", "Receive summary", stats.summary());
+                }
+                if (options.admission)
+                {
+                    log("INFO", "Admission summary", admission.summary());
+                }
+                log("INFO", "Drained, exiting after hot restart");
+                close(control_socket);
+                close(s_socket);
+                return 0; // Exit program
+            }
+            continue; // Handoff failed, keep serving
+        }
+        if (!(fds[0].revents & POLLIN))
+        {
+            continue;
+        }
+
+        sockaddr_in clientAddress{}; // Struct to store client ip address if a message is received
+        arena.reset();               // Reuse the same buffers for every datagram
+        rx_sample sample;            // Kernel receive timestamp and drop counter of this datagram
+        if (await_message(s_socket, clientAddress, arena, sample) <= 0)
+        {
+            continue; // Wait for a message
+        }
+        const uint64_t received_us = options.rx_stats || options.admission ? monotonic_us() : 0;
+        if (options.rx_stats)
+        {
+            // Drops are reported on the first datagram read after the overflow, the summary also covers datagrams that get no response
+            const uint32_t dropped = stats.add(sample);
+            if (dropped > 0)
+            {
+                log("WARNING", "Receive queue overflowed", to_string(dropped) + " datagrams dropped by the kernel (" + to_string(stats.dropped) + " in total)");
+            }
+            if (stats.datagrams % UDP_STATS_INTERVAL == 0)
+            {
+                log("INFO", "Receive summary", stats.summary());
+            }
+        }
+        begin_request_allocations(); // Test hook, see alloc_counter.h
+
+        // Record what the client sent before anything can reject it, segment control messages are part of the transfer not requests
+        const string_view client_message = arena.received(); // View of the message, no copy
+        const uint64_t now = monotonic_ms();
+        if (!is_command(client_message, NACK_COMMAND) && !is_command(client_message, FIN_COMMAND))
+        {
+            recorder.record(client_message, clientAddress, now);
+        }
+
+        // Reject clients over their rate limit before logging or parsing anything
+        if (!limiter.allow(clientAddress))
+        {
+            if (!options.drop_throttled)
+            {
+                sendto(s_socket, BUSY_RESPONSE.c_str(), BUSY_RESPONSE.size(), 0, (sockaddr *)&clientAddress, sizeof(clientAddress)); // Compact reply, client retries later
+            }
+            end_request_allocations(client_message);
+            continue;
+        }
+
+        // Segment control messages (NACK/FIN) only touch the cached response
+        if (segments.handle_control(client_message, clientAddress, now) != 1)
+        {
+            end_request_allocations(client_message);
+            continue;
+        }
+
+        // SEG <request_id> <message> asks for a segmented response, a repeated one is answered from the cache
+        uint32_t request_id = 0;
+        string_view request = client_message;
+        const int segmented = parse_segmented_request(client_message, request_id, request);
+        if (segmented == -1 || (segmented == 0 && segments.resend_all(clientAddress, request_id, now) == 0))
+        {
+            end_request_allocations(client_message);
+            continue;
+        }
+
+        // Too many datagrams queued ahead of this one: OVERLOADED <ms> before logging or parsing, so the queue drains faster than it fills
+        // and the client hears back now instead of after its timeout (control messages and repeats from the cache above are never shed)
+        if (options.admission)
+        {
+            const int ahead = sample.stamped ? admission.queued_ahead(sample.queue_us) : 0;
+            if (!admission.admit(ahead, received_us))
+            {
+                char response[OVERLOADED_RESPONSE_SIZE];
+                const size_t length = format_overloaded(admission.retry_after_ms(ahead, received_us), response, sizeof(response));
+                sendto(s_socket, response, length, 0, (sockaddr *)&clientAddress, sizeof(clientAddress));
+                end_request_allocations(client_message);
+                continue;
+            }
+        }
+        log("INFO", "Message from client", request);
+
+        // Validate client message
+        // My custom UDP protocol: ACK_START<result>ACK_END, built straight into the transmit buffer
+        arena.append(ACK_START);
+        loan_request loan;
+        int status = handle_solver_message(request, arena); // PRINCIPAL/RATE/*_BATCH, 1 if it's neither
+        if (status == 1)
+        {
+            status = handle_schedule_message(request, arena); // SCHEDULE, 1 if it's anything else
+        }
+        if (status == 1)
+        {
+            status = handle_scenario_message(request, arena); // SCENARIO, 1 if it's a plain quote
+        }
+        if (status == 1)
+        {
+            status = validate_message(request, loan) == 0 ? generate_payment_report(loan, arena) : -1;
+        }
+        if (status != 0)
+        {
+            if (options.admission)
+            {
+                admission.release();
+            }
+            continue; // Invalid messages get no response
+        }
+
+        // Handle a succesfully received message that has also been validated
+        if (options.rx_stats)
+        {
+            stats.process.add(monotonic_us() - received_us);
+        }
+        if (segmented == 0)
+        {
+            const uint64_t send_start = options.rx_stats ? monotonic_us() : 0;
+            arena.append(ACK_END);
+            segments.start(clientAddress, request_id, arena.response(), now); // Sends the first paced burst, later segments aren't timed
+            if (options.rx_stats)
+            {
+                stats.send.add(monotonic_us() - send_start);
+            }
+        }
+        else
+        {
+            respond(s_socket, clientAddress, arena, timing);
+        }
+        if (options.admission)
+        {
+            // Kernel receive timestamp to answer sent, adapts the limit
+            const uint64_t answered_us = monotonic_us();
+            admission.answered(sample.queue_us + (answered_us - received_us), answered_us);
+            admission.release();
+        }
+        end_request_allocations(request);
+    }
+
+    recorder.flush(monotonic_ms());
+    close(s_socket); // Close server socket for cleanup
+    if (control_socket != -1)
+    {
+        close(control_socket);
+    }
+    return 0; // Exit program
+}
+
+// Create the UDP server socket and bind it to port (SERVER_PORT unless --port)
+// Return socket on success, -1 on fail
+int create_server_socket(int port)
 {
     // Create the server socket
     int s_socket = socket(AF_INET, SOCK_DGRAM, 0); // Make a new socket using SOCK_DGRAM for UDP
     if (s_socket == -1)
     {
         log("ERROR", "Socket creation failed");
-        return 1; // Exit program
+        return -1; // Fail
     }
 
     // Configured specific IP and port for listening
@@ -23,7 +311,7 @@ int main()
     // Documentation on INADDR_ANY - https://man7.org/linux/man-pages/man7/ip.7.html
     sockaddr_in serverAddress{};                 // Initialize server address
     serverAddress.sin_family = AF_INET;          // Set address family to IPv4
-    serverAddress.sin_port = htons(SERVER_PORT); // Assign port number in network byte order
+    serverAddress.sin_port = htons(port);        // Assign port number in network byte order
     serverAddress.sin_addr.s_addr = INADDR_ANY;  // Listine to incoming connections from any source
 
     // Bind the socket to the configured server address and port
@@ -31,66 +319,51 @@ int main()
     {
         log("ERROR", "Bind failed");
         close(s_socket);
-        return 1; // Exit program
+        return -1; // Fail
     }
 
-    log("INFO", "Server ready on port", to_string(SERVER_PORT));
-
-    // Always stay open and await responses
-    while (true)
-    {
-        sockaddr_in clientAddress{};                                          // Struct to store client ip address if a message is received
-        const string client_message = await_message(s_socket, clientAddress); // Wait for a message
-        // Validate client message
-        if (!client_message.empty() && validate_message(client_message) == 0)
-        {
-            // Handle a succesfully received message that has also been validated
-            respond(s_socket, client_message, clientAddress);
-        }
-    }
-
-    close(s_socket); // Close server socket for cleanup
-    return 0;        // Exit program
+    return s_socket; // Success
 }
 
-// Awaits a string message from client socket
-// Return string of message on success, empty string on fail
-string await_message(int s_socket, sockaddr_in &clientAddress, const int BUFFER_SIZE)
+// Awaits a message from client socket into the arena's receive buffer
+// - recvmsg() instead of recvfrom() so the kernel's receive timestamp and drop counter come along (with --rx-stats)
+// Return number of bytes received on success, -1 on fail
+ssize_t await_message(int s_socket, sockaddr_in &clientAddress, request_arena &arena, rx_sample &sample)
 {
     // No timeout here since the server should always wait for incoming messages (unlike UDP client)
-    char buffer[BUFFER_SIZE] = {0};                        // Buffer for the reply
-    socklen_t clientAddressLength = sizeof(clientAddress); // Length of client ip address
-
-    ssize_t recv_bytes = recvfrom(s_socket, buffer, sizeof(buffer) - 1, 0, (sockaddr *)&clientAddress, &clientAddressLength); // Store client message in buffer
+    ssize_t recv_bytes = receive_datagram(s_socket, arena.receive_buffer, sizeof(arena.receive_buffer) - 1, clientAddress, sample); // Store client message in buffer
 
     // Handle different states of received messages
     if (recv_bytes == -1)
     {
         // Handle no message received
         log("ERROR", "No response", strerror(errno));
-        return ""; // Fail
+        return -1; // Fail
     }
     else
     {
-        // Handle succesfully received message
-        buffer[recv_bytes] = '\0'; // Null-terminate to make a valid C-string when converting to string
-        log("INFO", "Message from client", string(buffer));
-        return string(buffer); // Success
+        // Handle succesfully received message (logged by the caller once the client passed rate limiting)
+        arena.receive_length = recv_bytes;
+        return recv_bytes; // Success
     }
-    return ""; // Assume failure
+    return -1; // Assume failure
 }
 
 // Fire and forget a response to client, no check if they received it
+// - The arena already holds ACK_START and the result, ACK_END is added here
+// - With stats, the time spent in sendto() goes into its send histogram
 // No return
-void respond(int c_socket, const string &message, sockaddr_in &clientAddress)
+void respond(int c_socket, sockaddr_in &clientAddress, request_arena &arena, udp_stats *stats)
 {
-    const int MAX_SIZE = 3;
-    string terms[MAX_SIZE];
-    split_by_space(message, terms);
-    string response_message = ACK_START + generate_payment_report(terms) + ACK_END; // My custom UDP protocol
+    arena.append(ACK_END);
+    const string_view response_message = arena.response();
 
-    ssize_t bytes_to_send = strlen(response_message.c_str());
-    ssize_t sent_bytes = sendto(c_socket, response_message.c_str(), bytes_to_send, 0, (sockaddr *)&clientAddress, sizeof(clientAddress)); // Send message
+    const uint64_t send_start = stats != nullptr ? monotonic_us() : 0;
+    ssize_t sent_bytes = sendto(c_socket, response_message.data(), response_message.size(), 0, (sockaddr *)&clientAddress, sizeof(clientAddress)); // Send message
+    if (stats != nullptr)
+    {
+        stats->send.add(monotonic_us() - send_start);
+    }
     if (sent_bytes == -1)
     {
         log("ERROR", "Failed to send response", strerror(errno));
@@ -100,4 +373,4 @@ void respond(int c_socket, const string &message, sockaddr_in &clientAddress)
     {
         log("INFO", "Response to client", response_message);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,215 @@
+#include "admission.h"             // Admission control
+#include "../network/tcp_stats.h" // Arrival times on the monotonic clock (monotonic_us)
+
+#include <netinet/tcp.h> // Accept queue length (TCP_INFO)
+#include <cstdio>        // OVERLOADED <ms> and summaries (snprintf)
+#include <cstring>       // Control message payloads (memcpy)
+#include <ctime>         // Receive time (clock_gettime)
+#include <algorithm>     // min, max
+
+admission_control::admission_control(int target_latency_ms, int max_limit)
+    : target_us((uint64_t)target_latency_ms * 1000), max_limit(max_limit)
+{
+}
+
+// Return true if the request may go ahead (it holds a slot until release()), false if it should be answered OVERLOADED
+bool admission_control::admit(int ahead, uint64_t now_us)
+{
+    if (refuse(ahead, now_us))
+    {
+        return false;
+    }
+    in_flight++;
+    admitted++;
+    depth = ahead + 1;
+    return true;
+}
+
+// Return true if the request should be answered OVERLOADED, false if it is within the limit
+bool admission_control::refuse(int ahead, uint64_t now_us)
+{
+    if (ahead < (int)limit)
+    {
+        return false;
+    }
+    if (now_us - last_shed_us > (uint64_t)ADMISSION_QUIET_MS * 1000)
+    {
+        overload_since_us = now_us; // A new overload, the previous one ended with a quiet spell
+    }
+    last_shed_us = now_us;
+    shed++;
+    if (shed % ADMISSION_LOG_INTERVAL == 1)
+    {
+        char line[ADMISSION_SUMMARY_SIZE];
+        log("WARNING", "Overloaded, shedding requests", string_view(line, format_summary(line, sizeof(line)))); // Once per ADMISSION_LOG_INTERVAL so shedding stays cheap
+    }
+    return true;
+}
+
+void admission_control::queued(uint64_t queue_us, uint64_t now_us)
+{
+    queue_seen_us = queue_us;
+    queue_seen_at_us = now_us;
+}
+
+// The queue the last request waited in keeps draining while new connections are shed without being read,
+// so the estimate reaches 0 on its own and the next connection is read (and measured) again
+uint64_t admission_control::queue_left_us(uint64_t now_us) const
+{
+    const uint64_t elapsed = now_us - queue_seen_at_us;
+    return queue_seen_us > elapsed ? queue_seen_us - elapsed : 0;
+}
+
+// Additive increase while answers are within the target, multiplicative decrease once per window when one is late
+// - Like TCP slow start, the limit grows by one per answer (doubling per window) while answers take less than half the target, so it
+//   reaches the server's real capacity quickly instead of shedding requests that would have been answered in time
+// - The increase needs the limit to be in use (depth at least half of it), an idle server would otherwise grow it without any evidence
+// - The time per answer is the gap since the previous answer, bounded by this request's latency: while requests queue the gap is what
+//   one answer costs (shed requests in between included), after an idle spell the latency is
+void admission_control::answered(uint64_t latency_us, uint64_t now_us)
+{
+    const uint64_t gap = last_answer_us == 0 ? latency_us : min(now_us - last_answer_us, latency_us);
+    answer_us = answer_us == 0 ? gap : answer_us + (gap - answer_us) * ADMISSION_SMOOTHING;
+    last_answer_us = now_us;
+    since_cut++;
+
+    if (latency_us <= target_us)
+    {
+        if (depth * 2 >= limit)
+        {
+            limit = min(max_limit, limit + (latency_us * 2 < target_us ? 1 : 1 / limit));
+        }
+        return;
+    }
+    late++;
+    if (since_cut >= (uint64_t)limit)
+    {
+        limit = max((double)ADMISSION_MIN_LIMIT, limit * ADMISSION_BACKOFF);
+        since_cut = 0;
+        cuts++;
+    }
+}
+
+void admission_control::release()
+{
+    in_flight--;
+}
+
+// The slot moves from in_flight (loop thread only) to the atomic detached count, so the heaviest requests stay visible to the limit
+void admission_control::detach()
+{
+    in_flight--;
+    detached.fetch_add(1, memory_order_relaxed);
+}
+
+void admission_control::end_detached()
+{
+    detached.fetch_sub(1, memory_order_relaxed);
+}
+
+int admission_control::pending() const
+{
+    return in_flight + detached.load(memory_order_relaxed);
+}
+
+// Little's law: the requests ahead left the queue one answer time apart
+int admission_control::queued_ahead(uint64_t queue_us) const
+{
+    return answer_us < 1 ? 0 : (int)min((double)INT32_MAX, queue_us / answer_us);
+}
+
+// Called right after refuse(), so the overload it measures includes this request
+// Return the hint in milliseconds, within MIN_RETRY_AFTER_MS and MAX_RETRY_AFTER_MS
+int admission_control::retry_after_ms(int ahead, uint64_t now_us) const
+{
+    const double excess = max(1.0, ahead - limit + 1);
+    const double overload_ms = (double)(now_us - overload_since_us) / 1000;
+    return (int)min((double)MAX_RETRY_AFTER_MS, max({(double)MIN_RETRY_AFTER_MS, excess * answer_us / 1000, overload_ms}));
+}
+
+string admission_control::summary() const
+{
+    char line[ADMISSION_SUMMARY_SIZE];
+    return string(line, format_summary(line, sizeof(line)));
+}
+
+// Example: limit 23.4, 23 in flight, 412 us per answer | 10210 admitted, 20874 shed, 96 late, 7 cuts
+// Return length written (without the terminating 0)
+size_t admission_control::format_summary(char *output, size_t capacity) const
+{
+    int length = snprintf(output, capacity, "limit %.1f, %d in flight, %.0f us per answer | %llu admitted, %llu shed, %llu late, %llu cuts",
+                          limit, pending(), answer_us, (unsigned long long)admitted, (unsigned long long)shed, (unsigned long long)late, (unsigned long long)cuts);
+    return length < 0 ? 0 : min((size_t)length, capacity - 1);
+}
+
+// Accepted sockets copy the listening socket's flags, so one call covers every connection
+// Documentation on SO_TIMESTAMPNS - https://man7.org/linux/man-pages/man7/socket.7.html
+// Return 0 on success, -1 on fail
+int set_receive_timestamps(int socket)
+{
+    const int value = 1;
+    if (setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPNS, &value, sizeof(value)) == -1)
+    {
+        log("ERROR", "Failed to set receive timestamps", strerror(errno));
+        return -1; // Fail
+    }
+    return 0; // Success
+}
+
+// The TCP counterpart of receive_datagram(): TCP reports the stamp of the last segment copied, so once the terminator is read it is
+// when the whole request had arrived (without a stamp the bytes count as arriving now)
+// Return number of bytes received, -1 on fail
+ssize_t receive_stamped(int socket, char *buffer, size_t capacity, uint64_t &arrived_us)
+{
+    iovec data{buffer, capacity};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(timespec))];
+    msghdr message{};
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t bytes = recvmsg(socket, &message, 0);
+    if (bytes <= 0)
+    {
+        return bytes; // Fail or closed
+    }
+
+    arrived_us = monotonic_us();
+    for (cmsghdr *header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header))
+    {
+        if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SO_TIMESTAMPNS)
+        {
+            timespec stamp, now;
+            memcpy(&stamp, CMSG_DATA(header), sizeof(stamp));
+            clock_gettime(CLOCK_REALTIME, &now); // Same clock as the stamp
+            const int64_t waited_ns = (int64_t)(now.tv_sec - stamp.tv_sec) * 1000000000 + (now.tv_nsec - stamp.tv_nsec);
+            if (waited_ns > 0 && (uint64_t)waited_ns / 1000 < arrived_us)
+            {
+                arrived_us -= (uint64_t)waited_ns / 1000; // A clock step backwards reads as no wait
+            }
+        }
+    }
+    return bytes; // Success
+}
+
+// On a listening socket TCP_INFO reports the accept queue: tcpi_unacked is its length, tcpi_sacked the backlog it may grow to
+// Documentation on TCP_INFO - https://man7.org/linux/man-pages/man7/tcp.7.html
+// Return connections waiting to be accepted, 0 if unknown
+int listen_backlog(int socket)
+{
+    tcp_info info{};
+    socklen_t length = sizeof(info);
+    if (getsockopt(socket, IPPROTO_TCP, TCP_INFO, &info, &length) == -1)
+    {
+        return 0;
+    }
+    return (int)info.tcpi_unacked;
+}
+
+// Return length written (without the terminating 0)
+size_t format_overloaded(int retry_after_ms, char *output, size_t capacity)
+{
+    int length = snprintf(output, capacity, "%s %d", OVERLOADED_RESPONSE.c_str(), retry_after_ms);
+    return length < 0 ? 0 : min((size_t)length, capacity - 1);
+}
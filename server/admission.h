@@ -0,0 +1,74 @@
+// Admission control and overload shedding (--admission)
+// - A request holds a slot from the moment the server has read it until it is answered, a new request is refused while the requests
+//   ahead of it reach the concurrency limit: the admitted ones not answered yet plus the ones still queued, estimated from the kernel
+//   receive timestamp (how long this request waited since it reached the socket divided by the time one answer takes)
+// - The limit adapts by AIMD on latency: an answer within --target-latency adds 1/limit (about +1 per limit answers, only while the limit
+//   is actually used, +1 per answer below half the target), a later one multiplies the limit by ADMISSION_BACKOFF at most once per limit
+//   answers so one overload cuts it once
+// - A refused request gets OVERLOADED <ms> right away instead of waiting in a full backlog or receive queue until the client times out,
+//   <ms> is how long the queue ahead of it takes to drain at the recent answer rate and the clients wait that long before retrying
+// - Under sustained overload the queue is short (it is kept at the limit) but every retry meets the same full server, so the hint is
+//   also at least as long as the shedding has lasted: retries spread out as the overload goes on instead of coming back every few
+//   milliseconds to be shed again, past a second clients give up at their deadline instead, and a short burst still gets short hints
+// - Latency is measured from the request's arrival, a client slow to send its request never counts against the server
+// - TCP also sheds at accept: the queueing delay of the last request read, minus the time since (the queue drains in real time),
+//   estimates what a new connection would wait, so while that is over the limit it is refused before costing a read or an epoll registration
+#ifndef ADMISSION_H
+#define ADMISSION_H
+#include "server_utils.h" // Server specific headers
+
+#include <atomic> // Requests handed to other threads (detached)
+
+#define ADMISSION_INITIAL_LIMIT 16  // Requests in flight allowed before the first answers move the limit
+#define ADMISSION_MIN_LIMIT 1       // The limit never drops below this (one request at a time still gets through)
+#define ADMISSION_MAX_LIMIT 1024    // Highest limit the AIMD increase can reach
+#define ADMISSION_LOG_INTERVAL 1000 // Requests shed between overload warnings
+#define ADMISSION_QUIET_MS 100      // Time without shedding that ends an overload (the retry hints start short again)
+#define OVERLOADED_RESPONSE_SIZE 32 // Fits OVERLOADED <ms>
+#define ADMISSION_SUMMARY_SIZE 192  // Fits one summary line
+
+const double ADMISSION_BACKOFF = 0.8;   // Multiplicative decrease of the limit after an answer later than the target
+const double ADMISSION_SMOOTHING = 0.1; // Weight of a new answer in the moving average of the time per answer
+
+struct admission_control
+{
+    uint64_t target_us;                     // --target-latency in microseconds
+    double max_limit;                       // Upper bound of limit
+    double limit = ADMISSION_INITIAL_LIMIT; // Requests allowed in flight or queued ahead
+    int in_flight = 0;                      // Requests admitted and not released yet
+    atomic<int> detached{0};                // Admitted requests handed to another thread (TCP grids), still in flight until that thread ends them
+    int depth = 0;                          // Requests ahead of the last admitted one plus itself, the limit only grows while it is used
+    double answer_us = 0;                   // Moving average of the time per answer (gap between answers, or the latency when the server was idle)
+    uint64_t last_answer_us = 0;            // When the previous answer went out, 0 before the first
+    uint64_t queue_seen_us = 0;             // Queueing delay of the last request read (TCP accept-time estimate)
+    uint64_t queue_seen_at_us = 0;          // When it was read
+    uint64_t overload_since_us = 0;         // When the current run of shedding began
+    uint64_t last_shed_us = 0;              // When a request was last shed
+    uint64_t since_cut = 0;                 // Answers since the limit was last cut
+    uint64_t admitted = 0;                  // Requests admitted
+    uint64_t shed = 0;                      // Requests refused with OVERLOADED
+    uint64_t late = 0;                      // Answers later than the target
+    uint64_t cuts = 0;                      // Times the limit was cut
+
+    admission_control(int target_latency_ms, int max_limit);
+    bool admit(int ahead, uint64_t now_us);                     // Take a slot if fewer than limit requests are ahead, false to shed the request
+    bool refuse(int ahead, uint64_t now_us);                    // True (counted as shed) if limit or more requests are ahead, takes no slot
+    void queued(uint64_t queue_us, uint64_t now_us);            // A request was read after waiting queue_us since it arrived
+    uint64_t queue_left_us(uint64_t now_us) const;              // What is left of that wait now, the queue ahead of a new arrival
+    void answered(uint64_t latency_us, uint64_t now_us);        // An admitted request was answered, adapts the limit to its latency
+    void release();                                             // An admitted request left (answered, invalid or closed)
+    void detach();                                              // An admitted request moves to another thread, which calls end_detached() once done
+    void end_detached();                                        // A detached request finished (any thread)
+    int pending() const;                                        // Requests in flight, detached ones included
+    int queued_ahead(uint64_t queue_us) const;                  // Requests ahead of one that waited queue_us since it arrived
+    int retry_after_ms(int ahead, uint64_t now_us) const;       // Time for the queue ahead to drain, at least the overload so far (OVERLOADED hint)
+    string summary() const;                                     // Limit, in flight, answer time and counts
+    size_t format_summary(char *output, size_t capacity) const; // summary() without allocating (shedding warnings), returns length written
+};
+
+int set_receive_timestamps(int socket);                                                        // SO_TIMESTAMPNS on a TCP listening socket, inherited by accepted ones
+ssize_t receive_stamped(int socket, char *buffer, size_t capacity, uint64_t &arrived_us);      // recv() that also sets when the bytes reached the socket
+int listen_backlog(int socket);                                                               // Connections waiting in a listening socket's accept queue, 0 if unknown
+size_t format_overloaded(int retry_after_ms, char *output, size_t capacity);                  // Write OVERLOADED <ms>, returns length written
+
+#endif // ADMISSION_H
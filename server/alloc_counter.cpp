@@ -0,0 +1,98 @@
+#include "alloc_counter.h" // Allocation counting test hook
+
+#include <cstdlib> // abort
+#include <cerrno>  // posix_memalign() errors (EINVAL, ENOMEM)
+
+const long WARMUP_REQUESTS = 2; // First requests may allocate once (time zone data, static buffers)
+
+static thread_local long request_allocations = 0; // Allocations since begin_request_allocations() on this thread
+static thread_local bool counting = false;         // Only count between begin and end
+static thread_local long requests_seen = 0;        // Requests finished on this thread
+
+#ifdef COUNT_ALLOCATIONS
+// Interpose the C allocator so every heap allocation goes through the counter, operator new included (libstdc++ calls malloc) as well
+// as C code that allocates on its own (stdio buffers, strdup, getaddrinfo)
+// - glibc exports its implementation as __libc_malloc and friends, the wrappers forward there (no dlsym(), which may allocate itself)
+// Documentation on replacing malloc - https://www.gnu.org/software/libc/manual/html_node/Replacing-malloc.html
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *memory, size_t size);
+    void *__libc_memalign(size_t alignment, size_t size);
+    void __libc_free(void *memory);
+
+    void *malloc(size_t size)
+    {
+        if (counting)
+            request_allocations++;
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t count, size_t size)
+    {
+        if (counting)
+            request_allocations++;
+        return __libc_calloc(count, size);
+    }
+
+    void *realloc(void *memory, size_t size)
+    {
+        if (counting)
+            request_allocations++; // Growing in place still asks the allocator
+        return __libc_realloc(memory, size);
+    }
+
+    void *memalign(size_t alignment, size_t size)
+    {
+        if (counting)
+            request_allocations++;
+        return __libc_memalign(alignment, size);
+    }
+
+    void *aligned_alloc(size_t alignment, size_t size) // Aligned operator new
+    {
+        return memalign(alignment, size);
+    }
+
+    int posix_memalign(void **memory, size_t alignment, size_t size)
+    {
+        if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+            return EINVAL;
+        *memory = memalign(alignment, size);
+        return *memory == nullptr ? ENOMEM : 0;
+    }
+
+    void free(void *memory)
+    {
+        __libc_free(memory);
+    }
+}
+#endif
+
+void begin_request_allocations()
+{
+    request_allocations = 0;
+    counting = true;
+}
+
+// Under COUNT_ALLOCATIONS a steady-state request that allocated is a failure: log it and abort so the test run fails loudly
+// Returns the number of allocations seen since begin_request_allocations()
+long end_request_allocations(string_view request)
+{
+    counting = false;
+    long allocations = request_allocations;
+#ifdef COUNT_ALLOCATIONS
+    requests_seen++;
+    if (allocations > 0 && requests_seen > WARMUP_REQUESTS)
+    {
+        log("ERROR", "Allocation on request path", to_string(allocations) + " allocation(s) while handling: " + string(request));
+        abort();
+    }
+#else
+    (void)request;
+    (void)requests_seen;
+    (void)WARMUP_REQUESTS;
+#endif
+    return allocations;
+}
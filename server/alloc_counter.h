@@ -0,0 +1,11 @@
+// Test hook that checks the request path doesn't allocate
+// Compile a server with -DCOUNT_ALLOCATIONS to count every malloc (operator new included) per request, any allocation on a steady-state
+// request is logged and aborts the server. Without the flag the calls below do nothing
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+#include "../network/network_utils.h" // Headers shared by client & server
+
+void begin_request_allocations();                 // Start counting allocations for a new request (on this thread)
+long end_request_allocations(string_view request); // Stop counting, returns allocations seen (aborts under COUNT_ALLOCATIONS if any)
+
+#endif // ALLOC_COUNTER_H
@@ -0,0 +1,160 @@
+#include "grid.h" // Payment grid streaming
+
+#include <thread>             // Worker threads (thread, hardware_concurrency)
+#include <mutex>              // Protect the row ring (mutex, unique_lock)
+#include <condition_variable> // Wake workers/sender when rows are ready or sent
+#include <atomic>             // Shared row counter and abort flag
+#include <vector>             // Row ring and worker list
+
+const int ROWS_PER_WORKER = 4;          // Ring slots per worker, bounds how far workers run ahead of the sender
+const size_t SEND_CHUNK_SIZE = 1 << 16; // Bytes gathered before each send() (64 KiB)
+
+// Send the whole buffer, stream sockets may accept only part of it
+// Return 0 on success, -1 on fail
+static int send_chunk(int c_socket, const string &chunk)
+{
+    const char *data = chunk.data();
+    size_t length = chunk.size();
+    while (length > 0)
+    {
+        ssize_t sent = send(c_socket, data, length, MSG_NOSIGNAL); // MSG_NOSIGNAL: don't die if the client hangs up mid-grid
+        if (sent == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            log("ERROR", "Failed to send grid chunk", strerror(errno));
+            return -1; // Fail
+        }
+        data += sent;
+        length -= sent;
+    }
+    return 0; // Success
+}
+
+// Write one CSV row (one amount against every term and rate) into row_output
+static void compute_grid_row(const grid_request &grid, long row, string &row_output)
+{
+    int amount = grid.amount_min + (int)row * grid.amount_step;
+    string amount_str = to_string(amount);
+    row_output.clear(); // Keep capacity, the slot is reused for the next row
+    for (int t = 0; t < grid.term_count; t++)
+    {
+        string years_str = to_string(grid.years[t]);
+        for (long r = 0; r < grid.rate_count(); r++)
+        {
+            double rate = grid.rate_at(r);
+            row_output += amount_str;
+            row_output += ',';
+            row_output += years_str;
+            row_output += ',';
+            row_output += format_double(rate, RATE_DECIMALS);
+            row_output += ',';
+            row_output += format_double(calculate_monthly_payment(amount, grid.years[t], rate), MONEY_DECIMALS);
+            row_output += '\n';
+        }
+    }
+}
+
+// Compute the grid with one worker per core and stream it in row-major order as CSV
+// - Workers take the next free row and write it into a ring slot, the sender sends rows in order as soon as they are done,
+//   so the first rows reach the client long before the last ones are computed
+// - Workers can run at most (ring size) rows ahead of the sender, so memory stays bounded however large the grid is
+// Return 0 on success, -1 if the client stopped receiving
+int stream_grid(int c_socket, const grid_request &grid)
+{
+    const long TOTAL_ROWS = grid.amount_count();
+    const int WORKERS = max(1, (int)thread::hardware_concurrency());
+    const long RING_SIZE = WORKERS * ROWS_PER_WORKER;
+
+    vector<string> ring(RING_SIZE);     // Finished rows waiting to be sent
+    vector<char> ready(RING_SIZE, 0);   // ready[slot] is 1 when the row in ring[slot] is done
+    long sent_rows = 0;                 // Rows handed to the sender so far (guarded by ring_mutex)
+    atomic<long> next_row{0};           // Next row a worker should compute
+    atomic<bool> aborted{false};        // Set when the client goes away
+    mutex ring_mutex;
+    condition_variable row_done;        // Signaled by workers
+    condition_variable slot_free;       // Signaled by the sender
+
+    auto worker = [&]()
+    {
+        while (!aborted)
+        {
+            long row = next_row++;
+            if (row >= TOTAL_ROWS)
+                return;
+            {
+                // Wait until the sender has freed the slot for this row
+                unique_lock<mutex> lock(ring_mutex);
+                slot_free.wait(lock, [&]
+                               { return aborted || row < sent_rows + RING_SIZE; });
+                if (aborted)
+                    return;
+            }
+            string row_output;
+            row_output.swap(ring[row % RING_SIZE]); // Reuse the slot's buffer without holding the lock
+            compute_grid_row(grid, row, row_output);
+            {
+                lock_guard<mutex> lock(ring_mutex);
+                ring[row % RING_SIZE].swap(row_output);
+                ready[row % RING_SIZE] = 1;
+            }
+            row_done.notify_all();
+        }
+    };
+
+    vector<thread> workers;
+    for (int i = 0; i < WORKERS; i++)
+    {
+        workers.emplace_back(worker);
+    }
+
+    string chunk = "amount,years,rate,monthly_payment\n"; // CSV header
+    int status = 0;
+    for (long row = 0; row < TOTAL_ROWS; row++)
+    {
+        long slot = row % RING_SIZE;
+        {
+            unique_lock<mutex> lock(ring_mutex);
+            row_done.wait(lock, [&]
+                          { return ready[slot] == 1; });
+            chunk += ring[slot];
+            ready[slot] = 0;
+            sent_rows++;
+        }
+        slot_free.notify_all();
+
+        if (chunk.size() >= SEND_CHUNK_SIZE)
+        {
+            if (send_chunk(c_socket, chunk) != 0)
+            {
+                status = -1;
+                break;
+            }
+            chunk.clear();
+        }
+    }
+    if (status == 0 && !chunk.empty())
+    {
+        status = send_chunk(c_socket, chunk);
+    }
+
+    if (status != 0)
+    {
+        // Stop workers that are waiting for the sender
+        {
+            lock_guard<mutex> lock(ring_mutex);
+            aborted = true;
+        }
+        slot_free.notify_all();
+    }
+    for (thread &t : workers)
+    {
+        t.join();
+    }
+
+    if (status == 0)
+    {
+        log("INFO", "Grid sent to client", to_string(TOTAL_ROWS) + " rows on " + to_string(WORKERS) + " thread(s)");
+    }
+    return status;
+}
@@ -0,0 +1,8 @@
+// Payment grids (GRID requests) computed in parallel and streamed back to the client as CSV
+#ifndef GRID_H
+#define GRID_H
+#include "server_utils.h" // Server specific headers
+
+int stream_grid(int c_socket, const grid_request &grid); // Compute a payment grid across all cores and stream it row by row
+
+#endif // GRID_H
@@ -0,0 +1,240 @@
+#include "hot_restart.h" // Hot restart socket handoff
+
+#include <sys/un.h> // Unix domain socket address (sockaddr_un)
+#include <cstdint>  // Fixed size integers for the handoff header
+
+// Header sent in front of every handoff, the sockets themselves travel as SCM_RIGHTS ancillary data
+struct handoff_header
+{
+    uint32_t socket_count; // Number of sockets attached to this message
+    uint32_t state_length; // Number of warm state bytes sent right after the header
+};
+
+const char HANDOFF_ACK = 'K';     // Sent by the new process once it owns the sockets
+const int HANDOFF_TIMEOUT = 5;    // Seconds the old process waits for the new process to acknowledge
+const int MAX_WARM_STATE = 1 << 26; // Sanity limit on warm state size (64 MiB)
+
+// Fill a sockaddr_un with the handoff path
+// Return 0 on success, -1 if the path is too long for sun_path
+static int make_unix_address(const string &handoff_path, sockaddr_un &address)
+{
+    memset(&address, 0, sizeof(address)); // Initialize all data to 0 to avoid garbage values
+    address.sun_family = AF_UNIX;
+    if (handoff_path.size() >= sizeof(address.sun_path))
+    {
+        log("ERROR", "Handoff path too long", handoff_path);
+        return -1; // Fail
+    }
+    memcpy(address.sun_path, handoff_path.c_str(), handoff_path.size());
+    return 0; // Success
+}
+
+// Keep calling send() until the whole buffer is written (stream sockets may send partially)
+// Return 0 on success, -1 on fail
+static int send_all(int socket, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t sent = send(socket, data, length, MSG_NOSIGNAL);
+        if (sent == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1; // Fail
+        }
+        data += sent;
+        length -= sent;
+    }
+    return 0; // Success
+}
+
+// Keep calling recv() until the whole buffer is filled
+// Return 0 on success, -1 on fail or if the peer closed early
+static int recv_all(int socket, char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t received = recv(socket, data, length, 0);
+        if (received == -1 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return -1; // Fail
+        data += received;
+        length -= received;
+    }
+    return 0; // Success
+}
+
+// Connect to a running server over the handoff path and receive its sockets and warm state
+// - The received sockets are already bound (and listening for TCP), so the caller must NOT bind them again
+// Return 0 if the sockets were taken over, 1 if no server is running on this path, -1 on fail
+int request_handoff(const string &handoff_path, int sockets[], int &socket_count, string &warm_state)
+{
+    sockaddr_un address;
+    if (make_unix_address(handoff_path, address) != 0)
+    {
+        return -1; // Fail
+    }
+
+    int control_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (control_socket == -1)
+    {
+        log("ERROR", "Handoff socket creation failed", strerror(errno));
+        return -1; // Fail
+    }
+
+    if (connect(control_socket, (sockaddr *)&address, sizeof(address)) == -1)
+    {
+        int connect_error = errno;
+        close(control_socket);
+        if (connect_error == ENOENT || connect_error == ECONNREFUSED)
+        {
+            // Nothing to take over (first start or the previous server is gone), caller binds normally
+            log("INFO", "No running server to take over", handoff_path);
+            return 1;
+        }
+        log("ERROR", "Handoff connect failed", strerror(connect_error));
+        return -1; // Fail
+    }
+
+    // Receive the header with the sockets attached as ancillary data
+    // Documentation on SCM_RIGHTS - https://man7.org/linux/man-pages/man7/unix.7.html
+    handoff_header header{};
+    iovec io{&header, sizeof(header)};
+    char control_buffer[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_SOCKETS)];
+    memset(control_buffer, 0, sizeof(control_buffer));
+    msghdr message{};
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control_buffer;
+    message.msg_controllen = sizeof(control_buffer);
+
+    ssize_t received = recvmsg(control_socket, &message, MSG_WAITALL);
+    if (received != (ssize_t)sizeof(header) || (message.msg_flags & MSG_CTRUNC))
+    {
+        log("ERROR", "Handoff header not received", received == -1 ? strerror(errno) : "short read");
+        close(control_socket);
+        return -1; // Fail
+    }
+
+    socket_count = 0;
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (int i = 0; i < count && socket_count < MAX_HANDOFF_SOCKETS; i++)
+            {
+                memcpy(&sockets[socket_count++], CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            }
+        }
+    }
+    if (socket_count != (int)header.socket_count || header.state_length > (uint32_t)MAX_WARM_STATE)
+    {
+        log("ERROR", "Handoff mismatch", to_string(socket_count) + " of " + to_string(header.socket_count) + " sockets received");
+        for (int i = 0; i < socket_count; i++)
+            close(sockets[i]);
+        close(control_socket);
+        return -1; // Fail
+    }
+
+    // Warm state (caches etc.) follows the header, may be empty
+    warm_state.assign(header.state_length, '\0');
+    if (header.state_length > 0 && recv_all(control_socket, &warm_state[0], header.state_length) != 0)
+    {
+        log("WARNING", "Warm state lost during handoff", "starting cold");
+        warm_state.clear();
+    }
+
+    // Tell the old process we own the sockets now so it can stop using them and drain
+    if (send_all(control_socket, &HANDOFF_ACK, 1) != 0)
+    {
+        log("ERROR", "Handoff ack failed", strerror(errno));
+        for (int i = 0; i < socket_count; i++)
+            close(sockets[i]);
+        close(control_socket);
+        return -1; // Fail
+    }
+    close(control_socket);
+
+    log("INFO", "Took over sockets from running server", to_string(socket_count) + " socket(s), " + to_string(warm_state.size()) + " bytes warm state");
+    return 0; // Success
+}
+
+// Create the Unix socket a future replacement process connects to
+// - Any stale path is removed first, a process still holding it keeps its (now unlinked) socket
+// Return listening socket on success, -1 on fail
+int open_handoff_listener(const string &handoff_path)
+{
+    sockaddr_un address;
+    if (make_unix_address(handoff_path, address) != 0)
+    {
+        return -1; // Fail
+    }
+
+    int control_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (control_socket == -1)
+    {
+        log("ERROR", "Handoff socket creation failed", strerror(errno));
+        return -1; // Fail
+    }
+
+    unlink(handoff_path.c_str()); // Remove stale path (ignore failure if it doesn't exist)
+    if (bind(control_socket, (sockaddr *)&address, sizeof(address)) == -1 || listen(control_socket, 1) == -1)
+    {
+        log("ERROR", "Handoff listener failed", strerror(errno));
+        close(control_socket);
+        return -1; // Fail
+    }
+
+    log("INFO", "Hot restart enabled", handoff_path);
+    return control_socket; // Success
+}
+
+// Accept the replacement process on the control socket and pass it our sockets and warm state
+// - On failure the caller still owns the sockets and should keep serving
+// Return 0 once the new process acknowledged the handoff, -1 on fail
+int serve_handoff(int control_socket, const int sockets[], int socket_count, const string &warm_state)
+{
+    int new_process = accept(control_socket, nullptr, nullptr);
+    if (new_process == -1)
+    {
+        log("ERROR", "Handoff accept failed", strerror(errno));
+        return -1; // Fail
+    }
+
+    // Don't let a broken replacement process hang the running server
+    struct timeval timeout = {HANDOFF_TIMEOUT, 0};
+    setsockopt(new_process, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(new_process, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    handoff_header header{(uint32_t)socket_count, (uint32_t)warm_state.size()};
+    iovec io{&header, sizeof(header)};
+    char control_buffer[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_SOCKETS)];
+    memset(control_buffer, 0, sizeof(control_buffer));
+    msghdr message{};
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control_buffer;
+    message.msg_controllen = CMSG_SPACE(sizeof(int) * socket_count);
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * socket_count);
+    memcpy(CMSG_DATA(cmsg), sockets, sizeof(int) * socket_count);
+
+    char ack = 0;
+    if (sendmsg(new_process, &message, MSG_NOSIGNAL) != (ssize_t)sizeof(header) ||
+        send_all(new_process, warm_state.data(), warm_state.size()) != 0 ||
+        recv_all(new_process, &ack, 1) != 0 || ack != HANDOFF_ACK)
+    {
+        log("ERROR", "Handoff to new process failed", "keep serving");
+        close(new_process);
+        return -1; // Fail
+    }
+
+    close(new_process);
+    log("INFO", "Handed off sockets to new process", to_string(socket_count) + " socket(s)");
+    return 0; // Success
+}
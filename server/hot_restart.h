@@ -0,0 +1,18 @@
+// Hot restart lets a freshly started server take over the sockets of the one already running
+// The old process hands its listening/UDP socket to the new process over a Unix socket (SCM_RIGHTS),
+// so the port never closes and clients never see a refused connection during a redeploy
+#ifndef HOT_RESTART_H
+#define HOT_RESTART_H
+#include "../network/network_utils.h" // Headers shared by client & server
+
+#include <string> // Warm state is passed as an opaque string
+
+using namespace std;
+
+#define MAX_HANDOFF_SOCKETS 4 // Max number of sockets passed in one handoff
+
+int request_handoff(const string &handoff_path, int sockets[], int &socket_count, string &warm_state); // NEW process: receive sockets (and warm state) from the running server
+int open_handoff_listener(const string &handoff_path);                                                 // Listen on a Unix socket for a future replacement process
+int serve_handoff(int control_socket, const int sockets[], int socket_count, const string &warm_state); // OLD process: pass sockets (and warm state) to the replacement process
+
+#endif // HOT_RESTART_H
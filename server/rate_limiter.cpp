@@ -0,0 +1,130 @@
+#include "rate_limiter.h" // Token bucket rate limiting
+#include "server_utils.h"  // Client address for the throttle log (format_address)
+
+#include <chrono> // Monotonic clock for refills (steady_clock)
+#include <cmath>  // Refill time rounded up (ceil)
+
+// Bucket state is packed into 64 bits so it can be read and replaced with one CAS
+// - Bits 0-39: last refill time in milliseconds since the limiter started (about 34 years)
+// - Bits 40-62: tokens in 1/1024 of a token (fixed point, up to 8191 tokens)
+// - Bit 63: peer is currently throttled (used to count throttled peers once per episode)
+const uint64_t TIME_MASK = (1ULL << 40) - 1;
+const int TOKEN_SHIFT = 40;
+const uint64_t TOKEN_MASK = (1ULL << 23) - 1;
+const uint64_t THROTTLED_FLAG = 1ULL << 63;
+const uint64_t ONE_TOKEN = 1024;
+const double MAX_BURST = (double)(TOKEN_MASK / ONE_TOKEN);
+
+static uint64_t pack_state(uint64_t tokens, uint64_t time_ms, bool throttled)
+{
+    return (time_ms & TIME_MASK) | (tokens << TOKEN_SHIFT) | (throttled ? THROTTLED_FLAG : 0);
+}
+
+// Milliseconds since the first call (so it fits in 40 bits)
+static uint64_t now_ms()
+{
+    static const auto START = chrono::steady_clock::now();
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - START).count();
+}
+
+rate_limiter::rate_limiter(double rate, double burst)
+    : rate(rate), burst(min(burst > 0 ? burst : max(rate, 1.0), MAX_BURST)),
+      full_refill_ms(rate > 0 ? (uint64_t)ceil(this->burst * 1000 / rate) : 0)
+{
+}
+
+// Take one token from the client's bucket, refilling it first based on the time since the last request
+// - Called before any parsing so a flooding client costs one hash lookup and one CAS per datagram/connection
+// Return true if the request is allowed, false if the client is over its limit
+bool rate_limiter::allow(const sockaddr_in &clientAddress)
+{
+    if (rate <= 0)
+    {
+        return true; // Limiter disabled
+    }
+
+    const uint32_t ADDRESS = clientAddress.sin_addr.s_addr;
+    const uint64_t NOW = now_ms();
+    const uint64_t FULL_BUCKET = (uint64_t)(burst * ONE_TOKEN);
+
+    // Find the client's bucket, or claim a free slot, within the probe window
+    // Documentation on Fibonacci hashing - https://en.wikipedia.org/wiki/Hash_function#Fibonacci_hashing
+    const uint32_t HOME = (uint32_t)((ADDRESS * 2654435761ULL) >> 20) & (PEER_TABLE_SIZE - 1);
+    peer_bucket *bucket = nullptr;
+    peer_bucket *oldest = nullptr;
+    uint64_t oldest_time = UINT64_MAX;
+    for (int i = 0; i < PEER_PROBE_LIMIT && bucket == nullptr; i++)
+    {
+        peer_bucket &slot = table[(HOME + i) & (PEER_TABLE_SIZE - 1)];
+        uint32_t key = slot.address.load(memory_order_acquire);
+        if (key == ADDRESS)
+        {
+            bucket = &slot;
+        }
+        else if (key == 0)
+        {
+            uint32_t expected = 0;
+            if (slot.address.compare_exchange_strong(expected, ADDRESS, memory_order_acq_rel))
+            {
+                slot.state.store(pack_state(FULL_BUCKET, NOW, false), memory_order_release); // New peers start with a full bucket
+                bucket = &slot;
+            }
+            else if (expected == ADDRESS)
+            {
+                bucket = &slot; // Another thread claimed it for the same client
+            }
+            key = expected; // Lost to another client, the slot is now occupied like any other
+        }
+        if (bucket == nullptr && key != 0)
+        {
+            uint64_t last_time = slot.state.load(memory_order_relaxed) & TIME_MASK;
+            if (last_time < oldest_time)
+            {
+                oldest_time = last_time;
+                oldest = &slot;
+            }
+        }
+    }
+
+    if (bucket == nullptr)
+    {
+        // Probe window full, evict the peer that has been idle the longest
+        // A racing update for the evicted peer may land on the new bucket, that only costs a little accuracy
+        oldest->address.store(ADDRESS, memory_order_release);
+        oldest->state.store(pack_state(FULL_BUCKET, NOW, false), memory_order_release);
+        evictions.fetch_add(1, memory_order_relaxed);
+        bucket = oldest;
+    }
+
+    // Refill and take a token in one CAS loop
+    uint64_t state = bucket->state.load(memory_order_acquire);
+    while (true)
+    {
+        uint64_t last_time = state & TIME_MASK;
+        uint64_t tokens = (state >> TOKEN_SHIFT) & TOKEN_MASK;
+        bool was_throttled = (state & THROTTLED_FLAG) != 0;
+        uint64_t elapsed = min(NOW > last_time ? NOW - last_time : 0, full_refill_ms); // Clamped first, a peer idle for days would overflow elapsed * rate * ONE_TOKEN
+        uint64_t added = (uint64_t)(elapsed * rate * ONE_TOKEN / 1000);
+        uint64_t refill_time = added > 0 ? NOW : last_time; // Keep the old time until at least one fraction is earned, so slow rates still refill under a flood
+        tokens = min(FULL_BUCKET, tokens + added);
+
+        bool allowed = tokens >= ONE_TOKEN;
+        uint64_t next = pack_state(allowed ? tokens - ONE_TOKEN : tokens, refill_time, !allowed);
+        if (bucket->state.compare_exchange_weak(state, next, memory_order_acq_rel))
+        {
+            if (!allowed)
+            {
+                throttled_requests.fetch_add(1, memory_order_relaxed);
+                if (!was_throttled)
+                {
+                    // Only log when a peer starts being throttled, logging every dropped request would cost more than serving it
+                    uint64_t peers = throttled_peers.fetch_add(1, memory_order_relaxed) + 1;
+                    char client_name[INET_ADDRSTRLEN + 8];
+                    const size_t length = format_address(clientAddress, client_name, sizeof(client_name)); // inet_ntoa() shares one buffer between threads
+                    log("WARNING", "Client throttled", string(client_name, length) + " (throttled requests: " + to_string(throttled_requests.load()) + ", throttled peers: " + to_string(peers) + ", evictions: " + to_string(evictions.load()) + ")");
+                }
+            }
+            return allowed;
+        }
+    }
+}
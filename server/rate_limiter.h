@@ -0,0 +1,37 @@
+// Per-client token bucket rate limiting
+// Buckets live in a fixed-size open addressing table keyed by IPv4 address, every update is a single CAS so the
+// table can be shared between threads without locks, and the longest idle peer is evicted when a probe window is full
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+#include "../network/network_utils.h" // Headers shared by client & server
+
+#include <atomic>  // Lock-free bucket updates
+#include <cstdint> // Fixed size integers for packed bucket state
+
+#define PEER_TABLE_SIZE 4096 // Number of buckets (power of 2), older peers are evicted beyond this
+#define PEER_PROBE_LIMIT 8   // Slots checked per lookup before evicting
+
+// One bucket, address 0 (0.0.0.0) marks a free slot since it is never a real source address
+struct peer_bucket
+{
+    atomic<uint32_t> address{0}; // IPv4 address in network byte order
+    atomic<uint64_t> state{0};   // Packed tokens, last refill time and throttled flag (see rate_limiter.cpp)
+};
+
+struct rate_limiter
+{
+    double rate;             // Tokens added per second (requests per second per client), 0 disables the limiter
+    double burst;            // Bucket size (max requests in a burst)
+    uint64_t full_refill_ms; // Time an empty bucket takes to fill up, a longer idle spell adds nothing more
+
+    atomic<uint64_t> throttled_requests{0}; // Requests rejected so far
+    atomic<uint64_t> throttled_peers{0};    // Times a peer went from allowed to throttled
+    atomic<uint64_t> evictions{0};          // Buckets reused for a new peer because the probe window was full
+
+    peer_bucket table[PEER_TABLE_SIZE];
+
+    rate_limiter(double rate, double burst);
+    bool allow(const sockaddr_in &clientAddress); // Take a token for this client, false if over the limit
+};
+
+#endif // RATE_LIMITER_H
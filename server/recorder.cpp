@@ -0,0 +1,127 @@
+#include "recorder.h" // Traffic recording
+
+#include <fcntl.h>    // Open the recording for appending (open)
+#include <sys/stat.h> // New or existing recording (fstat)
+
+// Open (or create) a recording and check that an existing one holds the same transport
+// Return 0 on success, -1 on fail
+int traffic_recorder::open(const string &path, record_transport transport)
+{
+    // Read access to check the header of an existing recording, every write goes to the end (O_APPEND)
+    // Documentation on O_APPEND - https://man7.org/linux/man-pages/man2/open.2.html
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        log("ERROR", "Failed to open recording " + path, strerror(errno));
+        return -1; // Fail
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) == 0 && status.st_size == 0)
+    {
+        record_file_header header{};
+        memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+        header.version = RECORD_VERSION;
+        header.transport = transport;
+        if (write(fd, &header, sizeof(header)) != sizeof(header))
+        {
+            log("ERROR", "Failed to write recording header", strerror(errno));
+            close(fd);
+            fd = -1;
+            return -1; // Fail
+        }
+    }
+    else
+    {
+        // Appending (a restarted server), the recording must be one this server type wrote
+        record_file_header header{};
+        if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, RECORD_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != RECORD_VERSION || header.transport != (uint32_t)transport)
+        {
+            log("ERROR", "Not a recording of this server", path);
+            close(fd);
+            fd = -1;
+            return -1; // Fail
+        }
+    }
+
+    log("INFO", "Recording requests to", path);
+    return 0; // Success
+}
+
+// Copy one request into the buffer, writing the buffer first if the record doesn't fit
+void traffic_recorder::record(string_view message, const sockaddr_in &client, uint64_t now)
+{
+    if (fd == -1)
+    {
+        return; // Not recording
+    }
+    if (length == 0)
+    {
+        last_flush = now; // The flush interval starts with the oldest buffered record
+    }
+    if (length + sizeof(record_header) + message.size() > sizeof(buffer))
+    {
+        flush(now);
+        if (fd == -1)
+        {
+            return; // The write failed and recording stopped
+        }
+    }
+
+    timespec arrival;
+    clock_gettime(CLOCK_REALTIME, &arrival);
+    record_header header;
+    header.timestamp_ns = (uint64_t)arrival.tv_sec * 1000000000 + arrival.tv_nsec;
+    header.address = client.sin_addr.s_addr;
+    header.port = client.sin_port;
+    header.length = (uint16_t)message.size(); // Messages are at most MESSAGE_BUFFER_SIZE bytes
+    memcpy(buffer + length, &header, sizeof(header));
+    memcpy(buffer + length + sizeof(header), message.data(), message.size());
+    length += sizeof(header) + message.size();
+    records++;
+}
+
+int traffic_recorder::next_timeout(uint64_t now) const
+{
+    if (length == 0)
+    {
+        return -1; // Nothing buffered
+    }
+    const uint64_t due = last_flush + RECORD_FLUSH_INTERVAL;
+    return due <= now ? 0 : (int)(due - now);
+}
+
+void traffic_recorder::flush_due(uint64_t now)
+{
+    if (length > 0 && now >= last_flush + RECORD_FLUSH_INTERVAL)
+    {
+        flush(now);
+    }
+}
+
+// Write every buffered record with one write(), O_APPEND keeps records whole even if an old and a new process overlap
+void traffic_recorder::flush(uint64_t now)
+{
+    last_flush = now;
+    if (length == 0 || fd == -1)
+    {
+        return;
+    }
+    ssize_t written = write(fd, buffer, length);
+    if (written != (ssize_t)length)
+    {
+        // A short write leaves a torn record at the end of the file, stop recording so the file stays readable up to it
+        // The server keeps serving, a full disk never stalls requests
+        for (size_t offset = 0; offset + sizeof(record_header) <= length; dropped++)
+        {
+            record_header header;
+            memcpy(&header, buffer + offset, sizeof(header));
+            offset += sizeof(header) + header.length;
+        }
+        log("ERROR", "Failed to write recording, recording stopped", to_string(dropped) + " record(s) dropped" + (written == -1 ? string(", ") + strerror(errno) : string()));
+        close(fd);
+        fd = -1;
+    }
+    length = 0;
+}
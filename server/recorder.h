@@ -0,0 +1,57 @@
+// Traffic recording for realistic benchmarks (replayed with tools/Replay.cpp)
+// With --record <file> every incoming request is appended to a binary file: a record_file_header once,
+// then for every request a record_header (arrival time, client address) followed by the raw message bytes
+// Records are collected in memory and written with one write() when the buffer fills or once a second,
+// so recording costs a memcpy per request on the hot path
+// The file is opened with O_APPEND, a process started with --hot-restart keeps appending to the same recording
+#ifndef RECORDER_H
+#define RECORDER_H
+#include "server_utils.h" // Server specific headers
+
+#define RECORD_BUFFER_SIZE 65536   // Records kept in memory between writes
+#define RECORD_FLUSH_INTERVAL 1000 // Longest time in milliseconds a record waits in memory
+#define RECORD_VERSION 1           // Bumped when the layout below changes
+
+const char RECORD_MAGIC[8] = {'L', 'O', 'A', 'N', 'R', 'E', 'C', '\0'}; // First bytes of every recording
+
+// Transport the recorded requests arrived on, one per file (TCP and UDP servers record separately)
+enum record_transport : uint32_t
+{
+    TRANSPORT_TCP = 1, // One request per connection, the message is recorded without MESSAGE_TERMINATOR
+    TRANSPORT_UDP = 2  // One request per datagram, recorded as received (including a SEG <request_id> prefix)
+};
+
+// Start of a recording, integers are in host byte order
+struct record_file_header
+{
+    char magic[8];      // RECORD_MAGIC
+    uint32_t version;   // RECORD_VERSION
+    uint32_t transport; // record_transport
+};
+
+// Start of every record, followed by length bytes of message
+struct record_header
+{
+    uint64_t timestamp_ns; // Arrival time (CLOCK_REALTIME) so recordings of both servers and of restarted processes line up
+    uint32_t address;      // Client IPv4 address (network byte order), identifies the client for replay
+    uint16_t port;         // Client port (network byte order)
+    uint16_t length;       // Message bytes that follow
+};
+
+struct traffic_recorder
+{
+    int fd = -1;                     // Recording file, -1 while recording is off
+    uint64_t last_flush = 0;         // Milliseconds (monotonic) of the last write
+    size_t length = 0;               // Bytes of buffer in use
+    uint64_t records = 0;            // Requests recorded by this process
+    uint64_t dropped = 0;            // Records lost to failed writes
+    char buffer[RECORD_BUFFER_SIZE]; // Records not written yet
+
+    int open(const string &path, record_transport transport);                  // Start recording to path, -1 on fail
+    void record(string_view message, const sockaddr_in &client, uint64_t now); // Append one request (no-op while recording is off)
+    int next_timeout(uint64_t now) const;                                      // Milliseconds until buffered records are due to be written, -1 if none
+    void flush_due(uint64_t now);                                              // Write buffered records if they waited RECORD_FLUSH_INTERVAL
+    void flush(uint64_t now);                                                  // Write buffered records now (before exiting)
+};
+
+#endif // RECORDER_H
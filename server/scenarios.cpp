@@ -0,0 +1,305 @@
+#include "scenarios.h" // What-if scenarios
+
+#include <cmath>   // pow
+#include <cstdlib> // Event values (strtod)
+
+// Base schedules of this thread's recent loans, fixed memory so a cache hit or miss never allocates
+struct scenario_cache
+{
+    base_schedule slots[SCENARIO_CACHE_SLOTS];
+    uint64_t last_used[SCENARIO_CACHE_SLOTS] = {}; // 0 while the slot is empty
+    uint64_t clock = 0;                            // Bumped on every lookup
+};
+
+static thread_local scenario_cache cache; // One per I/O thread and pool worker, no locking
+
+// Payment that pays off balance in months at monthly_rate, rounded to the cent like calculate_monthly_payment()
+static double amortized_payment(double balance, int months, double monthly_rate)
+{
+    if (monthly_rate == 0)
+    {
+        return round_to_nearest_cent_amount(balance / months);
+    }
+    return round_to_nearest_cent_amount((balance * monthly_rate) / (1 - pow(1 + monthly_rate, -months)));
+}
+
+// One month of the schedule, the same rounding as handle_schedule_message()
+// - Interest is rounded to the cent, the last month (or a payment larger than what is left) settles the balance
+// Return the interest charged
+static double amortize_month(double &balance, double payment, double extra, double monthly_rate, bool last_month)
+{
+    const double interest = round_to_nearest_cent_amount(balance * monthly_rate);
+    double principal = round_to_nearest_cent_amount(payment - interest) + extra;
+    if (last_month || principal > balance)
+    {
+        principal = balance;
+    }
+    balance = round_to_nearest_cent_amount(balance - principal);
+    return interest;
+}
+
+void base_schedule::build(double loan_amount, int loan_years, double loan_rate)
+{
+    amount = loan_amount;
+    years = loan_years;
+    rate = loan_rate;
+    payment = calculate_monthly_payment((int)loan_amount, loan_years, loan_rate);
+    monthly_rate = (loan_rate / 100) / 12;
+    months = loan_years * 12;
+    balance[0] = (int)loan_amount;
+    interest_paid[0] = 0;
+    payoff_month = months;
+    for (int month = 1; month <= months; month++)
+    {
+        balance[month] = balance[month - 1];
+        interest_paid[month] = interest_paid[month - 1] + amortize_month(balance[month], payment, 0, monthly_rate, month == months);
+        if (balance[month] <= 0 && payoff_month == months)
+        {
+            payoff_month = month; // Rounding can settle the loan a month early, later months stay at 0
+        }
+    }
+}
+
+int scenario::first_month() const
+{
+    int first = MAX_SCHEDULE_MONTHS + 1;
+    for (int i = 0; i < count; i++)
+    {
+        first = min(first, events[i].month);
+    }
+    return first;
+}
+
+// Replay the schedule from month from with the scenario's events, starting from the base schedule's state just before it
+// - Extra payments and lump sums keep the payment and shorten the loan, a reset re-amortizes what is left over the remaining months
+// - Any from at or before the first event gives the same result, from = 1 is the full recompute LoanBench compares against
+void run_scenario(const base_schedule &base, const scenario &events, scenario_result &result, int from)
+{
+    const int first = events.first_month(); // Inside the term, parse_scenario() checks that
+    if (from <= 0 || from > first)
+    {
+        from = first;
+    }
+    if (from > base.payoff_month)
+    {
+        // The base schedule was paid off before the first event
+        result.payoff_month = base.payoff_month;
+        result.total_interest = round_to_nearest_cent_amount(base.interest_paid[base.months]);
+        result.interest_saved = 0;
+        return;
+    }
+
+    double balance = base.balance[from - 1];
+    double interest_paid = base.interest_paid[from - 1];
+    double payment = base.payment;
+    double monthly_rate = base.monthly_rate;
+    int month = from;
+    for (; month <= base.months && balance > 0; month++)
+    {
+        double extra = 0;
+        for (int i = 0; i < events.count; i++)
+        {
+            const scenario_event &event = events.events[i];
+            if (month < event.month || month > event.until)
+            {
+                continue;
+            }
+            if (event.kind == EVENT_RESET)
+            {
+                monthly_rate = (event.value / 100) / 12;
+                payment = amortized_payment(balance, base.months - month + 1, monthly_rate);
+            }
+            else
+            {
+                extra += event.value;
+            }
+        }
+        interest_paid += amortize_month(balance, payment, extra, monthly_rate, month == base.months);
+    }
+
+    result.payoff_month = month - 1;
+    result.total_interest = round_to_nearest_cent_amount(interest_paid);
+    result.interest_saved = round_to_nearest_cent_amount(base.interest_paid[base.months] - interest_paid);
+}
+
+// Look the loan up in this thread's cache, a miss rebuilds the least recently used slot
+// Return the base schedule (valid until this thread looks up SCENARIO_CACHE_SLOTS other loans)
+const base_schedule &cached_base_schedule(double amount, int years, double rate)
+{
+    cache.clock++;
+    int victim = 0;
+    for (int i = 0; i < SCENARIO_CACHE_SLOTS; i++)
+    {
+        base_schedule &slot = cache.slots[i];
+        if (cache.last_used[i] != 0 && slot.amount == amount && slot.years == years && slot.rate == rate)
+        {
+            cache.last_used[i] = cache.clock;
+            return slot; // Hit
+        }
+        if (cache.last_used[i] < cache.last_used[victim])
+        {
+            victim = i;
+        }
+    }
+    cache.slots[victim].build(amount, years, rate);
+    cache.last_used[victim] = cache.clock;
+    return cache.slots[victim];
+}
+
+// Parse one event value (commas and % are ignored like in batch items)
+// Return 0 on success, -1 if it isn't a positive number
+static int parse_event_value(string_view text, double &value)
+{
+    char value_str[MAX_NUMBER_LENGTH];
+    size_t length = 0;
+    for (char c : text)
+    {
+        if (c == ',' || c == '%')
+            continue;
+        if (length + 1 >= MAX_NUMBER_LENGTH)
+            return -1; // Fail
+        value_str[length++] = c;
+    }
+    value_str[length] = '\0';
+    char *end;
+    value = strtod(value_str, &end);
+    return end == value_str || *end != '\0' || !(value > 0) || value > 1e9 ? -1 : 0;
+}
+
+// Parse <kind>:<value>[:<month>[:<until>]] into event, months must lie inside the term
+// Return 0 on success, -1 if invalid
+static int parse_event(string_view text, int months, scenario_event &event)
+{
+    string_view fields[4];
+    int count = 0;
+    while (true)
+    {
+        if (count == 4)
+            return -1; // Fail, too many fields
+        size_t colon = text.find(':');
+        fields[count++] = text.substr(0, colon);
+        if (colon == string_view::npos)
+            break;
+        text = text.substr(colon + 1);
+    }
+
+    double numbers[3] = {0, 1, (double)months}; // value, month, until (defaults of extra)
+    for (int i = 1; i < count; i++)
+    {
+        if (parse_event_value(fields[i], numbers[i - 1]) != 0)
+            return -1; // Fail
+    }
+    if (fields[0] == "extra" && count >= 2)
+    {
+        event.kind = EVENT_EXTRA;
+    }
+    else if ((fields[0] == "lump" || fields[0] == "reset") && count == 3)
+    {
+        event.kind = fields[0] == "lump" ? EVENT_LUMP : EVENT_RESET;
+        numbers[2] = numbers[1]; // Applies in one month (a reset stays in effect through the rate it leaves behind)
+    }
+    else
+    {
+        return -1; // Fail, unknown kind or wrong field count
+    }
+    if (numbers[1] != (int)numbers[1] || numbers[2] != (int)numbers[2] || numbers[1] > numbers[2] || numbers[2] > months ||
+        (event.kind == EVENT_RESET && numbers[0] > 100))
+    {
+        return -1; // Fail, months must be whole and inside the term, rates at most 100%
+    }
+    event.value = numbers[0];
+    event.month = (int)numbers[1];
+    event.until = (int)numbers[2];
+    return 0; // Success
+}
+
+// Parse <event>+<event>+... (events are joined by + since spaces separate scenarios and commas are stripped by the clients)
+// Return 0 on success, -1 if invalid
+int parse_scenario(string_view text, int months, scenario &result)
+{
+    result.count = 0;
+    while (true)
+    {
+        size_t plus = text.find('+');
+        if (result.count == MAX_SCENARIO_EVENTS || parse_event(text.substr(0, plus), months, result.events[result.count]) != 0)
+        {
+            return -1; // Fail
+        }
+        result.count++;
+        if (plus == string_view::npos)
+        {
+            return 0; // Success
+        }
+        text = text.substr(plus + 1);
+    }
+}
+
+// Answer SCENARIO <amount> <years> <rate> <scenario> [<scenario> ...] with one CSV row per scenario after the base schedule's row
+// - Payoff is reported as the month of the last payment and as years and months after the first payment
+// Return 0 if a response was appended, 1 if message isn't a SCENARIO message, -1 if it is invalid or doesn't fit
+int handle_scenario_message(string_view message, request_arena &arena)
+{
+    if (!is_command(message, SCENARIO_COMMAND))
+    {
+        return 1; // Not a scenario
+    }
+
+    // <amount> <years> <rate> are the first three arguments, the scenarios follow
+    string_view rest = message.substr(SCENARIO_COMMAND.size() + 1);
+    size_t loan_end = 0;
+    for (int spaces = 0; spaces < LOAN_TERM_COUNT && loan_end != string_view::npos; spaces++)
+    {
+        loan_end = rest.find(' ', spaces == 0 ? 0 : loan_end + 1);
+    }
+    loan_request loan;
+    if (loan_end == string_view::npos || validate_message(rest.substr(0, loan_end), loan) != 0)
+    {
+        log("ERROR", "Invalid scenario request", "SCENARIO <amount> <years> <rate> <scenario> ...");
+        return -1; // Fail
+    }
+    if (loan.years > MAX_SCHEDULE_YEARS)
+    {
+        log("ERROR", "Schedule too long", "Up to " + to_string(MAX_SCHEDULE_YEARS) + " years");
+        return -1; // Fail
+    }
+
+    // Parse every scenario before building anything, an invalid one rejects the whole request
+    scenario scenarios[MAX_SCENARIOS];
+    int count = 0;
+    string_view items = rest.substr(loan_end + 1);
+    while (!items.empty())
+    {
+        size_t space = items.find(' ');
+        string_view item = items.substr(0, space);
+        items = space == string_view::npos ? string_view() : items.substr(space + 1);
+        if (item.empty())
+            continue; // Extra spaces
+        if (count == MAX_SCENARIOS || parse_scenario(item, loan.years * 12, scenarios[count]) != 0)
+        {
+            log("ERROR", "Invalid scenario", item);
+            return -1; // Fail
+        }
+        count++;
+    }
+    if (count == 0)
+    {
+        log("ERROR", "No scenarios");
+        return -1; // Fail
+    }
+
+    const base_schedule &base = cached_base_schedule((int)loan.amount, loan.years, loan.rate);
+    char rate_str[64];
+    format_double(loan.rate, RATE_DECIMALS, rate_str, sizeof(rate_str));
+    int status = arena.appendf("\n$%d loan, %d years at %s%%, monthly payment $%.2f\nscenario,payoff_month,payoff_after,total_interest,interest_saved",
+                               (int)loan.amount, loan.years, rate_str, base.payment);
+    status |= arena.appendf("\nbase,%d,%dy %dm,%.2f,0.00", base.payoff_month, base.payoff_month / 12, base.payoff_month % 12,
+                            round_to_nearest_cent_amount(base.interest_paid[base.months]));
+    for (int i = 0; i < count; i++)
+    {
+        scenario_result result;
+        run_scenario(base, scenarios[i], result);
+        status |= arena.appendf("\n%d,%d,%dy %dm,%.2f,%.2f", i + 1, result.payoff_month, result.payoff_month / 12, result.payoff_month % 12,
+                                result.total_interest, result.interest_saved);
+    }
+    return status == 0 ? 0 : -1;
+}
@@ -0,0 +1,65 @@
+// What-if scenarios on top of a loan's amortization schedule: extra monthly payments, lump sums and rate resets
+// - The base schedule (the same month by month rounding as SCHEDULE) is built once per loan and cached per thread
+// - A scenario starts from the base schedule's balance just before its first event, so only the months from there on are recomputed
+//   and a sweep over many scenarios on the same loan costs a fraction of replaying each one from month 1
+#ifndef SCENARIOS_H
+#define SCENARIOS_H
+#include "server_utils.h" // Server specific headers
+
+#define MAX_SCHEDULE_MONTHS (MAX_SCHEDULE_YEARS * 12) // Longest base schedule
+#define MAX_SCENARIOS 32                              // Scenarios in one SCENARIO message
+#define MAX_SCENARIO_EVENTS 8                         // Events in one scenario
+#define SCENARIO_CACHE_SLOTS 8                        // Base schedules cached per thread (least recently used is replaced)
+
+enum scenario_event_kind
+{
+    EVENT_EXTRA, // extra:<amount>[:<from>[:<to>]] extra principal every month from <from> (default 1) to <to> (default the last month)
+    EVENT_LUMP,  // lump:<amount>:<month> one extra principal payment
+    EVENT_RESET  // reset:<rate>:<month> new rate from <month> on, the payment is re-amortized over the months left
+};
+
+struct scenario_event
+{
+    scenario_event_kind kind;
+    double value; // Dollars (extra, lump) or annual rate in percent (reset)
+    int month;    // First month the event applies to (1 based)
+    int until;    // Last month (extra), same as month otherwise
+};
+
+struct scenario
+{
+    scenario_event events[MAX_SCENARIO_EVENTS];
+    int count = 0;
+
+    int first_month() const; // Earliest month any event changes, everything before it is the base schedule
+};
+
+// Month by month state of the loan without any events
+struct base_schedule
+{
+    double amount = 0;                             // Key: <amount>
+    int years = 0;                                 // Key: <years>
+    double rate = 0;                               // Key: <rate>
+    double payment = 0;                            // calculate_monthly_payment()
+    double monthly_rate = 0;                       // rate / 100 / 12
+    int months = 0;                                // years * 12
+    int payoff_month = 0;                          // First month the balance is 0 (months unless rounding settled it early)
+    double balance[MAX_SCHEDULE_MONTHS + 1];       // Balance after month m (balance[0] is the amount)
+    double interest_paid[MAX_SCHEDULE_MONTHS + 1]; // Interest paid in months 1 to m (unrounded sum of cent amounts)
+
+    void build(double loan_amount, int loan_years, double loan_rate);
+};
+
+struct scenario_result
+{
+    int payoff_month = 0;      // Month of the last payment
+    double total_interest = 0; // Over the whole loan
+    double interest_saved = 0; // Base schedule's total interest minus total_interest (negative if a reset raised the rate)
+};
+
+int parse_scenario(string_view text, int months, scenario &result);                                        // Parse <event>+<event>+... against a term of months, -1 if invalid
+void run_scenario(const base_schedule &base, const scenario &events, scenario_result &result, int from = 0); // Recompute from month from (0: the first event, the incremental path)
+const base_schedule &cached_base_schedule(double amount, int years, double rate);                          // This thread's cached base schedule of a loan, built on a miss
+int handle_scenario_message(string_view message, request_arena &arena);                                    // Answer a SCENARIO message into the arena
+
+#endif // SCENARIOS_H
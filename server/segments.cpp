@@ -0,0 +1,259 @@
+#include "segments.h" // Segmented UDP responses
+
+#include <sys/uio.h> // Send header and payload without copying them together (sendmsg, iovec)
+#include <cstdio>    // Segment headers and log details without allocating (snprintf)
+#include <cstdlib>   // Parse ids and bitmaps (strtoul, strtoull)
+
+const int SEGMENT_HEADER_SIZE = 48; // "SEG <request_id> <seq> <total>\n" always fits
+
+// Parse an unsigned number of the given base from a view (copied to the stack so strtoull stops at the end of the view)
+// Return 0 on success, -1 if the view isn't a complete number
+static int parse_unsigned(string_view text, int base, uint64_t &value)
+{
+    char digits[MAX_NUMBER_LENGTH];
+    if (text.empty() || text.size() >= sizeof(digits))
+    {
+        return -1; // Fail
+    }
+    memcpy(digits, text.data(), text.size());
+    digits[text.size()] = '\0';
+    char *end;
+    errno = 0;
+    value = strtoull(digits, &end, base);
+    return (*end == '\0' && errno == 0 && digits[0] != '-') ? 0 : -1;
+}
+
+// Split SEG <request_id> <message>
+// Return 0 with request_id and request filled in, 1 if message isn't segmented, -1 if the id is malformed
+int parse_segmented_request(string_view message, uint32_t &request_id, string_view &request)
+{
+    if (!is_command(message, SEGMENT_COMMAND))
+    {
+        return 1; // Plain request
+    }
+    message = message.substr(SEGMENT_COMMAND.size() + 1);
+    const size_t space = message.find(' ');
+    uint64_t id;
+    if (space == string_view::npos || parse_unsigned(message.substr(0, space), 10, id) != 0 || id > UINT32_MAX)
+    {
+        log("ERROR", "Invalid segmented request", message);
+        return -1; // Fail
+    }
+    request_id = (uint32_t)id;
+    request = message.substr(space + 1);
+    return 0; // Success
+}
+
+static inline bool same_client(const sockaddr_in &a, const sockaddr_in &b)
+{
+    return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+segment_sender::segment_sender(int pace) : pace(pace), wheel(monotonic_ms())
+{
+    for (segmented_response &response : slots)
+    {
+        response.pacer.owner = &response;
+    }
+}
+
+segmented_response *segment_sender::find(const sockaddr_in &client, uint32_t request_id)
+{
+    for (segmented_response &response : slots)
+    {
+        if (response.in_use && response.request_id == request_id && same_client(response.client, client))
+        {
+            return &response;
+        }
+    }
+    return nullptr;
+}
+
+// Cache a response and send its first burst right away
+// - Takes a free slot, otherwise the least recently used one (a client that never sent FIN)
+// Return 0 on success, -1 if the response needs more than MAX_SEGMENTS segments
+int segment_sender::start(const sockaddr_in &client, uint32_t request_id, string_view response, uint64_t now)
+{
+    const int segment_count = (int)((response.size() + SEGMENT_PAYLOAD_SIZE - 1) / SEGMENT_PAYLOAD_SIZE);
+    if (segment_count > MAX_SEGMENTS || response.size() > RESPONSE_BUFFER_SIZE)
+    {
+        log("ERROR", "Response too large to segment", response.substr(0, 32));
+        return -1; // Fail
+    }
+
+    segmented_response *slot = find(client, request_id); // Same request again: replace it
+    for (int i = 0; slot == nullptr && i < SEGMENT_CACHE_SLOTS; i++)
+    {
+        if (!slots[i].in_use)
+            slot = &slots[i];
+    }
+    if (slot == nullptr)
+    {
+        slot = &slots[0];
+        for (segmented_response &candidate : slots)
+        {
+            if (candidate.last_used < slot->last_used)
+                slot = &candidate;
+        }
+        evictions++;
+    }
+
+    wheel.cancel(slot->pacer);
+    slot->in_use = true;
+    slot->client = client;
+    slot->request_id = request_id;
+    slot->segment_count = segment_count == 0 ? 1 : segment_count; // An empty response is still one (empty) segment
+    slot->pending = slot->segment_count == MAX_SEGMENTS ? ~0ULL : (1ULL << slot->segment_count) - 1;
+    slot->sent = 0;
+    slot->last_used = now;
+    slot->length = response.size();
+    memcpy(slot->data, response.data(), response.size());
+    responses++;
+
+    char detail[96];
+    int detail_length = snprintf(detail, sizeof(detail), "%zu bytes in %d segment(s), request %u", slot->length, slot->segment_count, request_id);
+    log("INFO", "Segmented response to client", string_view(detail, detail_length));
+
+    send_burst(*slot, now);
+    return 0; // Success
+}
+
+// The client repeated a SEG request it already sent (none of the segments arrived), send every segment again
+// Return 0 if the response was cached, -1 if it has to be computed again
+int segment_sender::resend_all(const sockaddr_in &client, uint32_t request_id, uint64_t now)
+{
+    segmented_response *response = find(client, request_id);
+    if (response == nullptr)
+    {
+        return -1; // Not cached
+    }
+    response->pending = response->segment_count == MAX_SEGMENTS ? ~0ULL : (1ULL << response->segment_count) - 1;
+    response->last_used = now;
+    log("INFO", "Repeated segmented request, resending cached response");
+    send_burst(*response, now);
+    return 0; // Success
+}
+
+// NACK <request_id> <missing bitmap hex>: queue only the missing segments again
+// FIN <request_id>: the client has everything, free the slot
+// Return 0 if handled, 1 if message is neither, -1 if malformed or unknown
+int segment_sender::handle_control(string_view message, const sockaddr_in &client, uint64_t now)
+{
+    const bool NACK = is_command(message, NACK_COMMAND);
+    if (!NACK && !is_command(message, FIN_COMMAND))
+    {
+        return 1; // Not a control message
+    }
+
+    string_view arguments = message.substr(message.find(' ') + 1);
+    const size_t space = arguments.find(' ');
+    uint64_t id;
+    uint64_t missing = 0;
+    if (parse_unsigned(arguments.substr(0, space), 10, id) != 0 || id > UINT32_MAX ||
+        (NACK && (space == string_view::npos || parse_unsigned(arguments.substr(space + 1), 16, missing) != 0)))
+    {
+        log("ERROR", "Invalid segment control message", message);
+        return -1; // Fail
+    }
+
+    segmented_response *response = find(client, (uint32_t)id);
+    if (response == nullptr)
+    {
+        // Evicted, or answered by the process before a hot restart, the client will repeat the whole request
+        log("WARNING", "Unknown segmented response", message);
+        return -1; // Fail
+    }
+
+    if (!NACK)
+    {
+        wheel.cancel(response->pacer);
+        response->in_use = false;
+        return 0; // Success
+    }
+
+    const uint64_t valid = response->segment_count == MAX_SEGMENTS ? ~0ULL : (1ULL << response->segment_count) - 1;
+    response->pending |= missing & valid;
+    response->last_used = now;
+    char detail[64];
+    int detail_length = snprintf(detail, sizeof(detail), "%d of %d segment(s), request %u", __builtin_popcountll(missing & valid), response->segment_count, (uint32_t)id);
+    log("INFO", "Client missing segments", string_view(detail, detail_length));
+    send_burst(*response, now);
+    return 0; // Success
+}
+
+// Send the lowest pending segments, at most pace of them, and come back on the next millisecond tick for the rest
+void segment_sender::send_burst(segmented_response &response, uint64_t now)
+{
+    int budget = pace > 0 ? pace : MAX_SEGMENTS;
+    while (response.pending != 0 && budget-- > 0)
+    {
+        const int sequence = __builtin_ctzll(response.pending);
+        response.pending &= response.pending - 1; // Clear lowest bit
+        send_segment(response, sequence);
+    }
+    if (response.pending != 0)
+    {
+        wheel.schedule(response.pacer, now + 1);
+    }
+}
+
+// Send one segment as header + payload straight from the cached response
+// Return 0 on success, -1 on fail (the client will NACK it)
+int segment_sender::send_segment(segmented_response &response, int sequence)
+{
+    char header[SEGMENT_HEADER_SIZE];
+    const int header_length = snprintf(header, sizeof(header), "%s %u %d %d\n", SEGMENT_COMMAND.c_str(), response.request_id, sequence, response.segment_count);
+    const size_t offset = (size_t)sequence * SEGMENT_PAYLOAD_SIZE;
+    const size_t payload_length = min((size_t)SEGMENT_PAYLOAD_SIZE, response.length - offset);
+
+    // Documentation on sendmsg - https://man7.org/linux/man-pages/man2/sendmsg.2.html
+    iovec io[2] = {{header, (size_t)header_length}, {response.data + offset, payload_length}};
+    msghdr message{};
+    message.msg_name = &response.client;
+    message.msg_namelen = sizeof(response.client);
+    message.msg_iov = io;
+    message.msg_iovlen = 2;
+    if (sendmsg(s_socket, &message, 0) == -1)
+    {
+        log("ERROR", "Failed to send segment", strerror(errno));
+        return -1; // Fail
+    }
+
+    segments_sent++;
+    if (response.sent & (1ULL << sequence))
+    {
+        retransmissions++;
+    }
+    response.sent |= 1ULL << sequence;
+    return 0; // Success
+}
+
+int segment_sender::next_timeout(uint64_t now) const
+{
+    return wheel.next_timeout(now);
+}
+
+void segment_sender::advance(uint64_t now)
+{
+    timer_node *timer = wheel.advance(now);
+    while (timer != nullptr)
+    {
+        timer_node *next = timer->next; // Read before send_burst() reschedules the timer
+        send_burst(*(segmented_response *)timer->owner, now);
+        timer = next;
+    }
+}
+
+void segment_sender::flush()
+{
+    for (segmented_response &response : slots)
+    {
+        while (response.in_use && response.pending != 0)
+        {
+            const int sequence = __builtin_ctzll(response.pending);
+            response.pending &= response.pending - 1;
+            send_segment(response, sequence);
+        }
+        wheel.cancel(response.pacer);
+    }
+}
@@ -0,0 +1,54 @@
+// Segmented, selectively acknowledged UDP responses
+// A response too large for one datagram is cut into numbered segments (SEG <request_id> <seq> <total>\n<payload>),
+// kept in a small cache until the client sends FIN, and only the segments a client reports missing (NACK bitmap) are sent again
+// Segments of one response are paced by the timer wheel so a large response doesn't leave as one burst
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+#include "server_utils.h" // Server specific headers
+#include "timer_wheel.h"  // Pacing timers
+
+#define SEGMENT_CACHE_SLOTS 32 // Responses kept for retransmission, the least recently used one is evicted when all are taken
+
+// One segmented response waiting for the client to confirm it
+struct segmented_response
+{
+    bool in_use = false;                // Slot holds a response
+    sockaddr_in client{};               // Client the response belongs to
+    uint32_t request_id = 0;            // Id chosen by the client
+    int segment_count = 0;              // Number of segments
+    uint64_t pending = 0;               // Segments still to send (bit per segment)
+    uint64_t sent = 0;                  // Segments sent at least once, a resend of one of these counts as a retransmission
+    uint64_t last_used = 0;             // Milliseconds, for eviction
+    timer_node pacer;                   // Fires every millisecond while segments are pending
+    size_t length = 0;                  // Bytes of data in use
+    char data[RESPONSE_BUFFER_SIZE];    // Whole response (ACK_START<result>ACK_END)
+};
+
+struct segment_sender
+{
+    int s_socket = -1;                                // UDP socket responses are sent on
+    int pace;                                         // Segments per millisecond per response, 0 sends every segment at once
+    timer_wheel wheel;                                // Pacing timers
+    segmented_response slots[SEGMENT_CACHE_SLOTS];    // Response cache
+    uint64_t responses = 0;                           // Segmented responses started
+    uint64_t segments_sent = 0;                       // Datagrams sent (first sends and retransmissions)
+    uint64_t retransmissions = 0;                     // Segments sent again after a NACK or a repeated request
+    uint64_t evictions = 0;                           // Responses dropped from the cache before the client sent FIN
+
+    segment_sender(int pace);
+    int start(const sockaddr_in &client, uint32_t request_id, string_view response, uint64_t now); // Cache a response and start sending it
+    int resend_all(const sockaddr_in &client, uint32_t request_id, uint64_t now);                  // Repeated SEG request: resend a cached response, -1 if it isn't cached
+    int handle_control(string_view message, const sockaddr_in &client, uint64_t now);              // Handle NACK/FIN, 1 if message is neither
+    int next_timeout(uint64_t now) const;                                                          // Milliseconds until the next paced send, -1 if none
+    void advance(uint64_t now);                                                                    // Send the segments whose pacing slot came up
+    void flush();                                                                                  // Send everything pending right away (before exiting)
+
+private:
+    segmented_response *find(const sockaddr_in &client, uint32_t request_id);
+    void send_burst(segmented_response &response, uint64_t now); // Send up to pace pending segments, reschedule if more are left
+    int send_segment(segmented_response &response, int sequence);
+};
+
+int parse_segmented_request(string_view message, uint32_t &request_id, string_view &request); // Split SEG <request_id> <message>, 1 if not segmented, -1 if malformed
+
+#endif // SEGMENTS_H
@@ -2,53 +2,149 @@
 
 #include <math.h>    // For power function (pow)
 #include <cmath>     // For roundinging (round)
-#include <string>    // stringstream, getline, to_string, stoi, stod
-#include <algorithm> // For removing commas (remove)
+#include <string>    // to_string, stod
+#include <algorithm> // For min
+#include <cstdio>    // Format numbers without allocating (snprintf)
+#include <cstdarg>   // printf-style arena appends (va_list)
+#include <climits>   // Timeout option range (INT_MAX)
 // #include <cctype>    // isspace
 
 using namespace std;
 
-// Split a string by each space and populate a string array
+const double PAYMENT_KERNEL_TOLERANCE = 3e-13; // Bound on the discount factor error of a payment kernel against pow() (about 10x the largest seen)
+
+// Parse optional server flags, every flag is optional so no arguments keeps the old behaviour
+// Return 0 on success, -1 on unknown flag
+int parse_server_options(int argc, char *argv[], server_options &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string flag = string(argv[i]);
+        if (flag == "--hot-restart")
+        {
+            options.hot_restart = true;
+        }
+        else if (flag == "--drop-throttled")
+        {
+            options.drop_throttled = true;
+        }
+        else if (flag == "--tcp-info")
+        {
+            options.tcp_info = true;
+        }
+        else if (flag == "--rx-stats")
+        {
+            options.rx_stats = true;
+        }
+        else if (flag == "--admission")
+        {
+            options.admission = true;
+        }
+        else if (flag == "--record" && i + 1 < argc)
+        {
+            options.record_path = argv[++i];
+        }
+        else if ((flag == "--rate-limit" || flag == "--burst") && i + 1 < argc)
+        {
+            double value;
+            try
+            {
+                value = stod(argv[++i]);
+            }
+            catch (const exception &e)
+            {
+                value = -1;
+            }
+            if (value < 0)
+            {
+                log("ERROR", "Invalid value for " + flag, argv[i]);
+                return -1; // Fail
+            }
+            (flag == "--rate-limit" ? options.rate_limit : options.rate_burst) = value;
+        }
+        else if ((flag == "--idle-timeout" || flag == "--read-timeout" || flag == "--request-timeout" || flag == "--segment-pace" || flag == "--io-threads" || flag == "--workers" || flag == "--port" || flag == "--rcvbuf" || flag == "--target-latency") && i + 1 < argc)
+        {
+            long value;
+            try
+            {
+                value = stol(argv[++i]);
+            }
+            catch (const exception &e)
+            {
+                value = -1;
+            }
+            const long highest = flag == "--io-threads" ? MAX_IO_THREADS : flag == "--workers" ? MAX_WORKERS : flag == "--port" ? 65535 : INT_MAX;
+            if (value < (flag == "--io-threads" || flag == "--port" || flag == "--target-latency" ? 1 : 0) || value > highest)
+            {
+                log("ERROR", "Invalid value for " + flag, argv[i]);
+                return -1; // Fail
+            }
+            int &setting = flag == "--idle-timeout"     ? options.idle_timeout
+                           : flag == "--read-timeout"   ? options.read_timeout
+                           : flag == "--segment-pace"   ? options.segment_pace
+                           : flag == "--io-threads"     ? options.io_threads
+                           : flag == "--workers"        ? options.workers
+                           : flag == "--port"           ? options.port
+                           : flag == "--rcvbuf"         ? options.receive_buffer
+                           : flag == "--target-latency" ? options.target_latency
+                                                        : options.request_timeout;
+            setting = (int)value;
+        }
+        else
+        {
+            log("ERROR", "Unknown option", flag);
+            log("INFO", "Usage", string(argv[0]) + " [--hot-restart] [--rate-limit <requests/sec>] [--burst <requests>] [--drop-throttled] [--idle-timeout <ms>] [--read-timeout <ms>] [--request-timeout <ms>] [--segment-pace <segments/ms>] [--record <file>] [--tcp-info] [--io-threads <n>] [--workers <n>] [--port <n>] [--rx-stats] [--rcvbuf <bytes>] [--admission] [--target-latency <ms>]");
+            return -1; // Fail
+        }
+    }
+    return 0; // Success
+}
+
+// Split a message by each space into views of each argument (no copies, the views point into the message)
 // Return 0 on success, -1 if too many arguments are provided
-int split_by_space(string prevalidated_message, string output[])
+int split_by_space(string_view prevalidated_message, string_view output[])
 {
-    stringstream ss(prevalidated_message);    // String stream for while loop
-    string parsed_argument;                   // Temporary storage for each parsed argument
-    int argument_num = 0;                     // For tracking number of arguments
-    while (getline(ss, parsed_argument, ' ')) // Split each argument by spaces (should only have 3)
+    int argument_num = 0; // For tracking number of arguments
+    while (!prevalidated_message.empty())
     {
-        if (argument_num > 2)
+        // Split each argument by spaces (should only have 3)
+        size_t space = prevalidated_message.find(' ');
+        string_view parsed_argument = prevalidated_message.substr(0, space);
+        prevalidated_message = space == string_view::npos ? string_view() : prevalidated_message.substr(space + 1);
+
+        if (argument_num > LOAN_TERM_COUNT - 1)
         {
             // Handle too many arguments
             log("ERROR", "Client sent too many arguments");
             return -1; // Failed validation
         }
         // Loop through each character and remove leading spaces (if any)
-        while (!parsed_argument.empty() && isspace(parsed_argument.front()))
+        while (!parsed_argument.empty() && isspace((unsigned char)parsed_argument.front()))
         {
-            parsed_argument.erase(0, 1); // Remove leading space
+            parsed_argument.remove_prefix(1); // Remove leading space
         }
-        // Remove any commas (will give stoi() problems later) (if any)
-        parsed_argument.erase(remove(parsed_argument.begin(), parsed_argument.end(), ','), parsed_argument.end()); // Remove commas
-        output[argument_num] = parsed_argument;                                                                    // Store new argument in output array (should have no leading spaces, no commas)
+        // Commas are left in, validate_amount()/validate_years()/validate_rate() skip them when parsing
+        output[argument_num] = parsed_argument; // Store new argument in output array (should have no leading spaces)
         argument_num++;
     }
     return 0; // Success
 }
 
-// Validate a message in the format <amount> <years> <rate>
+// Validate a message in the format <amount> <years> <rate> and parse it into loan
 // Return 0 on success, -1 on failure
-int validate_message(const string &prevalidated_message)
+int validate_message(string_view prevalidated_message, loan_request &loan)
 {
-    const int MAX_SIZE = 3;            // Max number of arguments
-    string parsed_arguments[MAX_SIZE]; // Array to hold split arguments
-    if (split_by_space(prevalidated_message, parsed_arguments) != 0)
+    for (string_view &term : loan.terms)
+    {
+        term = string_view(); // Missing arguments stay empty and fail validation
+    }
+    if (split_by_space(prevalidated_message, loan.terms) != 0)
     {
         // Handle too many arguments
         return -1; // Fail
     }
 
-    if (validate_amount(parsed_arguments[0]) == 0 && validate_years(parsed_arguments[1]) == 0 && validate_rate(parsed_arguments[2]) == 0)
+    if (validate_amount(loan.terms[0], &loan.amount) == 0 && validate_years(loan.terms[1], &loan.years) == 0 && validate_rate(loan.terms[2], &loan.rate) == 0)
     {
         // All arguments are valid and have been validated
         return 0; // Success
@@ -64,10 +160,76 @@ double round_to_nearest_cent_amount(double amount)
     return round(amount * 100) / 100; // Round to 2 decimal places
 }
 
+// x^N by repeated squaring, unrolled at compile time: x^360 is 8 squarings and 3 multiplies instead of pow()'s log and exp
+template <int N>
+static inline double power(double x)
+{
+    if constexpr (N == 0)
+    {
+        return 1;
+    }
+    else if constexpr (N % 2 == 0)
+    {
+        const double half = power<N / 2>(x);
+        return half * half;
+    }
+    else
+    {
+        return x * power<N - 1>(x);
+    }
+}
+
+// Monthly payment for a term fixed at compile time, the same formula as calculate_monthly_payment_generic()
+// - Squaring rounds differently from pow() in the last bits, so a result within that error of a half cent could round the other way:
+//   those (exact ties and very low rates, where 1 - discount cancels) return -1 and take the generic path, the rest is identical to the cent
+// Return the payment rounded to the cent, -1 if the generic path has to decide
+template <int YEARS>
+static double monthly_payment_kernel(int amount, double monthly_rate)
+{
+    constexpr int TOTAL_PAYMENTS = YEARS * 12;
+    const double growth = power<TOTAL_PAYMENTS>(1 + monthly_rate);               // (1+R)^N
+    const double exact_amount = (amount * monthly_rate) * growth / (growth - 1); // L*R / (1 - (1+R)^-N) with a single division
+    const double cents = exact_amount * 100;
+    const double rounded = round(cents);
+    if (fabs(fabs(cents - rounded) - 0.5) * (growth - 1) <= cents * PAYMENT_KERNEL_TOLERANCE * growth) // Error relative to 1 - (1+R)^-N
+    {
+        return -1; // Too close to call
+    }
+    return rounded / 100; // Same as round_to_nearest_cent_amount(exact_amount)
+}
+
 // Calculate monthly payment for a loan using the amortization formula
-// - Formula: (L*R)/(1-[1/(1+R)]^N), where L=amount, R=monthly rate, N=total payments
+// - Standard terms (10/15/20/30 years, nearly every request) use a kernel specialized for their number of payments
 // Return a double of the calculated monthly payment
 double calculate_monthly_payment(int amount, int years, double rate)
+{
+    const double monthly_rate = (rate / 100) / 12;
+    double payment = -1;
+    if (monthly_rate != 0)
+    {
+        switch (years)
+        {
+        case 10:
+            payment = monthly_payment_kernel<10>(amount, monthly_rate);
+            break;
+        case 15:
+            payment = monthly_payment_kernel<15>(amount, monthly_rate);
+            break;
+        case 20:
+            payment = monthly_payment_kernel<20>(amount, monthly_rate);
+            break;
+        case 30:
+            payment = monthly_payment_kernel<30>(amount, monthly_rate);
+            break;
+        }
+    }
+    return payment >= 0 ? payment : calculate_monthly_payment_generic(amount, years, rate);
+}
+
+// Calculate monthly payment for a loan using the amortization formula, any term
+// - Formula: (L*R)/(1-[1/(1+R)]^N), where L=amount, R=monthly rate, N=total payments
+// Return a double of the calculated monthly payment
+double calculate_monthly_payment_generic(int amount, int years, double rate)
 {
     double monthly_rate = (rate / 100) / 12; // Convert percentage to decimal and annual rate to monthly
     int total_payments = years * 12;         // Total number of payments (I assume this means per year)
@@ -82,25 +244,158 @@ double calculate_monthly_payment(int amount, int years, double rate)
     return round_to_nearest_cent_amount(exact_amount);
 }
 
-// Removes trailing 0's when applying to_string() to a double
-// - Example: to_string(777.06) is "777.060000" which isn't a valid dollar amount
-// Returns a valid dollar amount as a string
-string format_double(double value)
+// Rounds a double to a fixed number of decimals, then removes the trailing 0's
+// - Example: to_string(777.06) is "777.060000" which isn't a valid dollar amount, and a yearly total (monthly payment * 12) can come
+//   out as "23999987000.009998", MONEY_DECIMALS gives "777.06" and "23999987000.01", RATE_DECIMALS keeps grid steps like 3.25
+// Returns the formatted number as a string
+string format_double(double value, int decimals)
+{
+    char str[64];
+    size_t length = format_double(value, decimals, str, sizeof(str));
+    return string(str, length); // Return formatted string of a double
+}
+
+// Same as format_double() above but writes into output instead of allocating a string
+// Returns the number of characters written (output is null-terminated)
+size_t format_double(double value, int decimals, char *output, size_t capacity)
 {
-    string str = to_string(value);            // Convert value to string (will have trailing 0's)
-    str.erase(str.find_last_not_of('0') + 1); // Remove trailing zeros
-    if (str.back() == '.')
-        str.pop_back(); // Remove trailing dot if no decimals remain
-    return str;         // Return formatted string of a double
+    int length = snprintf(output, capacity, "%.*f", decimals, value); // Rounded to decimals (will have trailing 0's)
+    if (length < 0 || (size_t)length >= capacity)
+    {
+        output[0] = '\0';
+        return 0; // Doesn't fit
+    }
+    while (length > 0 && output[length - 1] == '0')
+        length--; // Remove trailing zeros
+    if (length > 0 && output[length - 1] == '.')
+        length--; // Remove trailing dot if no decimals remain
+    output[length] = '\0';
+    return length;
+}
+
+// Write "ip:port" into output for logging
+// Returns the number of characters written
+size_t format_address(const sockaddr_in &address, char *output, size_t capacity)
+{
+    char ip_str[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &address.sin_addr, ip_str, INET_ADDRSTRLEN);
+    int length = snprintf(output, capacity, "%s:%u", ip_str, ntohs(address.sin_port));
+    return length < 0 ? 0 : min((size_t)length, capacity - 1);
+}
+
+// Append a report with monthly and yearly payments for a validated <amount> <years> <rate> to the arena's response
+// Return 0 on success, -1 if the response buffer is full
+int generate_payment_report(const loan_request &loan, request_arena &arena)
+{
+    double monthly_payment = calculate_monthly_payment((int)loan.amount, loan.years, loan.rate); // Calculate monthly payment
+    double yearly_payment = (monthly_payment * 12);                                              // Total payment per year
+
+    char monthly_str[64];
+    char yearly_str[64];
+    size_t monthly_length = format_double(monthly_payment, MONEY_DECIMALS, monthly_str, sizeof(monthly_str));
+    size_t yearly_length = format_double(yearly_payment, MONEY_DECIMALS, yearly_str, sizeof(yearly_str));
+
+    // Formatted output: "\n$<amount> loan\nmonthly payment is $<monthly>\ntotal payment is $<yearly>" (amount without commas)
+    int status = arena.append("\n$");
+    for (char c : loan.terms[0])
+    {
+        if (c != ',')
+            status |= arena.append(string_view(&c, 1));
+    }
+    status |= arena.append(" loan\nmonthly payment is $");
+    status |= arena.append(string_view(monthly_str, monthly_length));
+    status |= arena.append("\ntotal payment is $");
+    status |= arena.append(string_view(yearly_str, yearly_length));
+    return status == 0 ? 0 : -1;
 }
 
-// Return a report string with monthly and yearly payments from <amount> <years> <rate> given a string array
-string generate_payment_report(string terms[])
+// Answer SCHEDULE <amount> <years> <rate> with the month by month amortization schedule as CSV
+// - Interest is rounded to the cent every month and the last payment clears whatever balance is left, like a real loan statement
+// - Too large for one UDP datagram for most terms, UDP clients receive it segmented (see SEGMENT_COMMAND)
+// Return 0 if a response was appended, 1 if message isn't a SCHEDULE message, -1 if it is invalid or doesn't fit
+int handle_schedule_message(string_view message, request_arena &arena)
 {
-    double monthly_payment = calculate_monthly_payment(stoi(terms[0]), stoi(terms[1]), stod(terms[2])); // Calculate monthly payment
-    double yearly_payment = (monthly_payment * 12);                                                      // Total payment per year
+    if (!is_command(message, SCHEDULE_COMMAND))
+    {
+        return 1; // Not a schedule
+    }
+    loan_request loan;
+    if (validate_message(message.substr(SCHEDULE_COMMAND.size() + 1), loan) != 0)
+    {
+        return -1; // Fail
+    }
+    if (loan.years > MAX_SCHEDULE_YEARS)
+    {
+        log("ERROR", "Schedule too long", "Up to " + to_string(MAX_SCHEDULE_YEARS) + " years");
+        return -1; // Fail
+    }
 
-    string output = string("\n$") + terms[0] + " loan\nmonthly payment is $" + format_double(monthly_payment) + "\ntotal payment is $" + format_double(yearly_payment); // Formatted output string
+    const double payment = calculate_monthly_payment((int)loan.amount, loan.years, loan.rate);
+    const double monthly_rate = (loan.rate / 100) / 12;
+    const int total_payments = loan.years * 12;
+    double balance = (int)loan.amount;
+    double total_interest = 0;
 
-    return output; // Return formatted output string
+    int status = arena.appendf("\n$%d loan amortization schedule\nmonth,payment,interest,principal,balance\n", (int)loan.amount);
+    for (int month = 1; month <= total_payments; month++)
+    {
+        double interest = round_to_nearest_cent_amount(balance * monthly_rate);
+        double principal = round_to_nearest_cent_amount(payment - interest);
+        if (month == total_payments || principal > balance)
+        {
+            principal = balance; // Final payment settles the rounding left over from earlier months
+        }
+        balance = round_to_nearest_cent_amount(balance - principal);
+        total_interest += interest;
+        status |= arena.appendf("%d,%.2f,%.2f,%.2f,%.2f\n", month, principal + interest, interest, principal, balance);
+    }
+    status |= arena.appendf("total interest is $%.2f", round_to_nearest_cent_amount(total_interest));
+    return status == 0 ? 0 : -1;
+}
+
+// Forget the previous request, the buffers are reused as they are (no zero-filling)
+void request_arena::reset()
+{
+    receive_length = 0;
+    transmit_length = 0;
+}
+
+string_view request_arena::received() const
+{
+    return string_view(receive_buffer, receive_length);
+}
+
+string_view request_arena::response() const
+{
+    return string_view(transmit_buffer, transmit_length);
+}
+
+// Append text to the response being built
+// Return 0 on success, -1 if it doesn't fit (nothing is appended)
+int request_arena::append(string_view text)
+{
+    if (text.size() > sizeof(transmit_buffer) - transmit_length)
+    {
+        return -1; // Fail
+    }
+    memcpy(transmit_buffer + transmit_length, text.data(), text.size());
+    transmit_length += text.size();
+    return 0; // Success
+}
+
+// printf-style append to the response being built, formats in place without a temporary string
+// Return 0 on success, -1 if it doesn't fit (nothing is appended)
+int request_arena::appendf(const char *format, ...)
+{
+    size_t capacity = sizeof(transmit_buffer) - transmit_length;
+    va_list arguments;
+    va_start(arguments, format);
+    int length = vsnprintf(transmit_buffer + transmit_length, capacity, format, arguments);
+    va_end(arguments);
+    if (length < 0 || (size_t)length >= capacity)
+    {
+        return -1; // Fail
+    }
+    transmit_length += length;
+    return 0; // Success
 }
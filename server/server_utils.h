@@ -4,13 +4,76 @@
 
 #include <string> // For strings from char*
 
+#define MESSAGE_BUFFER_SIZE 1024   // Client message buffer size in bytes
+#define RESPONSE_BUFFER_SIZE 32768 // Server response buffer size in bytes (fits a full *_BATCH response and a MAX_SCHEDULE_YEARS schedule)
+#define LOAN_TERM_COUNT 3          // <amount> <years> <rate>
+#define MAX_SCHEDULE_YEARS MAX_LOAN_YEARS // Longest term answered by SCHEDULE
+#define MAX_IO_THREADS 16          // Upper bound for --io-threads
+#define MAX_WORKERS 64             // Upper bound for --workers
+#define MONEY_DECIMALS 2           // Dollar amounts are rounded to the cent
+#define RATE_DECIMALS 6            // Rates in percent keep at most 6 decimals
+
 using namespace std;
 
-int split_by_space(string prevalidated_message, string output[]);     // Split string by spaces and populate array of strings
-int validate_message(const string &prevalidated_message);             // Validates string with format <amount> <years> <rate>
-double round_to_nearest_cent_amount(double amount);                   // Round double to nearest 2nd decimal place
-double calculate_monthly_payment(int amount, int years, double rate); // Apply monthly loan calculation
-string format_double(double value);                                   // Removes trailing 0's when applying to_string() to a double
-string generate_payment_report(string terms[]);                       // Generate string of payment report
+// Command line options shared by TCP and UDP servers
+struct server_options
+{
+    bool hot_restart = false;     // --hot-restart: take over sockets from a running server and hand them off on the next restart
+    double rate_limit = 0;        // --rate-limit <requests/sec>: per client address, 0 disables rate limiting
+    double rate_burst = 0;        // --burst <requests>: bucket size, defaults to one second worth of requests
+    bool drop_throttled = false;  // --drop-throttled: silently drop over-limit requests instead of replying BUSY
+    int idle_timeout = 10000;     // --idle-timeout <ms>: TCP only, max wait for the first byte of a request or for a stalled response to drain, 0 disables
+    int read_timeout = 5000;      // --read-timeout <ms>: TCP only, max gap between bytes once a request started arriving, 0 disables
+    int request_timeout = 30000;  // --request-timeout <ms>: TCP only, max time from accept to response sent (not applied to streamed grids), 0 disables
+    int segment_pace = 4;         // --segment-pace <segments/ms>: UDP only, segments of one segmented response sent per millisecond, 0 sends them all at once
+    string record_path;           // --record <file>: append every incoming request to a recording for tools/Replay.cpp, empty disables
+    bool tcp_info = false;        // --tcp-info: TCP only, sample TCP_INFO of every connection into histograms and log outliers
+    int io_threads = 1;           // --io-threads <n>: TCP only, event loops that accept, receive and send (1 to MAX_IO_THREADS)
+    int workers = 0;              // --workers <n>: TCP only, compute threads for SCHEDULE, SCENARIO and *_BATCH requests, 0 computes every request on its I/O thread
+    int port = SERVER_PORT;       // --port <n>: listen on another port (several replicas on one host), hot restart then uses its own handoff path
+    bool rx_stats = false;        // --rx-stats: UDP only, kernel receive timestamps and drop counts, queueing delay measured apart from processing and sending
+    int receive_buffer = 0;       // --rcvbuf <bytes>: UDP only, SO_RCVBUF of the server socket, 0 keeps the kernel default
+    bool admission = false;       // --admission: adaptive concurrency limit, requests over it are answered OVERLOADED <retry_after_ms> right away
+    int target_latency = 20;      // --target-latency <ms>: with --admission, the limit grows while answers take less than this and shrinks when they take longer
+};
+
+// Memory reused by every request on a connection (TCP) or on the server thread (UDP)
+// - Nothing on the request path allocates: the message is received here, parsed in place and the response is written here
+// - Buffers are never zero-filled, the lengths say how much is valid
+struct request_arena
+{
+    char receive_buffer[MESSAGE_BUFFER_SIZE];   // Raw client message
+    size_t receive_length = 0;                  // Bytes of receive_buffer in use
+    char transmit_buffer[RESPONSE_BUFFER_SIZE]; // Response being built
+    size_t transmit_length = 0;                 // Bytes of transmit_buffer in use
+
+    void reset();                        // Forget the previous request (keeps the memory)
+    string_view received() const;        // Message received so far
+    string_view response() const;        // Response built so far
+    int append(string_view text);        // Add to the response, -1 if it doesn't fit
+    int appendf(const char *format, ...) // printf-style append, -1 if it doesn't fit
+        __attribute__((format(printf, 2, 3)));
+};
+
+// A validated <amount> <years> <rate> message
+struct loan_request
+{
+    string_view terms[LOAN_TERM_COUNT]; // Arguments as sent by the client (views into the receive buffer)
+    double amount;                      // Parsed <amount>
+    int years;                          // Parsed <years>
+    double rate;                        // Parsed <rate>
+};
+
+int parse_server_options(int argc, char *argv[], server_options &options);        // Parse optional server flags (see README)
+int split_by_space(string_view prevalidated_message, string_view output[]);       // Split message by spaces into views of each argument
+int validate_message(string_view prevalidated_message, loan_request &loan);       // Validates message with format <amount> <years> <rate>
+double round_to_nearest_cent_amount(double amount);                               // Round double to nearest 2nd decimal place
+double calculate_monthly_payment(int amount, int years, double rate);             // Apply monthly loan calculation (specialized kernels for 10/15/20/30 years)
+double calculate_monthly_payment_generic(int amount, int years, double rate);     // Same with pow() for any term, the reference the specialized kernels match
+string format_double(double value, int decimals);                                 // Round to decimals, then remove trailing 0's
+size_t format_double(double value, int decimals, char *output, size_t capacity);  // Same as above without allocating, returns length written
+size_t format_address(const sockaddr_in &address, char *output, size_t capacity); // Write "ip:port" for logging, returns length written
+int generate_payment_report(const loan_request &loan, request_arena &arena);      // Append payment report to the arena's response
+int handle_schedule_message(string_view message, request_arena &arena);           // Append the amortization schedule for a SCHEDULE message
 
 #endif // SERVER_H_UTILS_H
\ No newline at end of file
@@ -0,0 +1,406 @@
+#include "solvers.h" // Inverse loan solvers
+
+#include <cmath>   // log1p, expm1, exp, fabs, floor
+#include <climits> // INT_MAX
+
+const double RATE_TOLERANCE = 1e-12; // Relative Newton step size at which the monthly rate counts as converged
+
+// Annuity factor (1 - (1+r)^-n) / r for a monthly rate r over n payments, n when r is 0
+// - Uses log1p/expm1 so small rates don't lose precision to 1 - (almost 1)
+// Documentation on log1p/expm1 - https://en.cppreference.com/w/cpp/numeric/math/expm1
+static double annuity_factor(double monthly_rate, int total_payments)
+{
+    if (monthly_rate == 0)
+    {
+        return total_payments;
+    }
+    return -expm1(-total_payments * log1p(monthly_rate)) / monthly_rate;
+}
+
+// Principal L for a payment M: inverse of M = L*R / (1 - (1+R)^-N), so L = M * (1 - (1+R)^-N) / R
+// Return the exact (unrounded) principal
+double solve_principal(double payment, int years, double rate)
+{
+    return payment * annuity_factor((rate / 100) / 12, years * 12);
+}
+
+// Largest whole dollar amount that calculate_monthly_payment() prices at or below payment
+// - Starts from the closed form and then steps a few dollars to absorb rounding to the cent
+// Return the amount, 0 if even $1 is not affordable
+int affordable_amount(double payment, int years, double rate)
+{
+    const int MAX_STEPS = 10000; // Rounding moves the answer by a few dollars at most, this is only a safety net
+    double exact = floor(solve_principal(payment, years, rate) + 1e-6);
+    int amount = exact >= INT_MAX ? INT_MAX - 1 : (int)exact;
+    for (int step = 0; step < MAX_STEPS && amount > 0 && calculate_monthly_payment(amount, years, rate) > payment; step++)
+    {
+        amount--; // Rounded payment is a cent over, try one dollar less
+    }
+    for (int step = 0; step < MAX_STEPS && amount < INT_MAX - 1 && calculate_monthly_payment(amount + 1, years, rate) <= payment; step++)
+    {
+        amount++; // Rounded payment is a cent under, one dollar more still fits
+    }
+    return amount;
+}
+
+// Evaluate g(r) = payment(r) - target and its derivative for Newton-Raphson
+// - payment(r) = L*r / (1-d) with d = (1+r)^-N, d/dr(1-d) = N*d/(1+r)
+static void rate_residual(double amount, double payment, int total_payments, double monthly_rate, double &residual, double &slope)
+{
+    double log_growth = total_payments * log1p(monthly_rate);
+    double discount = exp(-log_growth);              // (1+r)^-N
+    double one_minus_discount = -expm1(-log_growth); // 1 - (1+r)^-N without cancellation
+    residual = amount * monthly_rate / one_minus_discount - payment;
+    slope = amount * (one_minus_discount - monthly_rate * total_payments * discount / (1 + monthly_rate)) / (one_minus_discount * one_minus_discount);
+}
+
+// Starting point for the rate solvers, the larger of two lower bounds on the monthly rate:
+// - payment(r) <= L/N * (1 + r*(N+1)/2) (tangent at r = 0, tight for small rates)
+// - payment(r) <= L*r + L/N (tight for large rates)
+// Both are below the root, so the first Newton step is well behaved and later steps stay inside the bracket
+static double initial_rate_guess(double payment, double amount, int total_payments)
+{
+    double small_rate_guess = 2 * (payment * total_payments / amount - 1) / (total_payments + 1);
+    double large_rate_guess = payment / amount - 1.0 / total_payments;
+    return max(small_rate_guess, large_rate_guess);
+}
+
+// Annual rate (percent) at which calculate_monthly_payment(amount, years, rate) equals payment
+// - The payment only grows with the rate, so the monthly rate is bracketed by (0, payment/amount]:
+//   at r = payment/amount the interest alone equals the payment
+// - Newton-Raphson from a first order guess, falling back to bisection whenever a step leaves the bracket
+// Return 0 on success, -1 if the payment can't repay the amount even at 0%
+int solve_rate(double payment, double amount, int years, double &rate, int &iterations)
+{
+    const int N = years * 12; // Total payments
+    iterations = 0;
+    if (payment * N < amount * (1 - 1e-12))
+    {
+        return -1; // Fail, payment is below the zero interest payment
+    }
+    if (payment * N <= amount * (1 + 1e-12))
+    {
+        rate = 0; // Exactly the zero interest payment
+        return 0;
+    }
+
+    double low = 0;
+    double high = payment / amount;
+    double monthly_rate = initial_rate_guess(payment, amount, N);
+
+    while (iterations < MAX_RATE_ITERATIONS)
+    {
+        iterations++;
+        double residual, slope;
+        rate_residual(amount, payment, N, monthly_rate, residual, slope);
+        if (residual == 0)
+            break; // Landed exactly on the root
+        if (residual > 0)
+            high = monthly_rate; // Rate too high
+        else
+            low = monthly_rate; // Rate too low
+
+        double next = monthly_rate - residual / slope;
+        if (!(next >= low && next <= high))
+        {
+            next = 0.5 * (low + high); // Newton left the bracket, bisect instead
+        }
+        bool converged = fabs(next - monthly_rate) <= RATE_TOLERANCE * monthly_rate;
+        monthly_rate = next;
+        if (converged)
+            break;
+    }
+
+    rate = monthly_rate * 12 * 100; // Monthly decimal back to annual percent
+    return 0;                       // Success
+}
+
+// Batched solve_principal() over structure-of-arrays input
+// - No branches in the loop (the zero rate case is a select) so the compiler can vectorize it
+void solve_principal_batch(const double payment[], const int years[], const double rate[], double principal[], int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        double monthly_rate = (rate[i] / 100) / 12;
+        int total_payments = years[i] * 12;
+        double safe_rate = monthly_rate > 0 ? monthly_rate : 1; // Avoid 0/0 in the lane that selects N anyway
+        double factor = -expm1(-total_payments * log1p(safe_rate)) / safe_rate;
+        principal[i] = payment[i] * (monthly_rate > 0 ? factor : total_payments);
+    }
+}
+
+// Batched solve_rate() over structure-of-arrays input
+// - All lanes of a block run the same safeguarded Newton step in lockstep with selects instead of branches,
+//   finished lanes are masked out, and the block stops once every lane converged
+// - rate[i] is -1 when the payment can't repay the amount, iterations[i] counts the steps lane i needed
+void solve_rate_batch(const double payment[], const double amount[], const int years[], double rate[], int iterations[], int count)
+{
+    const int BLOCK = 64; // Lanes per block, keeps the per-lane state on the stack
+    for (int start = 0; start < count; start += BLOCK)
+    {
+        const int LANES = min(BLOCK, count - start);
+        double monthly_rate[BLOCK], low[BLOCK], high[BLOCK], target[BLOCK], principal[BLOCK];
+        int total_payments[BLOCK];
+        bool done[BLOCK];
+
+        for (int i = 0; i < LANES; i++)
+        {
+            const int N = years[start + i] * 12;
+            const double M = payment[start + i];
+            const double L = amount[start + i];
+            const bool solvable = M * N > L * (1 + 1e-12); // Otherwise the answer is 0% or no solution
+            target[i] = solvable ? M : 2.0;    // Harmless dummy lane (L=1, M=2, N=1) when not solvable
+            principal[i] = solvable ? L : 1.0;
+            total_payments[i] = solvable ? N : 1;
+            low[i] = 0;
+            high[i] = target[i] / principal[i];
+            monthly_rate[i] = initial_rate_guess(target[i], principal[i], total_payments[i]);
+            done[i] = !solvable;
+            iterations[start + i] = 0;
+            rate[start + i] = (M * N < L * (1 - 1e-12)) ? -1 : 0; // Final value for unsolvable lanes
+        }
+
+        for (int step = 0; step < MAX_RATE_ITERATIONS; step++)
+        {
+            int active = 0;
+            for (int i = 0; i < LANES; i++)
+            {
+                double r = monthly_rate[i];
+                double log_growth = total_payments[i] * log1p(r);
+                double discount = exp(-log_growth);
+                double one_minus_discount = -expm1(-log_growth);
+                double residual = principal[i] * r / one_minus_discount - target[i];
+                double slope = principal[i] * (one_minus_discount - r * total_payments[i] * discount / (1 + r)) / (one_minus_discount * one_minus_discount);
+
+                bool too_high = residual > 0;
+                double new_high = too_high ? r : high[i];
+                double new_low = too_high ? low[i] : r;
+                double next = r - residual / slope;
+                next = (next >= new_low && next <= new_high) ? next : 0.5 * (new_low + new_high);
+                next = residual == 0 ? r : next; // Landed exactly on the root
+                bool converged = fabs(next - r) <= RATE_TOLERANCE * r;
+
+                // Finished lanes keep their state
+                high[i] = done[i] ? high[i] : new_high;
+                low[i] = done[i] ? low[i] : new_low;
+                monthly_rate[i] = done[i] ? r : next;
+                iterations[start + i] += done[i] ? 0 : 1;
+                done[i] = done[i] || converged;
+                active += done[i] ? 0 : 1;
+            }
+            if (active == 0)
+                break;
+        }
+
+        for (int i = 0; i < LANES; i++)
+        {
+            if (iterations[start + i] > 0)
+            {
+                rate[start + i] = monthly_rate[i] * 12 * 100; // Monthly decimal back to annual percent
+            }
+        }
+    }
+}
+
+// Parse one <x:y:z> batch item into 3 numbers (commas and % signs are ignored)
+// - Batch items aren't logged one by one like validate_amount() etc, a batch can have 64 of them
+// Return 0 on success, -1 on fail
+static int parse_batch_item(string_view item, double values[3])
+{
+    for (int v = 0; v < 3; v++)
+    {
+        size_t colon = item.find(':');
+        if ((v < 2) == (colon == string_view::npos))
+        {
+            return -1; // Fail, expected exactly 3 values
+        }
+        string_view value = item.substr(0, colon);
+        item = colon == string_view::npos ? string_view() : item.substr(colon + 1);
+
+        char value_str[MAX_NUMBER_LENGTH];
+        size_t length = 0;
+        for (char c : value)
+        {
+            if (c == ',' || c == '%')
+                continue;
+            if (length + 1 >= MAX_NUMBER_LENGTH)
+                return -1; // Fail
+            value_str[length++] = c;
+        }
+        value_str[length] = '\0';
+        char *end;
+        values[v] = strtod(value_str, &end);
+        if (end == value_str || *end != '\0' || !(values[v] > 0) || values[v] > INT_MAX) // Every value must be positive
+        {
+            return -1; // Fail
+        }
+    }
+    return 0; // Success
+}
+
+// Split a batch message into its items and parse each into values[i][3]
+// Return number of items, -1 on fail
+static int parse_batch(string_view items, double values[][3])
+{
+    int count = 0;
+    while (!items.empty())
+    {
+        size_t space = items.find(' ');
+        string_view item = items.substr(0, space);
+        items = space == string_view::npos ? string_view() : items.substr(space + 1);
+        if (item.empty())
+            continue; // Extra spaces
+        if (count == MAX_BATCH_ITEMS || parse_batch_item(item, values[count]) != 0)
+        {
+            log("ERROR", "Invalid batch item", item);
+            return -1; // Fail
+        }
+        count++;
+    }
+    if (count == 0)
+    {
+        log("ERROR", "Empty batch");
+        return -1; // Fail
+    }
+    return count;
+}
+
+// Append a dollar amount (rounded to the cent, trailing zeros removed) to the response
+static int append_money(request_arena &arena, double value)
+{
+    char value_str[64];
+    return arena.append(string_view(value_str, format_double(value, MONEY_DECIMALS, value_str, sizeof(value_str))));
+}
+
+// Append a rate in percent (6 decimals at most) to the response
+static int append_rate(request_arena &arena, double rate)
+{
+    char rate_str[64];
+    return arena.append(string_view(rate_str, format_double(rate, RATE_DECIMALS, rate_str, sizeof(rate_str))));
+}
+
+// Answer a PRINCIPAL, RATE, PRINCIPAL_BATCH or RATE_BATCH message
+// - Formats straight into the arena like generate_payment_report(), so solves don't allocate either
+// Return 0 if a response was appended, 1 if message isn't a solver message, -1 if it is invalid
+int handle_solver_message(string_view message, request_arena &arena)
+{
+    int status = 0;
+    if (is_command(message, PRINCIPAL_COMMAND) || is_command(message, RATE_COMMAND))
+    {
+        // PRINCIPAL <payment> <years> <rate> or RATE <payment> <amount> <years>
+        const bool PRINCIPAL = is_command(message, PRINCIPAL_COMMAND);
+        string_view terms[LOAN_TERM_COUNT];
+        if (split_by_space(message.substr(message.find(' ') + 1), terms) != 0)
+        {
+            return -1; // Fail
+        }
+        double payment, amount, rate;
+        int years;
+        if (PRINCIPAL)
+        {
+            if (validate_amount(terms[0], &payment) != 0 || validate_years(terms[1], &years) != 0 || validate_rate(terms[2], &rate) != 0)
+                return -1; // Fail
+            int affordable = affordable_amount(payment, years, rate);
+            status |= arena.append("\n$");
+            status |= append_money(arena, payment);
+            status |= arena.append(" monthly payment\nloan amount is $");
+            status |= append_money(arena, solve_principal(payment, years, rate));
+            status |= arena.append("\naffordable amount is $");
+            status |= arena.appendf("%d", affordable);
+            status |= arena.append(" (monthly payment $");
+            status |= append_money(arena, calculate_monthly_payment(affordable, years, rate));
+            status |= arena.append(")");
+        }
+        else
+        {
+            if (validate_amount(terms[0], &payment) != 0 || validate_amount(terms[1], &amount) != 0 || validate_years(terms[2], &years) != 0)
+                return -1; // Fail
+            int iterations;
+            status |= arena.append("\n$");
+            status |= append_money(arena, amount);
+            status |= arena.append(" loan\nmonthly payment is $");
+            status |= append_money(arena, payment);
+            if (solve_rate(payment, amount, years, rate, iterations) == 0)
+            {
+                status |= arena.append("\nimplied rate is ");
+                status |= append_rate(arena, rate);
+                status |= arena.appendf("%% (%d iterations)", iterations);
+            }
+            else
+            {
+                status |= arena.append("\nno rate: payment is below the zero interest payment");
+            }
+        }
+    }
+    else if (is_command(message, PRINCIPAL_BATCH_COMMAND) || is_command(message, RATE_BATCH_COMMAND))
+    {
+        // PRINCIPAL_BATCH <payment:years:rate> ... or RATE_BATCH <payment:amount:years> ...
+        const bool PRINCIPAL = is_command(message, PRINCIPAL_BATCH_COMMAND);
+        double values[MAX_BATCH_ITEMS][3];
+        int count = parse_batch(message.substr(message.find(' ') + 1), values);
+        if (count == -1)
+        {
+            return -1; // Fail
+        }
+
+        // Structure-of-arrays copies for the batch kernels
+        double payment[MAX_BATCH_ITEMS], second[MAX_BATCH_ITEMS], result[MAX_BATCH_ITEMS];
+        int years[MAX_BATCH_ITEMS], iterations[MAX_BATCH_ITEMS];
+        for (int i = 0; i < count; i++)
+        {
+            payment[i] = values[i][0];
+            second[i] = PRINCIPAL ? values[i][2] : values[i][1]; // Rate for PRINCIPAL_BATCH, amount for RATE_BATCH
+            const double item_years = PRINCIPAL ? values[i][1] : values[i][2];
+            if (!(item_years > 0) || item_years != floor(item_years) || item_years > MAX_LOAN_YEARS)
+            {
+                log("ERROR", "Invalid batch item", "Years must be a positive integer up to " + to_string(MAX_LOAN_YEARS)); // Checked before the cast, like validate_years() does for single requests
+                return -1; // Fail
+            }
+            years[i] = (int)item_years;
+        }
+
+        if (PRINCIPAL)
+        {
+            solve_principal_batch(payment, years, second, result, count);
+            status |= arena.append("\npayment,years,rate,amount\n");
+            for (int i = 0; i < count; i++)
+            {
+                status |= append_money(arena, payment[i]);
+                status |= arena.appendf(",%d,", years[i]);
+                status |= append_rate(arena, second[i]);
+                status |= arena.append(",");
+                status |= append_money(arena, result[i]);
+                status |= arena.append("\n");
+            }
+        }
+        else
+        {
+            solve_rate_batch(payment, second, years, result, iterations, count);
+            status |= arena.append("\npayment,amount,years,rate,iterations\n");
+            for (int i = 0; i < count; i++)
+            {
+                status |= append_money(arena, payment[i]);
+                status |= arena.append(",");
+                status |= append_money(arena, second[i]);
+                status |= arena.appendf(",%d,", years[i]);
+                if (result[i] < 0)
+                    status |= arena.append("none");
+                else
+                    status |= append_rate(arena, result[i]);
+                status |= arena.appendf(",%d\n", iterations[i]);
+            }
+        }
+        log("INFO", PRINCIPAL ? "Principal batch solved" : "Rate batch solved");
+    }
+    else
+    {
+        return 1; // Not a solver message
+    }
+
+    if (status != 0)
+    {
+        log("ERROR", "Solver response too large");
+        return -1; // Fail
+    }
+    return 0; // Success
+}
@@ -0,0 +1,17 @@
+// Inverse loan solvers: the largest affordable principal for a payment, and the rate implied by a payment
+// Both use the same amortization formula as calculate_monthly_payment() so answers round-trip through it
+#ifndef SOLVERS_H
+#define SOLVERS_H
+#include "server_utils.h" // Server specific headers
+
+#define MAX_BATCH_ITEMS 64     // Max solves in one *_BATCH message (a 1024 byte message fits about 60)
+#define MAX_RATE_ITERATIONS 64 // Newton-Raphson iteration cap for the rate solver
+
+double solve_principal(double payment, int years, double rate);                                         // Exact principal whose payment is <payment> (closed form)
+int affordable_amount(double payment, int years, double rate);                                          // Largest whole dollar <amount> whose calculate_monthly_payment() is at most <payment>
+int solve_rate(double payment, double amount, int years, double &rate, int &iterations);                // Annual rate (percent) implied by a payment, safeguarded Newton-Raphson
+void solve_principal_batch(const double payment[], const int years[], const double rate[], double principal[], int count); // Batched solve_principal() over arrays
+void solve_rate_batch(const double payment[], const double amount[], const int years[], double rate[], int iterations[], int count); // Batched solve_rate() over arrays, -1 rate if no solution
+int handle_solver_message(string_view message, request_arena &arena);                                  // Answer PRINCIPAL/RATE/*_BATCH messages into the arena
+
+#endif // SOLVERS_H
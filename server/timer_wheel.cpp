@@ -0,0 +1,161 @@
+#include "timer_wheel.h" // Hierarchical timer wheel
+
+#include <ctime> // clock_gettime
+
+const uint64_t SLOT_MASK = WHEEL_SLOTS - 1;                               // Slot index bits of one level
+const uint64_t WHEEL_RANGE = 1ULL << (WHEEL_SLOT_BITS * WHEEL_LEVELS); // Longest delay the wheel can represent (ms)
+
+// Slot index of a tick on a given level
+static inline uint64_t slot_index(uint64_t tick, int level)
+{
+    return (tick >> (WHEEL_SLOT_BITS * level)) & SLOT_MASK;
+}
+
+// Unlink a timer from whatever slot list it is on
+static inline void unlink(timer_node &timer)
+{
+    timer.prev->next = timer.next;
+    timer.next->prev = timer.prev;
+    timer.next = nullptr;
+    timer.prev = nullptr;
+}
+
+timer_wheel::timer_wheel(uint64_t now_ms) : current(now_ms)
+{
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+    {
+        for (int slot = 0; slot < WHEEL_SLOTS; slot++)
+        {
+            slots[level][slot].next = &slots[level][slot]; // Empty circular list points at itself
+            slots[level][slot].prev = &slots[level][slot];
+        }
+    }
+}
+
+// Level 0 holds the next 64 ms one tick per slot, level 1 the next 64 * 64 ms 64 ticks per slot and so on
+// - A timer further away than the whole wheel is parked in the last level and re-placed when it cascades down
+void timer_wheel::place(timer_node &timer)
+{
+    uint64_t expires = timer.expires < current ? current : timer.expires; // Overdue timers fire on the next tick
+    uint64_t delta = expires - current;
+    if (delta >= WHEEL_RANGE)
+    {
+        expires = current + WHEEL_RANGE - 1; // Only picks the slot, timer.expires keeps the real deadline
+        delta = WHEEL_RANGE - 1;
+    }
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << (WHEEL_SLOT_BITS * (level + 1))))
+    {
+        level++;
+    }
+
+    timer_node &head = slots[level][slot_index(expires, level)];
+    timer.prev = head.prev; // Append at the tail
+    timer.next = &head;
+    head.prev->next = &timer;
+    head.prev = &timer;
+}
+
+// Called when every lower level wrapped around: the slot of this level that starts now is re-placed,
+// all of its timers are due within one revolution of the level below so they move down
+void timer_wheel::cascade(int level)
+{
+    timer_node &head = slots[level][slot_index(current, level)];
+    timer_node *timer = head.next;
+    head.next = &head; // Detach the whole list first, place() may append to other slots
+    head.prev = &head;
+    while (timer != &head)
+    {
+        timer_node *next = timer->next;
+        place(*timer);
+        timer = next;
+    }
+}
+
+void timer_wheel::schedule(timer_node &timer, uint64_t expires_ms)
+{
+    cancel(timer);
+    timer.expires = expires_ms;
+    place(timer);
+    count++;
+}
+
+void timer_wheel::cancel(timer_node &timer)
+{
+    if (timer.prev == nullptr)
+    {
+        return; // Not scheduled
+    }
+    unlink(timer);
+    count--;
+}
+
+// Process every tick up to now_ms, cascading higher levels down when the ones below wrap
+// - The returned timers are already unscheduled, read timer->next before rescheduling one of them
+timer_node *timer_wheel::advance(uint64_t now_ms)
+{
+    timer_node *expired = nullptr;
+    timer_node **tail = &expired;
+
+    while (current <= now_ms)
+    {
+        if (count == 0)
+        {
+            current = now_ms + 1; // Nothing scheduled, skip ahead instead of walking empty slots
+            break;
+        }
+
+        // Find the highest level whose lower levels all wrapped on this tick, then cascade top down
+        int top = 0;
+        while (top < WHEEL_LEVELS - 1 && slot_index(current, top) == 0)
+        {
+            top++;
+        }
+        for (int level = top; level >= 1; level--)
+        {
+            cascade(level);
+        }
+
+        // Everything left in the level 0 slot is due
+        timer_node &head = slots[0][slot_index(current, 0)];
+        while (head.next != &head)
+        {
+            timer_node *timer = head.next;
+            unlink(*timer);
+            count--;
+            *tail = timer;
+            tail = &timer->next;
+        }
+        current++;
+    }
+    *tail = nullptr;
+    return expired;
+}
+
+// Sleep until the next non-empty level 0 slot or the next cascade, whichever comes first
+// - Never later than a deadline, at most one level 0 revolution (64 ms) early
+int timer_wheel::next_timeout(uint64_t now_ms) const
+{
+    if (count == 0)
+    {
+        return -1; // Sleep until an event arrives
+    }
+    for (uint64_t tick = current; tick < current + WHEEL_SLOTS; tick++)
+    {
+        const timer_node &head = slots[0][slot_index(tick, 0)];
+        if (slot_index(tick, 0) == 0 || head.next != &head)
+        {
+            return tick <= now_ms ? 0 : (int)(tick - now_ms);
+        }
+    }
+    return WHEEL_SLOTS; // Unreachable, a revolution always contains a cascade tick
+}
+
+// Documentation on clock_gettime - https://man7.org/linux/man-pages/man2/clock_gettime.2.html
+uint64_t monotonic_ms()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
@@ -0,0 +1,42 @@
+// Hierarchical timer wheel for connection deadlines
+// Timers are intrusive list nodes hashed into slots by their deadline (4 levels of 64 one millisecond slots, about 4.6 hours),
+// so scheduling, cancelling and rescheduling are O(1) pointer updates with no syscall and no allocation
+// The caller reads the clock once per event loop iteration and advances the wheel to collect expired timers
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <cstdint> // Millisecond timestamps
+
+#define WHEEL_LEVELS 4    // Number of wheels, each level's slot covers a whole revolution of the level below
+#define WHEEL_SLOT_BITS 6 // log2(slots per level)
+#define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS)
+
+// One timer, embedded in the object it belongs to
+struct timer_node
+{
+    timer_node *next = nullptr; // Slot list links (next also links the list returned by advance())
+    timer_node *prev = nullptr; // nullptr while the timer is not scheduled
+    uint64_t expires = 0;       // Absolute deadline in milliseconds
+    void *owner = nullptr;      // Object the timer belongs to (connection etc.)
+};
+
+struct timer_wheel
+{
+    uint64_t current;                            // Next millisecond tick to process, every earlier deadline already fired
+    long count = 0;                              // Timers currently scheduled
+    timer_node slots[WHEEL_LEVELS][WHEEL_SLOTS]; // Circular list heads (sentinels)
+
+    timer_wheel(uint64_t now_ms);
+    void schedule(timer_node &timer, uint64_t expires_ms); // (Re)schedule a timer, a deadline in the past fires on the next advance()
+    void cancel(timer_node &timer);                        // Unschedule a timer (no-op if it isn't scheduled)
+    timer_node *advance(uint64_t now_ms);                  // Fire every timer due by now_ms, returns them as a list linked by next
+    int next_timeout(uint64_t now_ms) const;               // Milliseconds the caller may sleep before calling advance() again, -1 if no timers
+
+private:
+    void place(timer_node &timer); // Link a timer into the slot matching its deadline
+    void cascade(int level);       // Move the current slot of a level down to the levels below
+};
+
+uint64_t monotonic_ms(); // Milliseconds from CLOCK_MONOTONIC (vDSO, no real syscall)
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,121 @@
+#include "udp_stats.h" // Receive timestamps and drop counts
+
+#include <cstdio>    // Summaries (snprintf)
+#include <cstring>   // Control message payloads (memcpy)
+#include <ctime>     // Receive time (clock_gettime)
+#include <algorithm> // min
+
+// Drops are counted between consecutive datagrams, so a burst that overflowed the queue shows up on the first datagram read after it
+// Return the datagrams dropped since the previous datagram
+uint32_t udp_stats::add(const rx_sample &sample)
+{
+    datagrams++;
+    if (sample.stamped)
+    {
+        queue.add(sample.queue_us);
+    }
+    else
+    {
+        unstamped++;
+    }
+
+    uint32_t new_drops = 0;
+    if (counter_seen)
+    {
+        new_drops = sample.drops - last_drops; // Unsigned, survives the counter wrapping
+        dropped += new_drops;
+    }
+    last_drops = sample.drops;
+    counter_seen = true;
+    return new_drops;
+}
+
+// Example: 1000 datagrams, 0 unstamped, 0 dropped | queue us p50 7 p99 63 max 1022 | process us p50 31 p99 127 max 255 | send us p50 7 p99 15 max 31
+string udp_stats::summary() const
+{
+    char line[384];
+    int length = snprintf(line, sizeof(line),
+                          "%llu datagrams, %llu unstamped, %llu dropped | queue us p50 %llu p99 %llu max %llu | "
+                          "process us p50 %llu p99 %llu max %llu | send us p50 %llu p99 %llu max %llu",
+                          (unsigned long long)datagrams, (unsigned long long)unstamped, (unsigned long long)dropped,
+                          (unsigned long long)queue.percentile(50), (unsigned long long)queue.percentile(99), (unsigned long long)queue.max,
+                          (unsigned long long)process.percentile(50), (unsigned long long)process.percentile(99), (unsigned long long)process.max,
+                          (unsigned long long)send.percentile(50), (unsigned long long)send.percentile(99), (unsigned long long)send.max);
+    return string(line, length < 0 ? 0 : min((size_t)length, sizeof(line) - 1));
+}
+
+// SO_TIMESTAMPNS stamps in software when the datagram reaches the socket (no NIC support needed), in CLOCK_REALTIME
+// Documentation on SO_TIMESTAMPNS and SO_RXQ_OVFL - https://man7.org/linux/man-pages/man7/socket.7.html
+// Return 0 on success, -1 on fail
+int set_rx_stats(int socket, bool enabled)
+{
+    const int value = enabled ? 1 : 0;
+    if (setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPNS, &value, sizeof(value)) == -1 ||
+        setsockopt(socket, SOL_SOCKET, SO_RXQ_OVFL, &value, sizeof(value)) == -1)
+    {
+        log("ERROR", "Failed to set receive timestamps", strerror(errno));
+        return -1; // Fail
+    }
+    return 0; // Success
+}
+
+// The kernel doubles the request for its bookkeeping and caps it at net.core.rmem_max, so the size in effect is logged
+// Return 0 on success, -1 on fail
+int set_receive_buffer(int socket, int bytes)
+{
+    if (bytes > 0 && setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes)) == -1)
+    {
+        log("ERROR", "Failed to set SO_RCVBUF", strerror(errno));
+        return -1; // Fail
+    }
+    int size = 0;
+    socklen_t length = sizeof(size);
+    getsockopt(socket, SOL_SOCKET, SO_RCVBUF, &size, &length);
+    log("INFO", "Receive buffer", to_string(size) + " bytes" + (bytes > 0 ? " (requested " + to_string(bytes) + ")" : " (kernel default)"));
+    return 0; // Success
+}
+
+// Same as recvfrom() plus the control messages, which are only present while set_rx_stats() is on
+// Documentation on recvmsg and cmsg - https://man7.org/linux/man-pages/man3/cmsg.3.html
+// Return number of bytes received, -1 on fail
+ssize_t receive_datagram(int socket, char *buffer, size_t capacity, sockaddr_in &address, rx_sample &sample)
+{
+    iovec data{buffer, capacity};
+    alignas(cmsghdr) char control[RX_CONTROL_SIZE];
+    msghdr message{};
+    message.msg_name = &address;
+    message.msg_namelen = sizeof(address);
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t bytes = recvmsg(socket, &message, 0);
+    if (bytes == -1)
+    {
+        return -1; // Fail
+    }
+
+    sample = rx_sample{};
+    for (cmsghdr *header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header))
+    {
+        if (header->cmsg_level != SOL_SOCKET)
+        {
+            continue;
+        }
+        if (header->cmsg_type == SO_TIMESTAMPNS)
+        {
+            timespec stamp, now;
+            memcpy(&stamp, CMSG_DATA(header), sizeof(stamp));
+            clock_gettime(CLOCK_REALTIME, &now); // Same clock as the stamp
+            const int64_t waited_ns = (int64_t)(now.tv_sec - stamp.tv_sec) * 1000000000 + (now.tv_nsec - stamp.tv_nsec);
+            sample.queue_us = waited_ns > 0 ? (uint64_t)waited_ns / 1000 : 0; // A clock step backwards reads as no wait
+            sample.stamped = true;
+        }
+        else if (header->cmsg_type == SO_RXQ_OVFL)
+        {
+            memcpy(&sample.drops, CMSG_DATA(header), sizeof(sample.drops));
+        }
+    }
+    return bytes; // Success
+}
@@ -0,0 +1,40 @@
+// Receive path timing of UDPServer (--rx-stats)
+// - The kernel stamps every datagram as it is queued on the socket (SO_TIMESTAMPNS) and recvmsg() hands the stamp over
+//   as a control message, so the time a datagram waited in the receive queue is measured apart from our handler and from sendto()
+// - SO_RXQ_OVFL adds the socket's drop counter (datagrams discarded because the receive buffer was full) to the same control data,
+//   a growing counter means SO_RCVBUF (--rcvbuf) is too small for the bursts or the server can't keep up with them
+#ifndef UDP_STATS_H
+#define UDP_STATS_H
+#include "server_utils.h"         // Server specific headers
+#include "../network/tcp_stats.h" // log2 histograms
+
+#define UDP_STATS_INTERVAL 1000 // Datagrams between summaries (with --rx-stats)
+#define RX_CONTROL_SIZE 64      // recvmsg() control buffer, fits a timespec and the drop counter
+
+// Kernel side of one received datagram
+struct rx_sample
+{
+    bool stamped = false;  // SO_TIMESTAMPNS control message present
+    uint64_t queue_us = 0; // Kernel receive timestamp to recvmsg() returning
+    uint32_t drops = 0;    // Socket drop counter when the datagram was queued (cumulative, the kernel leaves it out while 0)
+};
+
+// Aggregate of every datagram read by the server
+struct udp_stats
+{
+    log2_histogram queue, process, send; // Microseconds: waiting in the socket queue, recvmsg() to response built, sendto()
+    uint64_t datagrams = 0;              // Datagrams read
+    uint64_t unstamped = 0;              // Datagrams without a kernel timestamp
+    uint64_t dropped = 0;                // Datagrams dropped by the kernel since the first datagram read
+    uint32_t last_drops = 0;             // Counter of the previous datagram
+    bool counter_seen = false;           // last_drops is valid (a handed off socket starts with the old process's drops)
+
+    uint32_t add(const rx_sample &sample); // Add one datagram's queueing delay, returns the drops since the previous datagram
+    string summary() const;                // One line with percentiles of every histogram and the drop count
+};
+
+int set_rx_stats(int socket, bool enabled);                                                                 // Turn timestamps and drop counts on or off (a handed off socket keeps them), -1 on fail
+int set_receive_buffer(int socket, int bytes);                                                              // SO_RCVBUF unless bytes is 0, logs the size in effect, -1 on fail
+ssize_t receive_datagram(int socket, char *buffer, size_t capacity, sockaddr_in &address, rx_sample &sample); // recvmsg() with the control data parsed into sample
+
+#endif // UDP_STATS_H
@@ -0,0 +1,219 @@
+#include "work_pool.h"     // Compute pool
+#include "alloc_counter.h" // Allocation counting test hook
+
+#include <sys/eventfd.h> // Completion wakeups (eventfd)
+#include <fcntl.h>       // EFD flags
+#include <sched.h>       // Yield while another thread finishes a push (sched_yield)
+
+static_assert((WORK_QUEUE_CAPACITY & (WORK_QUEUE_CAPACITY - 1)) == 0, "WORK_QUEUE_CAPACITY must be a power of 2");
+
+mpmc_queue::mpmc_queue()
+{
+    for (size_t i = 0; i < WORK_QUEUE_CAPACITY; i++)
+    {
+        cells[i].sequence.store(i, memory_order_relaxed);
+        cells[i].item = nullptr;
+    }
+}
+
+// Claim the cell at push_position once its sequence says the previous lap's item was popped
+bool mpmc_queue::push(work_item *item)
+{
+    size_t position = push_position.load(memory_order_relaxed);
+    while (true)
+    {
+        cell &slot = cells[position & (WORK_QUEUE_CAPACITY - 1)];
+        const size_t sequence = slot.sequence.load(memory_order_acquire);
+        const intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if (difference == 0)
+        {
+            if (push_position.compare_exchange_weak(position, position + 1, memory_order_relaxed))
+            {
+                slot.item = item;
+                slot.sequence.store(position + 1, memory_order_release); // Publishes the item to pop()
+                return true;
+            }
+            // Another producer took the cell, position was reloaded by the failed CAS
+        }
+        else if (difference < 0)
+        {
+            return false; // Full: the cell still holds the item pushed one lap ago
+        }
+        else
+        {
+            position = push_position.load(memory_order_relaxed); // Another producer moved on, catch up
+        }
+    }
+}
+
+// Claim the cell at pop_position once its sequence says it holds an item
+work_item *mpmc_queue::pop()
+{
+    size_t position = pop_position.load(memory_order_relaxed);
+    while (true)
+    {
+        cell &slot = cells[position & (WORK_QUEUE_CAPACITY - 1)];
+        const size_t sequence = slot.sequence.load(memory_order_acquire);
+        const intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+        if (difference == 0)
+        {
+            if (pop_position.compare_exchange_weak(position, position + 1, memory_order_relaxed))
+            {
+                work_item *item = slot.item;
+                slot.sequence.store(position + WORK_QUEUE_CAPACITY, memory_order_release); // Free for the push one lap later
+                return item;
+            }
+        }
+        else if (difference < 0)
+        {
+            return nullptr; // Empty (or the push at this position hasn't finished yet)
+        }
+        else
+        {
+            position = pop_position.load(memory_order_relaxed);
+        }
+    }
+}
+
+// Documentation on eventfd - https://man7.org/linux/man-pages/man2/eventfd.2.html
+// Return 0 on success, -1 on fail
+int completion_port::open()
+{
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd == -1)
+    {
+        log("ERROR", "eventfd() failed", strerror(errno));
+        return -1; // Fail
+    }
+    return 0; // Success
+}
+
+// The port holds every connection of its I/O thread, so the push can't fail
+void completion_port::post(work_item *item)
+{
+    queue.push(item);
+    wake();
+}
+
+// Only the first post after the I/O thread drained writes the eventfd, the rest ride on the same wakeup
+void completion_port::wake()
+{
+    if (!signalled.exchange(true, memory_order_acq_rel))
+    {
+        const uint64_t one = 1;
+        ssize_t written = write(event_fd, &one, sizeof(one));
+        (void)written; // Only fails if the counter would overflow, the I/O thread is awake then anyway
+    }
+}
+
+// Reset the eventfd and the flag before popping, an item posted after this writes the eventfd again
+// The exchange reads the flag a worker set after its push, so every item pushed before it is visible to the pops that follow
+void completion_port::acknowledge()
+{
+    uint64_t count;
+    ssize_t bytes = read(event_fd, &count, sizeof(count));
+    (void)bytes; // EAGAIN if a wakeup was already consumed, nothing to do
+    signalled.exchange(false, memory_order_acq_rel);
+}
+
+// Return 0 on success, -1 on fail
+int work_pool::start(int worker_count, work_handler work)
+{
+    if (sem_init(&ready, 0, 0) == -1)
+    {
+        log("ERROR", "sem_init() failed", strerror(errno));
+        return -1; // Fail
+    }
+    handler = work;
+    queues = new mpmc_queue[worker_count]; // Once at startup, never on the request path
+    workers = worker_count;                // Set before the first thread starts (workers read it in take()), every queue exists already
+    try
+    {
+        for (int i = 0; i < worker_count; i++)
+        {
+            threads.emplace_back(&work_pool::run, this, i);
+        }
+    }
+    catch (const exception &e)
+    {
+        log("ERROR", "Failed to start worker thread", e.what());
+        stop();
+        return -1; // Fail
+    }
+    return 0; // Success
+}
+
+// Push to the next queue in round-robin order, trying the others if it is full
+// Return 0 when queued, -1 when every queue is full (the caller handles the request itself)
+int work_pool::submit(work_item *item, uint32_t &cursor)
+{
+    for (int attempt = 0; attempt < workers; attempt++)
+    {
+        if (queues[cursor++ % workers].push(item))
+        {
+            sem_post(&ready); // One token per item, a worker that takes a token is guaranteed an item somewhere
+            return 0;         // Success
+        }
+    }
+    return -1; // Fail
+}
+
+// Wake every worker so each sees stopping once the queues are empty
+void work_pool::stop()
+{
+    stopping = true;
+    for (int i = 0; i < workers; i++)
+    {
+        sem_post(&ready);
+    }
+    for (thread &worker : threads)
+    {
+        worker.join();
+    }
+    threads.clear();
+    delete[] queues;
+    queues = nullptr;
+    workers = 0;
+    sem_destroy(&ready);
+}
+
+work_item *work_pool::take(int index)
+{
+    work_item *item = queues[index].pop();
+    for (int offset = 1; item == nullptr && offset < workers; offset++)
+    {
+        item = queues[(index + offset) % workers].pop();
+        if (item != nullptr)
+        {
+            stolen.fetch_add(1, memory_order_relaxed);
+        }
+    }
+    return item;
+}
+
+// Sleep until an item is queued anywhere, run it and post it back to its I/O thread
+void work_pool::run(int index)
+{
+    while (true)
+    {
+        while (sem_wait(&ready) == -1 && errno == EINTR)
+        {
+        }
+        work_item *item = take(index);
+        while (item == nullptr)
+        {
+            if (stopping)
+            {
+                return;
+            }
+            // The token's item was taken by a worker holding a later token, ours is still being pushed or popped elsewhere
+            sched_yield();
+            item = take(index);
+        }
+
+        begin_request_allocations(); // Test hook, see alloc_counter.h
+        item->status = handler(*item);
+        end_request_allocations(item->message);
+        item->port->post(item);
+    }
+}
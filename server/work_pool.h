@@ -0,0 +1,85 @@
+// Compute pool that takes heavy requests (schedules, solver batches) off the I/O threads
+// - Every worker owns a bounded lock-free MPMC queue, I/O threads push to them round-robin and an idle worker
+//   steals from the other queues, so one long request never holds up the requests queued behind it
+// - A finished item is posted back to the completion port of the I/O thread that owns its connection,
+//   which wakes that thread's epoll through an eventfd and sends the response from there
+// - Nothing allocates or takes a lock per request: queue slots are claimed with one CAS and a sleeping worker
+//   is woken with sem_post() (a futex wake only when a worker is actually asleep)
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+#include "server_utils.h" // Server specific headers
+
+#include <atomic>      // Queue positions and sequences
+#include <thread>      // Worker threads
+#include <vector>      // Worker threads
+#include <semaphore.h> // Sleeping workers (sem_wait)
+
+#define WORK_QUEUE_CAPACITY 1024 // Items per queue (power of 2), a completion port holds every connection of its I/O thread
+#define CACHE_LINE_SIZE 64       // Queue positions written by different threads live on their own cache line
+
+struct completion_port;
+
+// One request handed to the pool, embedded in the connection it belongs to
+struct work_item
+{
+    string_view message;             // Request without terminator or ID prefix (view into arena's receive buffer)
+    request_arena *arena = nullptr;  // The response is written into this arena's transmit buffer
+    int status = 0;                  // Handler result: 0 response built, -1 invalid request (no response)
+    completion_port *port = nullptr; // I/O thread the item goes back to
+    void *owner = nullptr;           // Connection the item belongs to
+};
+
+typedef int (*work_handler)(work_item &item); // Builds the response for one item (runs on a worker thread)
+
+// Bounded multi-producer multi-consumer queue of work_item pointers (Dmitry Vyukov's array queue)
+// Every cell carries a sequence number that says whose turn it is, so a push or pop is one CAS on a position
+// plus a release store on the cell, and producers and consumers never touch the same cache line unless the queue is nearly empty/full
+// Documentation on the algorithm - https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+struct mpmc_queue
+{
+    struct cell
+    {
+        atomic<size_t> sequence; // == position: free for the push at position, == position + 1: holds the item pushed at position
+        work_item *item;         // Payload once pushed
+    };
+
+    alignas(CACHE_LINE_SIZE) cell cells[WORK_QUEUE_CAPACITY];
+    alignas(CACHE_LINE_SIZE) atomic<size_t> push_position{0}; // Next position to push to
+    alignas(CACHE_LINE_SIZE) atomic<size_t> pop_position{0};  // Next position to pop from
+
+    mpmc_queue();
+    bool push(work_item *item); // false if the queue is full
+    work_item *pop();           // nullptr if the queue is empty
+};
+
+// Where workers post finished items for one I/O thread
+struct completion_port
+{
+    mpmc_queue queue;              // Finished items (many workers push, the owning I/O thread pops)
+    int event_fd = -1;             // Readable while items wait, registered in the I/O thread's epoll
+    atomic<bool> signalled{false}; // eventfd already written and not drained yet, later posts skip the write() syscall
+
+    int open();                 // Create the eventfd, -1 on fail
+    void post(work_item *item); // Worker side: queue a finished item and wake the I/O thread
+    void wake();                // Wake the I/O thread without an item (hot restart drain)
+    void acknowledge();         // I/O thread side: call before draining the queue with queue.pop()
+};
+
+struct work_pool
+{
+    int workers = 0;                // Worker threads, 0 while the pool isn't started
+    work_handler handler = nullptr; // Runs every item
+    mpmc_queue *queues = nullptr;   // One queue per worker
+    sem_t ready;                    // Items pushed and not taken yet
+    atomic<bool> stopping{false};   // Workers exit once this is set and the queues are empty
+    atomic<uint64_t> stolen{0};     // Items run by a worker other than the one they were queued for
+    vector<thread> threads;         // Worker threads
+
+    int start(int worker_count, work_handler work); // Start the workers, -1 on fail
+    int submit(work_item *item, uint32_t &cursor);  // Queue an item (cursor spreads one I/O thread's items over the queues), -1 if every queue is full
+    void stop();                                    // Let the workers finish what is queued and join them
+    void run(int index);                            // Worker thread body
+    work_item *take(int index);                     // Own queue first, then steal from the others
+};
+
+#endif // WORK_POOL_H
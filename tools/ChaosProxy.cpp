@@ -0,0 +1,906 @@
+// Lossy-link proxy for trying client retry logic (and benchmarking it) without any special network setup
+// - Sits between a client and a server on both UDP and TCP, the client connects to the proxy port (<ip>:<port> on the clients)
+// - Every datagram (UDP) or chunk (TCP) goes through a simulated link: bandwidth cap, fixed delay and random jitter,
+//   then loss, duplication, reordering (held back so later packets overtake it) and truncation, each with its own probability
+// - TCP is a reliable ordered stream, so chunks keep their order (delay, jitter, bandwidth and truncation only),
+//   --loss resets a whole connection instead and duplication/reordering only apply to UDP
+// - Deterministic under --seed: every flow (UDP client or TCP connection) direction draws from its own generator seeded from
+//   --seed and the flow number, so the same traffic gets the same impairments no matter how other flows interleave
+// - Every flow is reported when it ends (TCP close, UDP idle): requests, client retransmits and NACKs, time to first response,
+//   time to complete, goodput and the impairments applied, optionally as CSV rows for offline comparison
+// Usage: ChaosProxy <listen_port> <server_ip>[:<port>] [--seed <n>] [--loss <p>] [--duplicate <p>] [--reorder <p>] [--truncate <p>]
+//                   [--delay <ms>] [--jitter <ms>] [--bandwidth <bytes/sec>] [--idle <ms>] [--csv <file>]
+#include "../network/network_utils.h" // Headers shared by client & server
+
+#include <sys/epoll.h> // Wait on both listening sockets and every flow at once (epoll)
+#include <fcntl.h>     // Non-blocking sockets (fcntl)
+#include <csignal>     // Print the summary on Ctrl-C (sigaction)
+#include <netdb.h>     // Resolve the server address (getaddrinfo)
+#include <vector>      // Flows, latencies
+#include <queue>       // Deliveries ordered by due time (priority_queue)
+#include <map>         // UDP client address -> flow
+#include <unordered_set> // Payload hashes seen per UDP flow (client retransmits)
+#include <algorithm>   // sort, max
+#include <cstdio>      // Report output (printf), CSV (fopen)
+#include <cmath>       // ceil
+
+const int MAX_EPOLL_EVENTS = 64;          // Events handled per epoll_wait() call
+const int DATAGRAM_BUFFER_SIZE = 65536;   // Largest UDP datagram
+const int TCP_CHUNK_SIZE = 16384;         // Bytes read per recv(), each chunk is one "packet" on the simulated link
+const int DEFAULT_IDLE_MS = 3000;         // A UDP flow without traffic for this long is reported and forgotten
+const double REORDER_HOLD_MS = 10;        // Extra delay of a reordered datagram (plus up to the jitter), later datagrams overtake it
+const double DUPLICATE_GAP_MS = 1;        // A duplicate arrives this long after the original (plus up to the jitter)
+const uint64_t TCP_LISTEN_TAG = UINT64_MAX;      // epoll tag of the TCP listening socket
+const uint64_t UDP_LISTEN_TAG = UINT64_MAX - 1;  // epoll tag of the UDP listening socket (flows use flow index << 1 | side)
+
+enum direction
+{
+    TO_SERVER = 0, // Client -> server
+    TO_CLIENT = 1  // Server -> client
+};
+
+enum side
+{
+    CLIENT_SIDE = 0, // Accepted TCP socket (UDP flows answer through the listening socket)
+    SERVER_SIDE = 1  // Socket connected to the server
+};
+
+// Link impairments from the command line
+struct chaos_settings
+{
+    uint64_t seed = 1;    // --seed
+    double loss = 0;      // --loss: UDP datagram dropped, TCP connection reset
+    double duplicate = 0; // --duplicate: UDP datagram delivered twice
+    double reorder = 0;   // --reorder: UDP datagram held back by REORDER_HOLD_MS
+    double truncate = 0;  // --truncate: datagram/chunk cut at a random length (TCP: the stream ends there)
+    double delay_ms = 0;  // --delay: one-way propagation delay
+    double jitter_ms = 0; // --jitter: uniform extra delay in [0, jitter]
+    double bandwidth = 0; // --bandwidth: bytes/sec per flow direction, 0 is unlimited
+    int idle_ms = DEFAULT_IDLE_MS; // --idle
+};
+
+// Small deterministic generator (splitmix64), one per flow direction
+// Documentation on splitmix64 - https://prng.di.unimi.it/splitmix64.c
+struct chaos_random
+{
+    uint64_t state = 0;
+
+    uint64_t next()
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); } // [0, 1)
+    bool chance(double p) { return p > 0 && uniform() < p; }
+};
+
+// What one flow did, reported when it ends
+struct flow_stats
+{
+    uint64_t start_ns = 0;          // First byte/datagram from the client
+    uint64_t first_response_ns = 0; // First byte/datagram delivered to the client, 0 if none
+    uint64_t last_response_ns = 0;  // Last byte/datagram delivered to the client
+    uint64_t requests = 0;          // UDP: datagrams from the client (NACK/FIN excluded), TCP: 1
+    uint64_t retransmits = 0;       // UDP: client datagrams identical to an earlier one
+    uint64_t nacks = 0;             // UDP: NACKs from the client
+    uint64_t bytes[2] = {};         // Bytes delivered per direction (duplicates excluded)
+    uint64_t dropped[2] = {};       // Datagrams dropped per direction (TCP: 1 for a reset connection)
+    uint64_t duplicated[2] = {};    // Datagrams delivered twice
+    uint64_t reordered[2] = {};     // Datagrams held back
+    uint64_t truncated[2] = {};     // Datagrams/chunks cut short
+};
+
+// One UDP client (address) or one TCP connection
+struct chaos_flow
+{
+    int number = 0;                 // Order of appearance, seeds the generators
+    bool tcp = false;               // Transport
+    bool done = false;              // Reported, sockets closed
+    sockaddr_in client{};           // Client address
+    int fd[2] = {-1, -1};           // CLIENT_SIDE (TCP only) and SERVER_SIDE sockets
+    bool connected = false;         // TCP: connection to the server established
+    bool read_closed[2] = {};       // TCP: peer on this side sent EOF (or the stream was cut)
+    bool eof_pending[2] = {};       // TCP: shut down writing towards the destination of direction once its outbox drains
+    bool eof_sent[2] = {};          // TCP: shutdown(SHUT_WR) done per direction
+    string outbox[2];               // TCP: bytes delivered by the link but not accepted by the socket yet, per direction
+    uint32_t interest[2] = {};      // epoll events registered per side
+    chaos_random random[2];         // Per direction
+    uint64_t link_free_ns[2] = {};  // When the simulated link of a direction finishes sending what it has (bandwidth cap)
+    uint64_t last_due_ns[2] = {};   // TCP: latest delivery scheduled per direction (chunks never overtake each other)
+    uint64_t last_activity_ns = 0;  // UDP idle detection
+    int pending = 0;                // Deliveries scheduled and not done
+    unordered_set<size_t> seen;     // UDP: hashes of client payloads (retransmit detection)
+    flow_stats stats;
+};
+
+// A datagram/chunk on the simulated link
+struct delivery
+{
+    uint64_t due_ns; // When it comes out of the link
+    uint64_t order;  // Tie breaker, keeps equal due times in scheduling order
+    int flow;        // Flow index
+    int dir;         // direction
+    bool eof;        // TCP: end of stream marker instead of data
+    string data;     // Payload
+};
+
+struct later_delivery
+{
+    bool operator()(const delivery &a, const delivery &b) const { return a.due_ns != b.due_ns ? a.due_ns > b.due_ns : a.order > b.order; }
+};
+
+struct chaos_state
+{
+    chaos_settings settings;
+    sockaddr_in server{};                                                         // Forward target
+    int epoll_fd = -1;                                                            // epoll instance
+    int tcp_listen = -1;                                                          // Accepts clients
+    int udp_listen = -1;                                                          // Receives from and answers UDP clients
+    vector<chaos_flow> flows;                                                     // Every flow so far (indexes are epoll tags)
+    map<uint64_t, int> udp_flow_of_client;                                        // Active UDP flow per client address << 16 | port
+    priority_queue<delivery, vector<delivery>, later_delivery> link;              // Datagrams/chunks in flight
+    uint64_t next_order = 0;                                                      // delivery.order
+    FILE *csv = nullptr;                                                          // --csv
+    vector<double> complete_ms[2];                                                // Per transport (0 UDP, 1 TCP), flows that got a response
+    uint64_t flows_reported[2] = {};                                              // Per transport
+    uint64_t flows_failed[2] = {};                                                // Per transport, no response at all
+    uint64_t total_bytes_to_client[2] = {};                                       // Per transport
+    double total_seconds[2] = {};                                                 // Per transport, sum of flow durations (for mean goodput)
+};
+
+static volatile sig_atomic_t stop_requested = 0; // Set by SIGINT/SIGTERM
+
+static void request_stop(int)
+{
+    stop_requested = 1;
+}
+
+static uint64_t now_ns()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// "ip:port" for reports
+static string address_name(const sockaddr_in &address)
+{
+    char ip[INET_ADDRSTRLEN] = "?";
+    inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip));
+    return string(ip) + ":" + to_string(ntohs(address.sin_port));
+}
+
+static uint64_t ms_to_ns(double ms)
+{
+    return (uint64_t)(ms * 1000000);
+}
+
+// Seed a flow's generators from --seed, the flow number and the direction (splitmix64 spreads nearby seeds apart)
+static void seed_flow(chaos_flow &flow, uint64_t seed)
+{
+    for (int dir = 0; dir < 2; dir++)
+    {
+        chaos_random mixer;
+        mixer.state = seed ^ ((uint64_t)flow.number << 1 | dir) * 0xD6E8FEB86659FD93ULL;
+        flow.random[dir].state = mixer.next();
+    }
+}
+
+// (Re)register the events a side of a flow waits for
+static void update_interest(chaos_state &state, int index, int which)
+{
+    chaos_flow &flow = state.flows[index];
+    if (flow.fd[which] == -1)
+    {
+        return;
+    }
+    uint32_t events = 0;
+    const int sink_dir = which == CLIENT_SIDE ? TO_CLIENT : TO_SERVER; // Data written on this side arrived this way
+    if (!flow.tcp || !flow.read_closed[which])
+    {
+        events |= EPOLLIN;
+    }
+    if (flow.tcp && ((which == SERVER_SIDE && !flow.connected) || !flow.outbox[sink_dir].empty()))
+    {
+        events |= EPOLLOUT;
+    }
+    if (events == flow.interest[which])
+    {
+        return;
+    }
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = (uint64_t)index << 1 | which;
+    epoll_ctl(state.epoll_fd, flow.interest[which] == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, flow.fd[which], &event);
+    if (events == 0)
+    {
+        epoll_ctl(state.epoll_fd, EPOLL_CTL_DEL, flow.fd[which], nullptr);
+    }
+    flow.interest[which] = events;
+}
+
+// Put a datagram/chunk on the simulated link of a direction: serialization at --bandwidth, then delay and jitter,
+// then the random impairments (UDP: loss, reordering, duplication, truncation; TCP: truncation)
+static void send_through_link(chaos_state &state, int index, int dir, string data, uint64_t now)
+{
+    chaos_flow &flow = state.flows[index];
+    chaos_random &random = flow.random[dir];
+    const chaos_settings &settings = state.settings;
+
+    // Every draw happens for every packet, so one impairment's probability never shifts the others' sequence
+    const bool lost = random.chance(settings.loss);
+    const bool held_back = random.chance(settings.reorder);
+    const bool doubled = random.chance(settings.duplicate);
+    const bool cut = random.chance(settings.truncate);
+    const double jitter = random.uniform() * settings.jitter_ms;
+    const double duplicate_jitter = random.uniform() * settings.jitter_ms;
+    const size_t cut_length = data.empty() ? 0 : (size_t)(random.uniform() * data.size());
+
+    if (cut && !data.empty())
+    {
+        data.resize(cut_length);
+        flow.stats.truncated[dir]++;
+    }
+
+    // Bandwidth: the link sends one packet after another, a burst queues behind itself
+    uint64_t sent = max(now, flow.link_free_ns[dir]);
+    if (settings.bandwidth > 0)
+    {
+        sent += (uint64_t)(data.size() * 1e9 / settings.bandwidth);
+    }
+    flow.link_free_ns[dir] = sent;
+    uint64_t due = sent + ms_to_ns(settings.delay_ms + jitter);
+
+    if (flow.tcp)
+    {
+        // A stream keeps its order, a cut chunk ends the stream in this direction
+        due = max(due, flow.last_due_ns[dir]);
+        flow.last_due_ns[dir] = due;
+        state.link.push(delivery{due, state.next_order++, index, dir, false, move(data)});
+        flow.pending++;
+        if (cut)
+        {
+            flow.read_closed[dir == TO_SERVER ? CLIENT_SIDE : SERVER_SIDE] = true; // Stop reading the rest
+            state.link.push(delivery{due, state.next_order++, index, dir, true, string()});
+            flow.pending++;
+            update_interest(state, index, dir == TO_SERVER ? CLIENT_SIDE : SERVER_SIDE);
+        }
+        return;
+    }
+
+    if (lost)
+    {
+        flow.stats.dropped[dir]++;
+        return;
+    }
+    if (held_back)
+    {
+        due += ms_to_ns(REORDER_HOLD_MS + jitter);
+        flow.stats.reordered[dir]++;
+    }
+    if (doubled)
+    {
+        state.link.push(delivery{due + ms_to_ns(DUPLICATE_GAP_MS + duplicate_jitter), state.next_order++, index, dir, false, data});
+        flow.pending++;
+        flow.stats.duplicated[dir]++;
+    }
+    state.link.push(delivery{due, state.next_order++, index, dir, false, move(data)});
+    flow.pending++;
+}
+
+// Write as much of a direction's outbox as the socket takes, then shut down writing if the stream ended
+static void flush_outbox(chaos_state &state, int index, int dir)
+{
+    chaos_flow &flow = state.flows[index];
+    const int which = dir == TO_SERVER ? SERVER_SIDE : CLIENT_SIDE;
+    if (flow.fd[which] == -1 || (which == SERVER_SIDE && !flow.connected))
+    {
+        return;
+    }
+    string &outbox = flow.outbox[dir];
+    while (!outbox.empty())
+    {
+        ssize_t sent = send(flow.fd[which], outbox.data(), outbox.size(), MSG_NOSIGNAL);
+        if (sent > 0)
+        {
+            outbox.erase(0, sent);
+            continue;
+        }
+        if (sent == -1 && errno == EINTR)
+            continue;
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        outbox.clear(); // Peer gone, the rest is lost
+        flow.eof_pending[dir] = true;
+        break;
+    }
+    if (outbox.empty() && flow.eof_pending[dir] && !flow.eof_sent[dir])
+    {
+        shutdown(flow.fd[which], SHUT_WR);
+        flow.eof_sent[dir] = true;
+    }
+    update_interest(state, index, which);
+}
+
+// Log one flow (and append its CSV row), close its sockets and add it to the totals
+static void finish_flow(chaos_state &state, int index, const char *outcome)
+{
+    chaos_flow &flow = state.flows[index];
+    if (flow.done)
+    {
+        return;
+    }
+    flow.done = true;
+    for (int which = 0; which < 2; which++)
+    {
+        if (flow.fd[which] != -1)
+        {
+            close(flow.fd[which]); // Also removes it from epoll
+            flow.fd[which] = -1;
+        }
+    }
+    if (!flow.tcp)
+    {
+        state.udp_flow_of_client.erase(((uint64_t)flow.client.sin_addr.s_addr << 16) | flow.client.sin_port);
+    }
+
+    const flow_stats &stats = flow.stats;
+    const int transport = flow.tcp ? 1 : 0;
+    const bool answered = stats.first_response_ns != 0;
+    const double first_ms = answered ? (stats.first_response_ns - stats.start_ns) / 1e6 : -1;
+    const double complete_ms = answered ? (stats.last_response_ns - stats.start_ns) / 1e6 : -1;
+    const double goodput = answered && complete_ms > 0 ? stats.bytes[TO_CLIENT] / (complete_ms / 1000) : 0;
+    state.flows_reported[transport]++;
+    if (answered)
+    {
+        state.complete_ms[transport].push_back(complete_ms);
+        state.total_bytes_to_client[transport] += stats.bytes[TO_CLIENT];
+        state.total_seconds[transport] += complete_ms / 1000;
+    }
+    else
+    {
+        state.flows_failed[transport]++;
+    }
+
+    const string client = address_name(flow.client);
+    char line[512];
+    snprintf(line, sizeof(line),
+             "%s %s, %llu request(s), %llu retransmit(s), %llu NACK(s) | first response %.3f ms, complete %.3f ms, goodput %.0f B/s | "
+             "to server: %llu B, %llu dropped, %llu duplicated, %llu reordered, %llu truncated | to client: %llu B, %llu dropped, %llu duplicated, %llu reordered, %llu truncated",
+             flow.tcp ? "TCP" : "UDP", client.c_str(), (unsigned long long)stats.requests, (unsigned long long)stats.retransmits, (unsigned long long)stats.nacks,
+             first_ms, complete_ms, goodput,
+             (unsigned long long)stats.bytes[TO_SERVER], (unsigned long long)stats.dropped[TO_SERVER], (unsigned long long)stats.duplicated[TO_SERVER],
+             (unsigned long long)stats.reordered[TO_SERVER], (unsigned long long)stats.truncated[TO_SERVER],
+             (unsigned long long)stats.bytes[TO_CLIENT], (unsigned long long)stats.dropped[TO_CLIENT], (unsigned long long)stats.duplicated[TO_CLIENT],
+             (unsigned long long)stats.reordered[TO_CLIENT], (unsigned long long)stats.truncated[TO_CLIENT]);
+    log(answered ? "INFO" : "WARNING", "Flow " + to_string(flow.number) + " " + outcome, line);
+
+    if (state.csv != nullptr)
+    {
+        fprintf(state.csv, "%d,%s,%s,%s,%llu,%llu,%llu,%.3f,%.3f,%.0f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+                flow.number, flow.tcp ? "tcp" : "udp", client.c_str(), outcome,
+                (unsigned long long)stats.requests, (unsigned long long)stats.retransmits, (unsigned long long)stats.nacks, first_ms, complete_ms, goodput,
+                (unsigned long long)stats.bytes[TO_SERVER], (unsigned long long)stats.bytes[TO_CLIENT],
+                (unsigned long long)stats.dropped[TO_SERVER], (unsigned long long)stats.dropped[TO_CLIENT],
+                (unsigned long long)stats.duplicated[TO_SERVER], (unsigned long long)stats.duplicated[TO_CLIENT],
+                (unsigned long long)stats.reordered[TO_SERVER], (unsigned long long)stats.reordered[TO_CLIENT],
+                (unsigned long long)stats.truncated[TO_SERVER], (unsigned long long)stats.truncated[TO_CLIENT]);
+        fflush(state.csv);
+    }
+
+    // The flow entry stays (its index may still be in the link queue), its buffers go
+    flow.seen = unordered_set<size_t>();
+    flow.outbox[TO_SERVER] = string();
+    flow.outbox[TO_CLIENT] = string();
+}
+
+// A TCP flow ends once both directions delivered their end of stream
+static void check_tcp_done(chaos_state &state, int index)
+{
+    chaos_flow &flow = state.flows[index];
+    if (!flow.done && flow.eof_sent[TO_SERVER] && flow.eof_sent[TO_CLIENT] && flow.pending == 0)
+    {
+        finish_flow(state, index, "closed");
+    }
+}
+
+static int new_flow(chaos_state &state, bool tcp, const sockaddr_in &client, uint64_t now)
+{
+    chaos_flow flow;
+    flow.number = (int)state.flows.size() + 1;
+    flow.tcp = tcp;
+    flow.client = client;
+    flow.stats.start_ns = now;
+    flow.last_activity_ns = now;
+    seed_flow(flow, state.settings.seed);
+    state.flows.push_back(move(flow));
+    return (int)state.flows.size() - 1;
+}
+
+// Accept every pending TCP client and start connecting to the server for it
+static void accept_tcp(chaos_state &state, uint64_t now)
+{
+    while (true)
+    {
+        sockaddr_in client{};
+        socklen_t length = sizeof(client);
+        int c_socket = accept4(state.tcp_listen, (sockaddr *)&client, &length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (c_socket == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                log("ERROR", "Accept failed", strerror(errno));
+            return;
+        }
+        const int index = new_flow(state, true, client, now);
+        chaos_flow &flow = state.flows[index];
+        flow.fd[CLIENT_SIDE] = c_socket;
+        flow.stats.requests = 1;
+
+        // TCP can't lose a segment from user space, a lost connection is reset instead (the client sees ECONNRESET)
+        if (flow.random[TO_SERVER].chance(state.settings.loss))
+        {
+            linger reset = {1, 0}; // Documentation on SO_LINGER - https://man7.org/linux/man-pages/man7/socket.7.html
+            setsockopt(c_socket, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+            flow.stats.dropped[TO_SERVER] = 1;
+            finish_flow(state, index, "reset");
+            continue;
+        }
+
+        flow.fd[SERVER_SIDE] = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (flow.fd[SERVER_SIDE] == -1 ||
+            (connect(flow.fd[SERVER_SIDE], (sockaddr *)&state.server, sizeof(state.server)) == -1 && errno != EINPROGRESS))
+        {
+            log("ERROR", "Connect to server failed", strerror(errno));
+            finish_flow(state, index, "server unreachable");
+            continue;
+        }
+        update_interest(state, index, CLIENT_SIDE);
+        update_interest(state, index, SERVER_SIDE);
+    }
+}
+
+// Read every available chunk on one side of a TCP flow and put it on the link
+static void read_tcp(chaos_state &state, int index, int which, char *buffer, uint64_t now)
+{
+    const int dir = which == CLIENT_SIDE ? TO_SERVER : TO_CLIENT;
+    while (!state.flows[index].read_closed[which])
+    {
+        chaos_flow &flow = state.flows[index];
+        ssize_t received = recv(flow.fd[which], buffer, TCP_CHUNK_SIZE, 0);
+        if (received > 0)
+        {
+            send_through_link(state, index, dir, string(buffer, received), now);
+            continue;
+        }
+        if (received == -1 && errno == EINTR)
+            continue;
+        if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        // EOF (or an error): the end of the stream travels the link behind the data
+        flow.read_closed[which] = true;
+        state.link.push(delivery{max(now, flow.last_due_ns[dir]), state.next_order++, index, dir, true, string()});
+        flow.pending++;
+    }
+    update_interest(state, index, which);
+}
+
+// The server side finished connecting (or failed to)
+static void handle_tcp_connect(chaos_state &state, int index)
+{
+    chaos_flow &flow = state.flows[index];
+    int error = 0;
+    socklen_t length = sizeof(error);
+    getsockopt(flow.fd[SERVER_SIDE], SOL_SOCKET, SO_ERROR, &error, &length);
+    if (error != 0)
+    {
+        log("ERROR", "Connect to server failed", strerror(error));
+        finish_flow(state, index, "server unreachable");
+        return;
+    }
+    flow.connected = true;
+    flush_outbox(state, index, TO_SERVER);
+}
+
+// Datagram from a client on the UDP listening socket: find (or start) its flow and put the datagram on the link
+static void receive_udp_client(chaos_state &state, char *buffer, uint64_t now)
+{
+    while (true)
+    {
+        sockaddr_in client{};
+        socklen_t length = sizeof(client);
+        ssize_t received = recvfrom(state.udp_listen, buffer, DATAGRAM_BUFFER_SIZE, 0, (sockaddr *)&client, &length);
+        if (received < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        const uint64_t key = ((uint64_t)client.sin_addr.s_addr << 16) | client.sin_port;
+        auto found = state.udp_flow_of_client.find(key);
+        int index;
+        if (found == state.udp_flow_of_client.end())
+        {
+            index = new_flow(state, false, client, now);
+            chaos_flow &flow = state.flows[index];
+            flow.fd[SERVER_SIDE] = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (flow.fd[SERVER_SIDE] == -1 || connect(flow.fd[SERVER_SIDE], (sockaddr *)&state.server, sizeof(state.server)) == -1)
+            {
+                log("ERROR", "UDP socket creation failed", strerror(errno));
+                finish_flow(state, index, "server unreachable");
+                continue;
+            }
+            state.udp_flow_of_client[key] = index;
+            update_interest(state, index, SERVER_SIDE);
+        }
+        else
+        {
+            index = found->second;
+        }
+
+        chaos_flow &flow = state.flows[index];
+        flow.last_activity_ns = now;
+        const string_view datagram(buffer, received);
+        if (is_command(datagram, NACK_COMMAND))
+        {
+            flow.stats.nacks++;
+        }
+        else if (!is_command(datagram, FIN_COMMAND))
+        {
+            flow.stats.requests++;
+            if (!flow.seen.insert(hash<string_view>{}(datagram)).second)
+            {
+                flow.stats.retransmits++; // Same bytes again: the client's retry
+            }
+        }
+        send_through_link(state, index, TO_SERVER, string(datagram), now);
+    }
+}
+
+// Datagrams from the server for one UDP flow
+static void receive_udp_server(chaos_state &state, int index, char *buffer, uint64_t now)
+{
+    while (true)
+    {
+        ssize_t received = recv(state.flows[index].fd[SERVER_SIDE], buffer, DATAGRAM_BUFFER_SIZE, 0);
+        if (received < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        state.flows[index].last_activity_ns = now;
+        send_through_link(state, index, TO_CLIENT, string(buffer, received), now);
+    }
+}
+
+// Hand every datagram/chunk that came out of the link to its destination
+static void deliver_due(chaos_state &state, uint64_t now)
+{
+    while (!state.link.empty() && state.link.top().due_ns <= now)
+    {
+        delivery item = state.link.top(); // Copy out before pop (priority_queue::top is const)
+        state.link.pop();
+        chaos_flow &flow = state.flows[item.flow];
+        flow.pending--;
+        if (flow.done)
+        {
+            continue;
+        }
+
+        if (item.dir == TO_CLIENT && !item.eof)
+        {
+            flow.stats.first_response_ns = flow.stats.first_response_ns == 0 ? now : flow.stats.first_response_ns;
+            flow.stats.last_response_ns = now;
+        }
+        if (!item.eof)
+        {
+            flow.stats.bytes[item.dir] += item.data.size();
+        }
+
+        if (!flow.tcp)
+        {
+            flow.last_activity_ns = now;
+            if (item.dir == TO_SERVER)
+                send(flow.fd[SERVER_SIDE], item.data.data(), item.data.size(), 0);
+            else
+                sendto(state.udp_listen, item.data.data(), item.data.size(), 0, (sockaddr *)&flow.client, sizeof(flow.client));
+            continue;
+        }
+
+        if (item.eof)
+        {
+            flow.eof_pending[item.dir] = true;
+        }
+        else
+        {
+            flow.outbox[item.dir] += item.data;
+        }
+        flush_outbox(state, item.flow, item.dir);
+        check_tcp_done(state, item.flow);
+    }
+}
+
+// Report UDP flows that went quiet, their client is done (or gave up)
+static void expire_udp_flows(chaos_state &state, uint64_t now)
+{
+    vector<int> idle;
+    for (const auto &entry : state.udp_flow_of_client)
+    {
+        const chaos_flow &flow = state.flows[entry.second];
+        if (flow.pending == 0 && now - flow.last_activity_ns >= ms_to_ns(state.settings.idle_ms))
+        {
+            idle.push_back(entry.second);
+        }
+    }
+    for (int index : idle)
+    {
+        finish_flow(state, index, "idle");
+    }
+}
+
+// Value at percentile p of sorted values (nearest rank)
+static double percentile(const vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t rank = (size_t)ceil(p / 100 * sorted.size());
+    return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+static void print_summary(chaos_state &state)
+{
+    printf("\n%-4s %7s %7s %11s %11s %11s %11s %13s\n", "", "flows", "failed", "p50 ms", "p90 ms", "p99 ms", "max ms", "goodput B/s");
+    const char *names[2] = {"UDP", "TCP"};
+    for (int transport = 0; transport < 2; transport++)
+    {
+        vector<double> &latencies = state.complete_ms[transport];
+        if (state.flows_reported[transport] == 0)
+            continue;
+        sort(latencies.begin(), latencies.end());
+        printf("%-4s %7llu %7llu %11.3f %11.3f %11.3f %11.3f %13.0f\n", names[transport], (unsigned long long)state.flows_reported[transport],
+               (unsigned long long)state.flows_failed[transport], percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99),
+               latencies.empty() ? 0 : latencies.back(),
+               state.total_seconds[transport] > 0 ? state.total_bytes_to_client[transport] / state.total_seconds[transport] : 0);
+    }
+}
+
+// Resolve <server_ip>[:<port>]
+// Return 0 on success, -1 on fail
+static int parse_server(const string &text, sockaddr_in &server)
+{
+    const size_t colon = text.rfind(':');
+    const string host = colon == string::npos ? text : text.substr(0, colon);
+    const int port = colon == string::npos ? SERVER_PORT : atoi(text.c_str() + colon + 1);
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    addrinfo *result;
+    if (port < 1 || port > 65535 || getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0)
+    {
+        return -1; // Fail
+    }
+    server = *(sockaddr_in *)result->ai_addr;
+    server.sin_port = htons(port);
+    freeaddrinfo(result);
+    return 0; // Success
+}
+
+// Bind a non-blocking socket of type to the listening port on every interface
+// Return socket on success, -1 on fail
+static int listen_on(int type, int port)
+{
+    int fd = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return -1; // Fail
+    }
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = INADDR_ANY;
+    if (bind(fd, (sockaddr *)&address, sizeof(address)) == -1 || (type == SOCK_STREAM && listen(fd, 128) == -1))
+    {
+        close(fd);
+        return -1; // Fail
+    }
+    return fd; // Success
+}
+
+int main(int argc, char *argv[])
+{
+    const string USAGE = "Usage: " + string(argc > 0 ? argv[0] : "ChaosProxy") + " <listen_port> <server_ip>[:<port>] [--seed <n>] [--loss <p>] [--duplicate <p>] [--reorder <p>] [--truncate <p>] [--delay <ms>] [--jitter <ms>] [--bandwidth <bytes/sec>] [--idle <ms>] [--csv <file>]";
+    chaos_state state;
+    chaos_settings &settings = state.settings;
+    const int listen_port = argc > 1 ? atoi(argv[1]) : 0;
+    if (argc < 3 || listen_port < 1 || listen_port > 65535 || parse_server(argv[2], state.server) != 0)
+    {
+        log("ERROR", "Invalid arguments", USAGE);
+        return 1; // Exit program
+    }
+    string csv_path;
+    for (int i = 3; i < argc; i++)
+    {
+        const string flag = argv[i];
+        if (i + 1 >= argc)
+        {
+            log("ERROR", "Missing value for " + flag, USAGE);
+            return 1; // Exit program
+        }
+        const string value_text = argv[++i];
+        if (flag == "--csv")
+        {
+            csv_path = value_text;
+            continue;
+        }
+        char *end;
+        const double value = strtod(value_text.c_str(), &end);
+        const bool probability = flag == "--loss" || flag == "--duplicate" || flag == "--reorder" || flag == "--truncate";
+        if (*end != '\0' || value < 0 || (probability && value > 1))
+        {
+            log("ERROR", "Invalid value for " + flag, value_text);
+            return 1; // Exit program
+        }
+        if (flag == "--seed")
+            settings.seed = strtoull(value_text.c_str(), nullptr, 10);
+        else if (flag == "--loss")
+            settings.loss = value;
+        else if (flag == "--duplicate")
+            settings.duplicate = value;
+        else if (flag == "--reorder")
+            settings.reorder = value;
+        else if (flag == "--truncate")
+            settings.truncate = value;
+        else if (flag == "--delay")
+            settings.delay_ms = value;
+        else if (flag == "--jitter")
+            settings.jitter_ms = value;
+        else if (flag == "--bandwidth")
+            settings.bandwidth = value;
+        else if (flag == "--idle" && value >= 1)
+            settings.idle_ms = (int)value;
+        else
+        {
+            log("ERROR", "Unknown option " + flag, USAGE);
+            return 1; // Exit program
+        }
+    }
+
+    if (!csv_path.empty())
+    {
+        state.csv = fopen(csv_path.c_str(), "a");
+        if (state.csv == nullptr)
+        {
+            log("ERROR", "Cannot open CSV file", csv_path + ": " + strerror(errno));
+            return 1; // Exit program
+        }
+        if (ftell(state.csv) == 0)
+        {
+            fprintf(state.csv, "flow,transport,client,outcome,requests,retransmits,nacks,first_response_ms,complete_ms,goodput_bps,"
+                               "bytes_to_server,bytes_to_client,dropped_to_server,dropped_to_client,duplicated_to_server,duplicated_to_client,"
+                               "reordered_to_server,reordered_to_client,truncated_to_server,truncated_to_client\n");
+        }
+    }
+
+    state.tcp_listen = listen_on(SOCK_STREAM, listen_port);
+    state.udp_listen = listen_on(SOCK_DGRAM, listen_port);
+    state.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (state.tcp_listen == -1 || state.udp_listen == -1 || state.epoll_fd == -1)
+    {
+        log("ERROR", "Failed to listen on port " + to_string(listen_port), strerror(errno));
+        return 1; // Exit program
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = TCP_LISTEN_TAG;
+    epoll_ctl(state.epoll_fd, EPOLL_CTL_ADD, state.tcp_listen, &event);
+    event.data.u64 = UDP_LISTEN_TAG;
+    epoll_ctl(state.epoll_fd, EPOLL_CTL_ADD, state.udp_listen, &event);
+
+    // Documentation on sigaction - https://man7.org/linux/man-pages/man2/sigaction.2.html
+    struct sigaction action{};
+    action.sa_handler = request_stop; // No SA_RESTART, epoll_wait() returns EINTR
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    char description[256];
+    snprintf(description, sizeof(description), "seed %llu, loss %g, duplicate %g, reorder %g, truncate %g, delay %g ms, jitter %g ms, bandwidth %s",
+             (unsigned long long)settings.seed, settings.loss, settings.duplicate, settings.reorder, settings.truncate, settings.delay_ms, settings.jitter_ms,
+             settings.bandwidth > 0 ? (to_string((long long)settings.bandwidth) + " B/s").c_str() : "unlimited");
+    log("INFO", "Proxying port " + to_string(listen_port) + " (TCP and UDP) to", address_name(state.server));
+    log("INFO", "Impairments", description);
+
+    vector<char> buffer(DATAGRAM_BUFFER_SIZE);
+    epoll_event events[MAX_EPOLL_EVENTS];
+    uint64_t next_idle_check = now_ns();
+    while (!stop_requested)
+    {
+        // Sleep until the next datagram leaves the link (rounded up to a millisecond) or the next idle check
+        uint64_t now = now_ns();
+        uint64_t wake = next_idle_check;
+        if (!state.link.empty())
+        {
+            wake = min(wake, state.link.top().due_ns);
+        }
+        const int timeout = wake > now ? (int)((wake - now + 999999) / 1000000) : 0;
+
+        int ready = epoll_wait(state.epoll_fd, events, MAX_EPOLL_EVENTS, timeout);
+        if (ready == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            log("ERROR", "epoll_wait() failed", strerror(errno));
+            break;
+        }
+        now = now_ns();
+        for (int i = 0; i < ready; i++)
+        {
+            const uint64_t tag = events[i].data.u64;
+            if (tag == TCP_LISTEN_TAG)
+            {
+                accept_tcp(state, now);
+                continue;
+            }
+            if (tag == UDP_LISTEN_TAG)
+            {
+                receive_udp_client(state, buffer.data(), now);
+                continue;
+            }
+            const int index = (int)(tag >> 1);
+            const int which = (int)(tag & 1);
+            if (state.flows[index].done)
+            {
+                continue;
+            }
+            if (!state.flows[index].tcp)
+            {
+                receive_udp_server(state, index, buffer.data(), now);
+                continue;
+            }
+            if ((events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && which == SERVER_SIDE && !state.flows[index].connected)
+            {
+                handle_tcp_connect(state, index);
+                if (state.flows[index].done)
+                    continue;
+            }
+            if (events[i].events & EPOLLOUT)
+            {
+                flush_outbox(state, index, which == CLIENT_SIDE ? TO_CLIENT : TO_SERVER);
+            }
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            {
+                read_tcp(state, index, which, buffer.data(), now);
+            }
+            check_tcp_done(state, index);
+        }
+
+        deliver_due(state, now);
+        if (now >= next_idle_check)
+        {
+            expire_udp_flows(state, now);
+            next_idle_check = now + ms_to_ns(100);
+        }
+    }
+
+    // Report whatever is still open
+    for (size_t i = 0; i < state.flows.size(); i++)
+    {
+        finish_flow(state, (int)i, "open at exit");
+    }
+    print_summary(state);
+    if (state.csv != nullptr)
+    {
+        fclose(state.csv);
+    }
+    close(state.tcp_listen);
+    close(state.udp_listen);
+    close(state.epoll_fd);
+    return 0; // Exit program
+}
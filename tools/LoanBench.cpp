@@ -0,0 +1,222 @@
+// Micro-benchmarks for the loan math used by the servers (no sockets involved)
+// Reports throughput of each kernel and checks that inverse solves round-trip through calculate_monthly_payment()
+#include "../server/solvers.h"   // Inverse solvers (also pulls in server_utils.h)
+#include "../server/scenarios.h" // What-if scenarios
+
+#include <chrono> // Timing (steady_clock)
+#include <random> // Deterministic workload (mt19937)
+#include <vector> // Workload arrays
+#include <cstdio> // Table output (printf)
+#include <cmath>  // fabs
+
+const int DEFAULT_LOANS = 200000; // Loans per benchmark when no argument is given
+const int SWEEP_LOANS = 1000;     // Loans in the scenario sweep (first of the workload)
+const int SWEEP_SCENARIOS = 64;   // Scenarios per loan in the sweep
+const int STANDARD_TERMS[] = {10, 15, 20, 30};
+
+// Random but repeatable loans (same seed every run so results are comparable)
+struct loan_workload
+{
+    vector<double> amount, rate, payment;
+    vector<int> years;
+};
+
+static loan_workload make_workload(int count)
+{
+    mt19937 generator(42);
+    uniform_int_distribution<int> amount_distribution(50000, 2000000);
+    uniform_real_distribution<double> rate_distribution(0.5, 12.0);
+    uniform_int_distribution<int> term_distribution(0, 3);
+
+    loan_workload workload;
+    for (int i = 0; i < count; i++)
+    {
+        int amount = amount_distribution(generator);
+        int years = STANDARD_TERMS[term_distribution(generator)];
+        double rate = round(rate_distribution(generator) * 100) / 100; // Quoted rates have 2 decimals
+        workload.amount.push_back(amount);
+        workload.years.push_back(years);
+        workload.rate.push_back(rate);
+        workload.payment.push_back(calculate_monthly_payment(amount, years, rate));
+    }
+    return workload;
+}
+
+// One random event at a month inside the term: an extra payment from that month on, a lump sum or a rate reset
+static scenario make_scenario(mt19937 &generator, int months)
+{
+    uniform_int_distribution<int> kind_distribution(0, 2);
+    uniform_int_distribution<int> month_distribution(1, months);
+    scenario result;
+    scenario_event &event = result.events[result.count++];
+    event.kind = (scenario_event_kind)kind_distribution(generator);
+    event.month = month_distribution(generator);
+    event.until = event.kind == EVENT_EXTRA ? months : event.month;
+    event.value = event.kind == EVENT_EXTRA ? 100 * uniform_int_distribution<int>(1, 10)(generator)
+                  : event.kind == EVENT_LUMP ? 1000 * uniform_int_distribution<int>(1, 50)(generator)
+                                             : uniform_int_distribution<int>(50, 1200)(generator) / 100.0;
+    return result;
+}
+
+// Run fn once and print operations per second
+template <typename Function>
+static void bench(const char *name, int operations, Function fn, const char *note = "")
+{
+    auto start = chrono::steady_clock::now();
+    fn();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("%-28s %12.0f ops/s %10.1f ns/op   %s\n", name, operations / seconds, seconds * 1e9 / operations, note);
+}
+
+int main(int argc, char *argv[])
+{
+    const int LOANS = argc > 1 ? atoi(argv[1]) : DEFAULT_LOANS;
+    if (LOANS <= 0)
+    {
+        log("ERROR", "Invalid arguments", "Usage: " + string(argv[0]) + " [loans]");
+        return 1; // Exit program
+    }
+    loan_workload workload = make_workload(LOANS);
+    volatile double sink = 0; // Keeps the compiler from dropping the work
+
+    printf("%d loans, terms 10/15/20/30 years, rates 0.5%%-12%%\n\n", LOANS);
+
+    bench("calculate_monthly_payment", LOANS, [&]
+          {
+              for (int i = 0; i < LOANS; i++)
+                  sink = sink + calculate_monthly_payment((int)workload.amount[i], workload.years[i], workload.rate[i]); }, "specialized 10/15/20/30 year kernels");
+
+    bench("..._generic", LOANS, [&]
+          {
+              for (int i = 0; i < LOANS; i++)
+                  sink = sink + calculate_monthly_payment_generic((int)workload.amount[i], workload.years[i], workload.rate[i]); }, "pow() for every term");
+
+    // The kernels must match pow() to the cent: every workload loan, then every rate from 0.001% to 30% in 0.001% steps on a few amounts
+    long payments_checked = 0;
+    int payment_mismatches = 0;
+    for (int i = 0; i < LOANS; i++, payments_checked++)
+    {
+        if (calculate_monthly_payment((int)workload.amount[i], workload.years[i], workload.rate[i]) != calculate_monthly_payment_generic((int)workload.amount[i], workload.years[i], workload.rate[i]))
+            payment_mismatches++;
+    }
+    const int CHECK_AMOUNTS[] = {1, 999, 150000, 777777, 2000000, 99999999};
+    for (int step = 1; step <= 30000; step++)
+    {
+        for (int amount : CHECK_AMOUNTS)
+        {
+            for (int years : STANDARD_TERMS)
+            {
+                payments_checked++;
+                if (calculate_monthly_payment(amount, years, step / 1000.0) != calculate_monthly_payment_generic(amount, years, step / 1000.0))
+                    payment_mismatches++;
+            }
+        }
+    }
+    printf("%-28s %ld payments compared, %d differ from the generic path\n", "", payments_checked, payment_mismatches);
+
+    bench("solve_principal", LOANS, [&]
+          {
+              for (int i = 0; i < LOANS; i++)
+                  sink = sink + solve_principal(workload.payment[i], workload.years[i], workload.rate[i]); });
+
+    bench("affordable_amount", LOANS, [&]
+          {
+              for (int i = 0; i < LOANS; i++)
+                  sink = sink + affordable_amount(workload.payment[i], workload.years[i], workload.rate[i]); });
+
+    vector<double> principal(LOANS);
+    bench("solve_principal_batch", LOANS, [&]
+          { solve_principal_batch(workload.payment.data(), workload.years.data(), workload.rate.data(), principal.data(), LOANS); });
+
+    // Scalar rate solves, also collecting iteration counts and round-trip error
+    vector<double> rate(LOANS);
+    vector<int> iterations(LOANS);
+    bench("solve_rate", LOANS, [&]
+          {
+              for (int i = 0; i < LOANS; i++)
+                  solve_rate(workload.payment[i], workload.amount[i], workload.years[i], rate[i], iterations[i]); });
+    long total_iterations = 0;
+    int max_iterations = 0;
+    int round_trip_mismatches = 0; // Solved rate doesn't reproduce the quoted payment to the cent
+    for (int i = 0; i < LOANS; i++)
+    {
+        total_iterations += iterations[i];
+        max_iterations = max(max_iterations, iterations[i]);
+        if (fabs(calculate_monthly_payment((int)workload.amount[i], workload.years[i], rate[i]) - workload.payment[i]) > 0.005)
+            round_trip_mismatches++;
+    }
+    printf("%-28s avg %.2f iterations, max %d, %d payment mismatch(es)\n", "", (double)total_iterations / LOANS, max_iterations, round_trip_mismatches);
+
+    vector<double> batch_rate(LOANS);
+    vector<int> batch_iterations(LOANS);
+    bench("solve_rate_batch", LOANS, [&]
+          { solve_rate_batch(workload.payment.data(), workload.amount.data(), workload.years.data(), batch_rate.data(), batch_iterations.data(), LOANS); });
+    total_iterations = 0;
+    max_iterations = 0;
+    double max_difference = 0; // Batch vs scalar rate (percent)
+    for (int i = 0; i < LOANS; i++)
+    {
+        total_iterations += batch_iterations[i];
+        max_iterations = max(max_iterations, batch_iterations[i]);
+        max_difference = max(max_difference, fabs(batch_rate[i] - rate[i]));
+    }
+    printf("%-28s avg %.2f iterations, max %d, max |batch - scalar| %.2e%%\n", "", (double)total_iterations / LOANS, max_iterations, max_difference);
+
+    // Requests the solvers must refuse (zero values have no answer, years * 12 overflows an int past INT_MAX / 12), each logs its error to stderr
+    const char *INVALID_SOLVER_MESSAGES[] = {
+        "RATE_BATCH 100:0:30", "RATE_BATCH 0:150000:30", "PRINCIPAL_BATCH 0:30:5", "PRINCIPAL_BATCH 777:30:0",
+        "PRINCIPAL_BATCH 777:200000000:5", "RATE_BATCH 777:150000:200000000", "PRINCIPAL_BATCH 777:41:5", "RATE_BATCH 777:150000:41",
+        "PRINCIPAL 777 200000000 5", "RATE 777 150000 41", "PRINCIPAL 0 30 5", "RATE 777 0 30"};
+    static request_arena arena; // Large, kept off the stack
+    int accepted = 0;           // Invalid requests answered anyway
+    for (const char *message : INVALID_SOLVER_MESSAGES)
+    {
+        arena.reset();
+        if (handle_solver_message(message, arena) != -1)
+            accepted++;
+    }
+    printf("%-28s %zu invalid solver requests, %d answered instead of refused\n", "", sizeof(INVALID_SOLVER_MESSAGES) / sizeof(INVALID_SOLVER_MESSAGES[0]), accepted);
+
+    // Scenario sweep: many scenarios on the same loans, replayed from month 1 against the incremental path from the first event
+    const int SWEEP = min(LOANS, SWEEP_LOANS);
+    const int SWEEP_TOTAL = SWEEP * SWEEP_SCENARIOS;
+    mt19937 scenario_generator(7);
+    vector<scenario> sweep(SWEEP_TOTAL);
+    for (int i = 0; i < SWEEP_TOTAL; i++)
+        sweep[i] = make_scenario(scenario_generator, workload.years[i / SWEEP_SCENARIOS] * 12);
+    vector<scenario_result> full(SWEEP_TOTAL), incremental(SWEEP_TOTAL);
+    static base_schedule base; // Large, kept off the stack
+
+    bench("base_schedule::build", SWEEP, [&]
+          {
+              for (int i = 0; i < SWEEP; i++)
+              {
+                  base.build((int)workload.amount[i], workload.years[i], workload.rate[i]);
+                  sink = sink + base.payment;
+              } });
+    bench("run_scenario (from month 1)", SWEEP_TOTAL, [&]
+          {
+              for (int i = 0; i < SWEEP_TOTAL; i++)
+              {
+                  if (i % SWEEP_SCENARIOS == 0)
+                      base.build((int)workload.amount[i / SWEEP_SCENARIOS], workload.years[i / SWEEP_SCENARIOS], workload.rate[i / SWEEP_SCENARIOS]);
+                  run_scenario(base, sweep[i], full[i], 1);
+              } }, "base built once per loan");
+    bench("run_scenario (incremental)", SWEEP_TOTAL, [&]
+          {
+              for (int i = 0; i < SWEEP_TOTAL; i++)
+              {
+                  const int loan = i / SWEEP_SCENARIOS;
+                  run_scenario(cached_base_schedule((int)workload.amount[loan], workload.years[loan], workload.rate[loan]), sweep[i], incremental[i]);
+              } }, "cached base, from the first event");
+    int scenario_mismatches = 0; // Incremental result differs from the full replay
+    for (int i = 0; i < SWEEP_TOTAL; i++)
+    {
+        if (full[i].payoff_month != incremental[i].payoff_month || full[i].total_interest != incremental[i].total_interest || full[i].interest_saved != incremental[i].interest_saved)
+            scenario_mismatches++;
+    }
+    printf("%-28s %d loans x %d scenarios, %d mismatch(es) against the full replay\n", "", SWEEP, SWEEP_SCENARIOS, scenario_mismatches);
+
+    (void)sink;
+    return 0; // Exit program
+}
@@ -0,0 +1,673 @@
+// Replays recordings made with the servers' --record option against a running server and reports latency percentiles
+// - Requests are sent with their recorded inter-arrival times (scaled by --speed), or as fast as possible with --speed 0
+// - TCP requests each get their own connection like the recorded clients did, UDP requests of one recorded client share one socket
+// - Segmented UDP requests get a fresh request id, every segment has to arrive (no NACKs), then a FIN is sent
+// - Latency is also broken down by command (quotes, SCHEDULE, RATE_BATCH, ...) so a mixed workload shows whether cheap requests wait behind heavy ones
+// - --rate sends at a fixed rate instead of the recorded times (open loop, for overload tests), --honor-retry sends a request the server
+//   shed (OVERLOADED <ms>) again after the hint like the clients do, its latency still counts from the first send
+// Usage: Replay <ip> <recording>... [--speed <factor>] [--rate <requests/sec>] [--max-inflight <requests>] [--timeout <ms>] [--honor-retry]
+#include "../server/recorder.h" // Recording format (also pulls in server_utils.h)
+
+#include <sys/epoll.h>    // Wait on every in-flight request at once (epoll)
+#include <sys/resource.h> // One descriptor per in-flight TCP request (setrlimit)
+#include <fcntl.h>        // Non-blocking sockets (fcntl)
+#include <vector>         // Requests, latencies
+#include <deque>          // In-flight requests in send order
+#include <map>            // Recorded client -> replay socket
+#include <set>            // Commands seen
+#include <queue>          // Requests waiting out an OVERLOADED hint (priority_queue)
+#include <algorithm>      // sort, stable_sort
+#include <cstdio>         // Report output (printf), reading recordings (fopen)
+#include <cmath>          // ceil
+
+const double DEFAULT_SPEED = 1;       // Recorded timing
+const int DEFAULT_MAX_INFLIGHT = 256; // Requests waiting for a response at once
+const int DEFAULT_TIMEOUT = 5000;     // Milliseconds before a request counts as lost
+const int MAX_EPOLL_EVENTS = 64;      // Events handled per epoll_wait() call
+const int READ_BUFFER_SIZE = 65536;   // Response bytes read per recv()
+const uint64_t UDP_TAG = 1ULL << 63;  // epoll tag bit of UDP sockets (TCP tags are request indexes)
+
+enum request_state
+{
+    STATE_PENDING,    // Not sent yet
+    STATE_CONNECTING, // TCP connect() in progress
+    STATE_WAITING,    // Sent, waiting for (the rest of) the response
+    STATE_BACKOFF,    // Shed by the server, waiting out its hint before sending again (with --honor-retry)
+    STATE_DONE        // Response complete, failed or timed out
+};
+
+enum request_outcome
+{
+    OUTCOME_OK,      // Whole response received
+    OUTCOME_BUSY,    // Server answered BUSY (rate limited)
+    OUTCOME_SHED,    // Server answered OVERLOADED (and with --honor-retry, still did when --timeout ran out)
+    OUTCOME_FAILED,  // Connect/send/receive error
+    OUTCOME_TIMEOUT, // No (complete) response within --timeout
+    OUTCOME_COUNT
+};
+
+// One recorded request and its replay progress
+struct replay_request
+{
+    uint64_t timestamp_ns;                // Recorded arrival time
+    record_transport transport;           // TCP or UDP
+    uint64_t client;                      // Recorded client address << 16 | port
+    string message;                       // What to send (TCP: with MESSAGE_TERMINATOR, UDP: with the replay request id)
+    string command;                       // First word of the request (SCHEDULE, RATE_BATCH, ...) or "quote" for <amount> <years> <rate>
+    bool segmented = false;               // UDP SEG request, the response arrives in segments
+    int flow = -1;                        // UDP socket index
+    int fd = -1;                          // TCP socket
+    request_state state = STATE_PENDING;  // Progress
+    request_outcome outcome = OUTCOME_OK; // Result once done
+    uint64_t intended_ns = 0;             // When it should have been sent (latency is measured from here so a late send counts)
+    uint64_t done_ns = 0;                 // When the response completed
+    uint64_t segments_received = 0;       // Segment bitmap
+    int segment_total = 0;                // Segments in the response, 0 until the first arrives
+    size_t response_length = 0;           // Response bytes received
+    bool busy = false;                    // Response started with BUSY
+    int retry_after_ms = -1;              // Hint of an OVERLOADED response, -1 otherwise
+    int attempts = 0;                     // Times sent (more than once only with --honor-retry)
+};
+
+// Replay socket of one recorded UDP client
+struct replay_flow
+{
+    int fd = -1;          // Connected UDP socket
+    deque<int> in_flight; // Requests sent on it, oldest first (plain responses are matched in order)
+};
+
+struct replay_state
+{
+    vector<replay_request> requests;  // Every recorded request, in arrival order
+    vector<replay_flow> flows;        // UDP sockets
+    deque<int> in_flight;             // Every request sent and not done, in send order (so deadlines are in order too)
+    int epoll_fd = -1;                // epoll instance
+    sockaddr_in server{};             // Server address (SERVER_PORT)
+    int timeout_ms = DEFAULT_TIMEOUT; // --timeout
+    int active = 0;                   // Requests in flight
+    bool honor_retry = false;         // --honor-retry
+    uint64_t resent = 0;              // Requests sent again after OVERLOADED
+    priority_queue<pair<uint64_t, int>, vector<pair<uint64_t, int>>, greater<pair<uint64_t, int>>> backoff; // When to resend, request index
+};
+
+static uint64_t now_ns()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Command word after any SEG <id> / ID <id> prefix, "quote" if the message starts with a number
+static string command_name(string_view message)
+{
+    for (string_view prefix : {string_view(SEGMENT_COMMAND), string_view("ID")})
+    {
+        if (is_command(message, prefix))
+        {
+            const size_t space = message.find(' ', prefix.size() + 1);
+            message = space == string_view::npos ? string_view() : message.substr(space + 1);
+        }
+    }
+    const string_view word = message.substr(0, message.find(' '));
+    if (word.empty() || !isupper((unsigned char)word[0]))
+    {
+        return "quote";
+    }
+    return string(word);
+}
+
+// Read every record of a recording into requests
+// Return 0 on success, -1 if the file isn't a recording
+static int load_recording(const char *path, vector<replay_request> &requests)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        log("ERROR", "Failed to open recording " + string(path), strerror(errno));
+        return -1; // Fail
+    }
+    record_file_header file_header;
+    if (fread(&file_header, sizeof(file_header), 1, file) != 1 || memcmp(file_header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0 ||
+        file_header.version != RECORD_VERSION || (file_header.transport != TRANSPORT_TCP && file_header.transport != TRANSPORT_UDP))
+    {
+        log("ERROR", "Not a recording", path);
+        fclose(file);
+        return -1; // Fail
+    }
+
+    record_header header;
+    char message[MESSAGE_BUFFER_SIZE];
+    size_t count = 0;
+    while (fread(&header, sizeof(header), 1, file) == 1)
+    {
+        if (header.length > sizeof(message) || fread(message, 1, header.length, file) != header.length)
+        {
+            log("WARNING", "Recording ends with a torn record", path);
+            break;
+        }
+        replay_request request;
+        request.timestamp_ns = header.timestamp_ns;
+        request.transport = (record_transport)file_header.transport;
+        request.client = ((uint64_t)header.address << 16) | header.port;
+        request.message.assign(message, header.length);
+        request.command = command_name(request.message);
+        requests.push_back(move(request));
+        count++;
+    }
+    fclose(file);
+    log("INFO", "Loaded " + to_string(count) + (file_header.transport == TRANSPORT_TCP ? " TCP" : " UDP") + " request(s) from", path);
+    return 0; // Success
+}
+
+// Give each UDP request its replay socket and each segmented one a unique id (its index), append the terminator to TCP requests
+// Return 0 on success, -1 if a socket can't be created
+static int prepare_requests(replay_state &state)
+{
+    map<uint64_t, int> flow_of_client;
+    for (size_t i = 0; i < state.requests.size(); i++)
+    {
+        replay_request &request = state.requests[i];
+        if (request.transport == TRANSPORT_TCP)
+        {
+            request.message += MESSAGE_TERMINATOR;
+            continue;
+        }
+
+        // SEG <recorded id> <message> becomes SEG <index> <message> so retried ids of different recorded clients never collide
+        if (is_command(request.message, SEGMENT_COMMAND))
+        {
+            const size_t space = request.message.find(' ', SEGMENT_COMMAND.size() + 1);
+            if (space != string::npos)
+            {
+                request.message = SEGMENT_COMMAND + " " + to_string(i) + request.message.substr(space);
+                request.segmented = true;
+            }
+        }
+
+        auto found = flow_of_client.find(request.client);
+        if (found == flow_of_client.end())
+        {
+            replay_flow flow;
+            flow.fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (flow.fd == -1 || connect(flow.fd, (sockaddr *)&state.server, sizeof(state.server)) == -1)
+            {
+                log("ERROR", "UDP socket creation failed", strerror(errno));
+                return -1; // Fail
+            }
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.u64 = UDP_TAG | state.flows.size();
+            epoll_ctl(state.epoll_fd, EPOLL_CTL_ADD, flow.fd, &event);
+            found = flow_of_client.emplace(request.client, (int)state.flows.size()).first;
+            state.flows.push_back(flow);
+        }
+        request.flow = found->second;
+    }
+    return 0; // Success
+}
+
+static void finish(replay_state &state, replay_request &request, request_outcome outcome, uint64_t now)
+{
+    if (request.state == STATE_DONE)
+    {
+        return;
+    }
+    if (request.fd != -1)
+    {
+        close(request.fd); // Also removes it from epoll
+        request.fd = -1;
+    }
+    request.state = STATE_DONE;
+    request.outcome = outcome;
+    request.done_ns = now;
+    state.active--;
+}
+
+// Send (again): connect for TCP (the message goes out once connected), send right away for UDP
+static void start_attempt(replay_state &state, int index, uint64_t now)
+{
+    replay_request &request = state.requests[index];
+    request.attempts++;
+    request.response_length = 0;
+    request.busy = false;
+    request.retry_after_ms = -1;
+
+    if (request.transport == TRANSPORT_UDP)
+    {
+        replay_flow &flow = state.flows[request.flow];
+        request.state = STATE_WAITING;
+        if (request.attempts > 1)
+        {
+            flow.in_flight.erase(find(flow.in_flight.begin(), flow.in_flight.end(), index)); // Plain responses are matched in send order
+        }
+        flow.in_flight.push_back(index);
+        if (send(flow.fd, request.message.data(), request.message.size(), 0) == -1)
+        {
+            log("ERROR", "Failed to send request", strerror(errno));
+            finish(state, request, OUTCOME_FAILED, now);
+        }
+        return;
+    }
+
+    request.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (request.fd == -1 || (connect(request.fd, (sockaddr *)&state.server, sizeof(state.server)) == -1 && errno != EINPROGRESS))
+    {
+        log("ERROR", "Connection failed", strerror(errno));
+        finish(state, request, OUTCOME_FAILED, now);
+        return;
+    }
+    request.state = STATE_CONNECTING;
+    epoll_event event{};
+    event.events = EPOLLOUT;
+    event.data.u64 = index;
+    epoll_ctl(state.epoll_fd, EPOLL_CTL_ADD, request.fd, &event);
+}
+
+// Start one request, it stays in flight until answered or past --timeout (retries after OVERLOADED included)
+static void send_request(replay_state &state, int index, uint64_t intended, uint64_t now)
+{
+    state.requests[index].intended_ns = intended;
+    state.active++;
+    state.in_flight.push_back(index);
+    start_attempt(state, index, now);
+}
+
+// OVERLOADED <ms>: sent again once the hint (plus jitter, like the clients) passed with --honor-retry, shed otherwise (or when --timeout is too close)
+static void shed(replay_state &state, int index, uint64_t now)
+{
+    replay_request &request = state.requests[index];
+    if (!state.honor_retry)
+    {
+        finish(state, request, OUTCOME_SHED, now);
+        return;
+    }
+    if (request.fd != -1)
+    {
+        close(request.fd);
+        request.fd = -1;
+    }
+    request.state = STATE_BACKOFF;
+    const uint64_t deadline = request.intended_ns + (uint64_t)state.timeout_ms * 1000000;
+    const int wait_ms = retry_wait_ms(request.retry_after_ms, deadline > now ? (deadline - now) / 1000 : 0);
+    if (wait_ms == -1)
+    {
+        finish(state, request, OUTCOME_SHED, now); // Too close to --timeout to come back in time
+        return;
+    }
+    state.backoff.push({now + (uint64_t)wait_ms * 1000000, index});
+}
+
+// TCP socket ready: send the message once connected, then read until the server closes the connection
+static void handle_tcp(replay_state &state, int index, uint64_t now, char *buffer)
+{
+    replay_request &request = state.requests[index];
+    if (request.state == STATE_CONNECTING)
+    {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(request.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        // Requests are far smaller than the socket buffer so one send() takes the whole message
+        if (error != 0 || send(request.fd, request.message.data(), request.message.size(), MSG_NOSIGNAL) != (ssize_t)request.message.size())
+        {
+            finish(state, request, OUTCOME_FAILED, now);
+            return;
+        }
+        request.state = STATE_WAITING;
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = index;
+        epoll_ctl(state.epoll_fd, EPOLL_CTL_MOD, request.fd, &event);
+        return;
+    }
+
+    while (request.state == STATE_WAITING)
+    {
+        ssize_t received = recv(request.fd, buffer, READ_BUFFER_SIZE, 0);
+        if (received > 0)
+        {
+            if (request.response_length == 0)
+            {
+                request.busy = string_view(buffer, received) == BUSY_RESPONSE;
+                parse_overloaded(string_view(buffer, received), request.retry_after_ms);
+            }
+            request.response_length += received;
+        }
+        else if (received == 0)
+        {
+            // The server closes the connection after every response
+            if (request.retry_after_ms >= 0)
+            {
+                shed(state, index, now);
+                return;
+            }
+            finish(state, request, request.busy ? OUTCOME_BUSY : request.response_length > 0 ? OUTCOME_OK : OUTCOME_FAILED, now);
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return;
+        }
+        else if (errno != EINTR)
+        {
+            finish(state, request, OUTCOME_FAILED, now);
+        }
+    }
+}
+
+// UDP socket readable: match every datagram to a request of this flow
+static void handle_udp(replay_state &state, int flow_index, uint64_t now, char *buffer)
+{
+    replay_flow &flow = state.flows[flow_index];
+    ssize_t received;
+    while ((received = recv(flow.fd, buffer, READ_BUFFER_SIZE, 0)) >= 0)
+    {
+        while (!flow.in_flight.empty() && state.requests[flow.in_flight.front()].state == STATE_DONE)
+        {
+            flow.in_flight.pop_front();
+        }
+        const string_view datagram(buffer, received);
+
+        uint32_t id;
+        int sequence, total;
+        string_view payload;
+        if (parse_segment_header(datagram, id, sequence, total, payload) == 0)
+        {
+            if (id >= state.requests.size() || state.requests[id].flow != flow_index || state.requests[id].state != STATE_WAITING)
+            {
+                continue; // Late or duplicate segment
+            }
+            replay_request &request = state.requests[id];
+            request.segment_total = total;
+            request.segments_received |= 1ULL << sequence;
+            request.response_length += payload.size();
+            if (request.segments_received == (total == MAX_SEGMENTS ? ~0ULL : (1ULL << total) - 1))
+            {
+                const string fin = FIN_COMMAND + " " + to_string(id);
+                send(flow.fd, fin.data(), fin.size(), 0);
+                finish(state, request, OUTCOME_OK, now);
+            }
+            continue;
+        }
+
+        // BUSY and OVERLOADED answer the oldest request of the flow, a plain response the oldest plain request
+        const bool busy = datagram == BUSY_RESPONSE;
+        int retry_after_ms = -1;
+        parse_overloaded(datagram, retry_after_ms);
+        for (int index : flow.in_flight)
+        {
+            replay_request &request = state.requests[index];
+            if (request.state == STATE_WAITING && (busy || retry_after_ms >= 0 || !request.segmented))
+            {
+                request.response_length = received;
+                if (retry_after_ms >= 0)
+                {
+                    request.retry_after_ms = retry_after_ms;
+                    shed(state, index, now);
+                }
+                else
+                {
+                    finish(state, request, busy ? OUTCOME_BUSY : OUTCOME_OK, now);
+                }
+                break;
+            }
+        }
+    }
+}
+
+// Allow one descriptor per in-flight TCP request (the default soft limit is often 1024)
+// Documentation on setrlimit - https://man7.org/linux/man-pages/man2/getrlimit.2.html
+static void raise_file_limit()
+{
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+// Value at percentile p of sorted latencies (nearest rank)
+static double percentile(const vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t rank = (size_t)ceil(p / 100 * sorted.size());
+    return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+// One row of the report, transport 0 means both, an empty command means every command
+static void print_summary(const string &name, const vector<replay_request> &requests, int transport, const string &command = "")
+{
+    vector<double> latencies; // Milliseconds, successful requests only
+    long outcomes[OUTCOME_COUNT] = {};
+    for (const replay_request &request : requests)
+    {
+        if ((transport != 0 && (int)request.transport != transport) || (!command.empty() && request.command != command))
+            continue;
+        outcomes[request.outcome]++;
+        if (request.outcome == OUTCOME_OK)
+            latencies.push_back((request.done_ns - request.intended_ns) / 1e6);
+    }
+    if (outcomes[OUTCOME_OK] + outcomes[OUTCOME_BUSY] + outcomes[OUTCOME_SHED] + outcomes[OUTCOME_FAILED] + outcomes[OUTCOME_TIMEOUT] == 0)
+    {
+        return;
+    }
+    sort(latencies.begin(), latencies.end());
+    printf("%-15s %8ld %6ld %6ld %6ld %7ld %9.3f %9.3f %9.3f %9.3f %9.3f\n", name.c_str(), outcomes[OUTCOME_OK], outcomes[OUTCOME_BUSY], outcomes[OUTCOME_SHED], outcomes[OUTCOME_FAILED], outcomes[OUTCOME_TIMEOUT],
+           percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99), percentile(latencies, 99.9), latencies.empty() ? 0 : latencies.back());
+}
+
+int main(int argc, char *argv[])
+{
+    const string USAGE = "Usage: " + string(argc > 0 ? argv[0] : "Replay") + " <ip> <recording>... [--speed <factor>] [--rate <requests/sec>] [--max-inflight <requests>] [--timeout <ms>] [--honor-retry]";
+    replay_state state;
+    double speed = DEFAULT_SPEED;
+    double rate = 0; // --rate, 0 keeps the recorded timing
+    int max_inflight = DEFAULT_MAX_INFLIGHT;
+    vector<const char *> recordings;
+
+    state.server.sin_family = AF_INET;
+    state.server.sin_port = htons(SERVER_PORT);
+    if (argc < 3 || inet_pton(AF_INET, argv[1], &state.server.sin_addr) != 1)
+    {
+        log("ERROR", "Invalid arguments", USAGE);
+        return 1; // Exit program
+    }
+    for (int i = 2; i < argc; i++)
+    {
+        const string flag = argv[i];
+        if (flag == "--honor-retry")
+        {
+            state.honor_retry = true;
+        }
+        else if ((flag == "--speed" || flag == "--rate" || flag == "--max-inflight" || flag == "--timeout") && i + 1 < argc)
+        {
+            const double value = atof(argv[++i]);
+            if (value < 0 || (flag != "--speed" && value < 1))
+            {
+                log("ERROR", "Invalid value for " + flag, argv[i]);
+                return 1; // Exit program
+            }
+            if (flag == "--speed")
+                speed = value;
+            else if (flag == "--rate")
+                rate = value;
+            else if (flag == "--max-inflight")
+                max_inflight = (int)value;
+            else
+                state.timeout_ms = (int)value;
+        }
+        else if (flag.rfind("--", 0) == 0)
+        {
+            log("ERROR", "Unknown option " + flag, USAGE);
+            return 1; // Exit program
+        }
+        else
+        {
+            recordings.push_back(argv[i]);
+        }
+    }
+
+    for (const char *path : recordings)
+    {
+        if (load_recording(path, state.requests) != 0)
+        {
+            return 1; // Exit program
+        }
+    }
+    if (state.requests.empty())
+    {
+        log("ERROR", "Nothing to replay", USAGE);
+        return 1; // Exit program
+    }
+    // Recordings of both servers (and of restarted processes) interleave by arrival time
+    stable_sort(state.requests.begin(), state.requests.end(), [](const replay_request &a, const replay_request &b)
+                { return a.timestamp_ns < b.timestamp_ns; });
+
+    raise_file_limit();
+    state.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (state.epoll_fd == -1 || prepare_requests(state) != 0)
+    {
+        return 1; // Exit program
+    }
+
+    const size_t total = state.requests.size();
+    const uint64_t first_ns = state.requests.front().timestamp_ns;
+    const double recorded_seconds = (state.requests.back().timestamp_ns - first_ns) / 1e9;
+    char speed_text[32] = "max";
+    if (rate > 0)
+    {
+        snprintf(speed_text, sizeof(speed_text), "%g requests/s", rate);
+    }
+    else if (speed > 0)
+    {
+        snprintf(speed_text, sizeof(speed_text), "%gx", speed);
+    }
+    printf("Replaying %zu request(s) over %zu UDP client(s), recorded over %.3f s, speed %s, max in flight %d%s\n\n", total, state.flows.size(), recorded_seconds, speed_text, max_inflight,
+           state.honor_retry ? ", OVERLOADED requests sent again after the hint" : "");
+
+    vector<char> buffer(READ_BUFFER_SIZE);
+    epoll_event events[MAX_EPOLL_EVENTS];
+    const uint64_t start_ns = now_ns();
+    // When a request should go out: every 1/rate seconds with --rate, at its recorded time scaled by --speed otherwise
+    auto intended_at = [&](size_t index)
+    {
+        return rate > 0 ? start_ns + (uint64_t)(index * 1e9 / rate) : start_ns + (uint64_t)((state.requests[index].timestamp_ns - first_ns) / speed);
+    };
+    const bool paced = rate > 0 || speed > 0; // Otherwise as fast as in-flight room allows
+    size_t next = 0;                          // Next request to send
+    while (next < total || state.active > 0)
+    {
+        uint64_t now = now_ns();
+
+        // Resend shed requests whose hint passed (they already hold their in-flight room)
+        while (!state.backoff.empty() && state.backoff.top().first <= now)
+        {
+            const int index = state.backoff.top().second;
+            state.backoff.pop();
+            if (state.requests[index].state == STATE_BACKOFF)
+            {
+                start_attempt(state, index, now);
+                state.resent++;
+            }
+        }
+
+        // Send every request that is due, while in-flight room lasts (a late send still measures latency from its recorded time)
+        while (next < total && state.active < max_inflight)
+        {
+            const uint64_t intended = paced ? intended_at(next) : now;
+            if (intended > now)
+                break;
+            send_request(state, next, intended, now);
+            next++;
+        }
+
+        // Sleep until the next send, the next resend or the oldest in-flight deadline, whichever comes first
+        int timeout = -1;
+        if (next < total && state.active < max_inflight && paced)
+        {
+            const uint64_t intended = intended_at(next);
+            timeout = intended > now ? (int)((intended - now) / 1000000) : 0; // Rounded down, the last millisecond is spun
+        }
+        if (!state.backoff.empty())
+        {
+            const uint64_t due = state.backoff.top().first;
+            const int backoff_timeout = due > now ? (int)((due - now) / 1000000) : 0;
+            timeout = timeout == -1 ? backoff_timeout : min(timeout, backoff_timeout);
+        }
+        while (!state.in_flight.empty() && state.requests[state.in_flight.front()].state == STATE_DONE)
+        {
+            state.in_flight.pop_front();
+        }
+        if (!state.in_flight.empty())
+        {
+            const uint64_t deadline = state.requests[state.in_flight.front()].intended_ns + (uint64_t)state.timeout_ms * 1000000;
+            const int deadline_timeout = deadline > now ? (int)((deadline - now + 999999) / 1000000) : 0;
+            timeout = timeout == -1 ? deadline_timeout : min(timeout, deadline_timeout);
+        }
+
+        int ready = epoll_wait(state.epoll_fd, events, MAX_EPOLL_EVENTS, timeout);
+        if (ready == -1 && errno != EINTR)
+        {
+            log("ERROR", "epoll_wait() failed", strerror(errno));
+            return 1; // Exit program
+        }
+        now = now_ns();
+        for (int i = 0; i < ready; i++)
+        {
+            const uint64_t tag = events[i].data.u64;
+            if (tag & UDP_TAG)
+                handle_udp(state, (int)(tag & ~UDP_TAG), now, buffer.data());
+            else
+                handle_tcp(state, (int)tag, now, buffer.data());
+        }
+
+        // Requests are in send order, so only the front can be past its deadline first
+        while (!state.in_flight.empty())
+        {
+            replay_request &oldest = state.requests[state.in_flight.front()];
+            if (oldest.state != STATE_DONE && now < oldest.intended_ns + (uint64_t)state.timeout_ms * 1000000)
+                break;
+            finish(state, oldest, oldest.state == STATE_BACKOFF ? OUTCOME_SHED : OUTCOME_TIMEOUT, now); // No-op if already done
+            state.in_flight.pop_front();
+        }
+    }
+    const double replay_seconds = (now_ns() - start_ns) / 1e9;
+
+    printf("%-15s %8s %6s %6s %6s %7s %9s %9s %9s %9s %9s\n", "", "ok", "busy", "shed", "failed", "timeout", "p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "max ms");
+    print_summary("TCP", state.requests, TRANSPORT_TCP);
+    print_summary("UDP", state.requests, TRANSPORT_UDP);
+    print_summary("all", state.requests, 0);
+    set<string> commands;
+    for (const replay_request &request : state.requests)
+    {
+        commands.insert(request.command);
+    }
+    if (commands.size() > 1)
+    {
+        printf("\n");
+        for (const string &command : commands)
+        {
+            print_summary(command, state.requests, 0, command);
+        }
+    }
+    long ok = 0;
+    for (const replay_request &request : state.requests)
+    {
+        ok += request.outcome == OUTCOME_OK ? 1 : 0;
+    }
+    printf("\nReplayed in %.3f s (%.0f requests/s), goodput %.0f ok/s", replay_seconds, total / replay_seconds, ok / replay_seconds);
+    if (state.honor_retry)
+    {
+        printf(", %llu resent after OVERLOADED", (unsigned long long)state.resent);
+    }
+    printf("\n");
+
+    for (replay_flow &flow : state.flows)
+    {
+        close(flow.fd);
+    }
+    close(state.epoll_fd);
+    return 0; // Exit program
+}
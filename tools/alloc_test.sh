@@ -0,0 +1,95 @@
+#!/bin/bash
+# Checks that steady-state requests don't allocate, for every command both servers answer
+# - Builds TCPServer and UDPServer with -DCOUNT_ALLOCATIONS (see Allocation Test Hook), a request that allocates after the warm-up
+#   logs [ERROR] Allocation on request path and aborts the server
+# - The TCP server runs with --record --tcp-info --admission --workers 1 and the UDP server with --record --rx-stats --admission, so
+#   the recorder, the samplers, admission control and the compute pool are on the request path too; a 1 ms --target-latency makes
+#   them shed requests (Replay sends those again after the hint)
+# - The clients send every command once (quotes, ID-prefixed quotes, PRINCIPAL, RATE, both batches, SCHEDULE, SCENARIO, segmented UDP),
+#   then Replay sends what the server recorded again many times over, concurrently, as fast as it can
+# - Fails (exit 1) if a server aborted or logged an allocation, or answered none of the replayed requests (a lost UDP segment only
+#   costs its request, Replay sends no NACKs)
+# Usage: tools/alloc_test.sh [--copies <n>] (port 13000 must be free)
+#        BIN=<dir> runs the clients and Replay from <dir> instead of compiled/
+cd "$(dirname "$0")/.." || exit 1
+BIN=${BIN:-compiled}
+
+COPIES=100 # Times the recording is replayed (past TCP_STATS_INTERVAL samples, so the TCP_INFO summary is logged too)
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --copies) COPIES="$2"; shift ;;
+        *) echo "Usage: $0 [--copies <n>]"; exit 1 ;;
+    esac
+    shift
+done
+for binary in "$BIN/TCPClient" "$BIN/UDPClient" "$BIN/Replay"; do
+    [ -x "$binary" ] || { echo "$binary is missing, see How to Compile Binaries"; exit 1; }
+done
+
+WORK=$(mktemp -d)
+SERVER=""
+trap '[ -n "$SERVER" ] && kill $SERVER 2>/dev/null; rm -rf "$WORK"' EXIT
+
+echo "Building servers with -DCOUNT_ALLOCATIONS"
+g++ -DCOUNT_ALLOCATIONS server/TCPServer.cpp server/server_utils.cpp server/hot_restart.cpp server/rate_limiter.cpp server/alloc_counter.cpp server/solvers.cpp server/scenarios.cpp server/grid.cpp server/timer_wheel.cpp server/recorder.cpp server/work_pool.cpp server/admission.cpp network/network_utils.cpp network/tcp_stats.cpp -pthread -o "$WORK/TCPServer" || exit 1
+g++ -DCOUNT_ALLOCATIONS server/UDPServer.cpp server/server_utils.cpp server/hot_restart.cpp server/rate_limiter.cpp server/alloc_counter.cpp server/solvers.cpp server/scenarios.cpp server/segments.cpp server/timer_wheel.cpp server/recorder.cpp server/udp_stats.cpp server/admission.cpp network/network_utils.cpp network/tcp_stats.cpp -o "$WORK/UDPServer" || exit 1
+
+# Every client mode except --grid (grid streams start threads, they are not covered)
+send_every_command() # <client>
+{
+    local client="$BIN/$1"
+    local extra=$([ "$1" = TCPClient ] && echo "--tcp-info")
+    "$client" 127.0.0.1 150,000 30 4.69% --repeat 3
+    "$client" 127.0.0.1 150,000 30 4.69% $extra
+    "$client" 127.0.0.1 250,000 15 3.5%
+    "$client" 127.0.0.1 80,000 7 6.25%
+    "$client" 127.0.0.1 --principal 777.06 30 4.69% $extra
+    "$client" 127.0.0.1 --rate 777.06 150,000 30
+    "$client" 127.0.0.1 --principal-batch 777.06:30:4.69% 1,200:15:3.5% 500:40:7%
+    "$client" 127.0.0.1 --rate-batch 777.06:150,000:30 1,200:100,000:10 100:150,000:30
+    "$client" 127.0.0.1 --schedule 150,000 30 4.69% $extra
+    "$client" 127.0.0.1 --scenario 150,000 30 4.69% extra:200 lump:10,000:60 reset:6.5:61 reset:3:61+extra:100:1:120
+}
+
+# <name> <server args>...: record the clients through the counting server, replay the recording, then check the server survived
+check_server()
+{
+    local name=$1
+    shift
+    "$WORK/$name" --record "$WORK/$name.rec" "$@" >"$WORK/$name.log" 2>&1 &
+    SERVER=$!
+    sleep 0.5
+    send_every_command ${name/Server/Client} >"$WORK/clients.log" 2>&1
+    sleep 2 # The recorder writes at most one second after the last request
+
+    local recordings=()
+    for ((i = 0; i < COPIES; i++)); do
+        recordings+=("$WORK/$name.rec")
+    done
+    "$BIN/Replay" 127.0.0.1 "${recordings[@]}" --speed 0 --max-inflight 16 --timeout 5000 --honor-retry 2>&1 | sed 's/\x1b\[[0-9;]*m//g' >"$WORK/replay.log"
+    echo "$name ($*): $(grep -E "^all " "$WORK/replay.log" | awk '{ print $2 " ok, " $5 " failed, " $6 " timeout" }'), $(grep -o "[0-9]* resent" "$WORK/replay.log") after OVERLOADED"
+
+    local failed=0
+    if ! kill -0 $SERVER 2>/dev/null; then
+        echo "$name exited during the test"
+        failed=1
+    fi
+    if grep -aq "Allocation on request path" "$WORK/$name.log"; then
+        grep -a "Allocation on request path" "$WORK/$name.log" | sed 's/\x1b\[[0-9;]*m//g'
+        failed=1
+    fi
+    if [ "$(grep -E "^all " "$WORK/replay.log" | awk '{ ok = $2 } END { print ok + 0 }')" = 0 ]; then
+        echo "$name answered no replayed request"
+        failed=1
+    fi
+    kill $SERVER 2>/dev/null
+    wait $SERVER 2>/dev/null
+    SERVER=""
+    return $failed
+}
+
+status=0
+check_server TCPServer --tcp-info --admission --target-latency 1 --workers 1 || status=1
+check_server UDPServer --rx-stats --admission --target-latency 1 || status=1
+[ $status = 0 ] && echo "No allocation on the request path" || echo "FAILED"
+exit $status
@@ -0,0 +1,48 @@
+#!/bin/bash
+# Tail latency of a server list with one slow replica, without and with hedged requests (the Server Lists and Hedged Requests local test)
+# - Starts three servers on --port 13001, 13002 and 13003 and a ChaosProxy on 14003 that slows the third (--delay plus up to --jitter ms)
+# - The client sends the same quote --requests times to 127.0.0.1:13001,127.0.0.1:13002,127.0.0.1:14003, once with --hedge-budget 0
+#   (the balancer alone) and once with the default budget
+# - Prints the client's per replica counts and its request latency line (p50/p90/p99/p99.9/max, hedges sent) for both runs
+# Usage: tools/hedge_test.sh [--udp] [--requests <n>] [--delay <ms>] [--jitter <ms>] (ports 13001-13003 and 14003 must be free)
+#        BIN=<dir> runs the binaries from <dir> instead of compiled/
+cd "$(dirname "$0")/.." || exit 1
+BIN=${BIN:-compiled}
+
+SERVER_NAME=TCPServer # Replicas under test
+CLIENT_NAME=TCPClient # Client sending the quotes
+REQUESTS=3000         # Quotes per run (--repeat)
+DELAY=5               # ChaosProxy --delay in milliseconds
+JITTER=40             # ChaosProxy --jitter in milliseconds
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --udp) SERVER_NAME=UDPServer; CLIENT_NAME=UDPClient ;;
+        --requests) REQUESTS="$2"; shift ;;
+        --delay) DELAY="$2"; shift ;;
+        --jitter) JITTER="$2"; shift ;;
+        *) echo "Usage: $0 [--udp] [--requests <n>] [--delay <ms>] [--jitter <ms>]"; exit 1 ;;
+    esac
+    shift
+done
+for binary in "$BIN/$SERVER_NAME" "$BIN/$CLIENT_NAME" "$BIN/ChaosProxy"; do
+    [ -x "$binary" ] || { echo "$binary is missing, see How to Compile Binaries"; exit 1; }
+done
+
+WORK=$(mktemp -d)
+PIDS=()
+trap '[ ${#PIDS[@]} -gt 0 ] && kill "${PIDS[@]}" 2>/dev/null; rm -rf "$WORK"' EXIT
+
+for port in 13001 13002 13003; do
+    "$BIN/$SERVER_NAME" --port $port >"$WORK/server.$port.log" 2>&1 &
+    PIDS+=($!)
+done
+"$BIN/ChaosProxy" 14003 127.0.0.1:13003 --delay $DELAY --jitter $JITTER >"$WORK/chaos.log" 2>&1 &
+PIDS+=($!)
+sleep 0.5
+
+SERVERS=127.0.0.1:13001,127.0.0.1:13002,127.0.0.1:14003
+for budget in 0 default; do
+    echo "== $CLIENT_NAME, $REQUESTS quotes to $SERVERS (14003: ChaosProxy --delay $DELAY --jitter $JITTER), --hedge-budget $budget"
+    "$BIN/$CLIENT_NAME" $SERVERS 150,000 30 4.69% --repeat $REQUESTS $([ $budget = default ] || echo "--hedge-budget $budget") 2>&1 |
+        sed 's/\x1b\[[0-9;]*m//g' | grep -E "\[INFO\] (Replica |Request latency)" | sed 's/^\[[0-9:]*\] \[INFO\] //'
+done
@@ -0,0 +1,110 @@
+#!/bin/bash
+# Restarts a server under load and reports what the clients saw: requests refused or failed, timeouts and p99 latency
+# - Records quotes through --record, then Replay --rate sends them at a fixed rate while the script restarts the server a few times
+# - Three runs on the same load: no restart (baseline), hot restarts (a second --hot-restart process takes the socket over, the old one
+#   drains and exits) and cold restarts (the old process is killed and a new one binds the port again --gap milliseconds later, the time
+#   a deploy takes between stopping one binary and starting the next)
+# - Refused connections count as failed in the Replay summary, requests lost in between as timeouts
+# Usage: tools/hot_restart_test.sh [--udp] [--rate <requests/sec>] [--seconds <n>] [--restarts <n>] [--gap <ms>] (port 13000 must be free)
+#        BIN=<dir> runs the binaries from <dir> instead of compiled/
+cd "$(dirname "$0")/.." || exit 1
+BIN=${BIN:-compiled}
+
+SERVER_NAME=TCPServer # Server under test
+RATE=2000             # Requests per second offered by Replay
+SECONDS_RUN=6         # Length of each run
+RESTARTS=3            # Restarts spread over the run
+REQUESTS=200          # Distinct quotes recorded
+TIMEOUT=1000          # Replay --timeout in milliseconds
+GAP_MS=100            # Cold restarts: time between killing the old server and starting the new one
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --udp) SERVER_NAME=UDPServer ;;
+        --rate) RATE="$2"; shift ;;
+        --seconds) SECONDS_RUN="$2"; shift ;;
+        --restarts) RESTARTS="$2"; shift ;;
+        --gap) GAP_MS="$2"; shift ;;
+        *) echo "Usage: $0 [--udp] [--rate <requests/sec>] [--seconds <n>] [--restarts <n>] [--gap <ms>]"; exit 1 ;;
+    esac
+    shift
+done
+for binary in "$BIN/$SERVER_NAME" "$BIN/Replay"; do
+    [ -x "$binary" ] || { echo "$binary is missing, see How to Compile Binaries"; exit 1; }
+done
+
+WORK=$(mktemp -d)
+SERVER=""
+trap '[ -n "$SERVER" ] && kill $SERVER 2>/dev/null; rm -rf "$WORK"' EXIT
+
+start_server() # <args>...
+{
+    "$BIN/$SERVER_NAME" "$@" >>"$WORK/server.log" 2>&1 &
+    SERVER=$!
+    sleep 0.5
+}
+
+stop_server()
+{
+    kill $SERVER 2>/dev/null
+    wait $SERVER 2>/dev/null
+    SERVER=""
+}
+
+# One quote, on its own connection (TCP) or socket (UDP) like the clients
+send_quote()
+{
+    local message="$((RANDOM % 900 + 100)),000 $((RANDOM % 3 == 0 ? 15 : 30)) $((RANDOM % 5 + 3)).$((RANDOM % 100))%"
+    if [ "$SERVER_NAME" = TCPServer ]; then
+        exec 3<>/dev/tcp/127.0.0.1/13000 || return 1
+        printf '%s\n' "$message" >&3
+        cat <&3 >/dev/null
+    else
+        exec 3<>/dev/udp/127.0.0.1/13000 || return 1
+        printf '%s' "$message" >&3
+    fi
+    exec 3<&-
+}
+
+# Replay in the background for SECONDS_RUN, restarting the server RESTARTS times on the way with <mode> (none, hot or cold)
+run() # <mode>
+{
+    local recordings=()
+    for ((i = 0; i < RATE * SECONDS_RUN / REQUESTS; i++)); do
+        recordings+=("$WORK/quotes.rec")
+    done
+    : >"$WORK/server.log"
+    start_server --hot-restart
+    "$BIN/Replay" 127.0.0.1 "${recordings[@]}" --rate $RATE --max-inflight 8192 --timeout $TIMEOUT >"$WORK/replay.log" 2>&1 &
+    local replay=$!
+    local old_servers=()
+    local restarts=$([ "$1" = none ] && echo 0 || echo $RESTARTS)
+    for ((restart = 1; restart <= restarts; restart++)); do
+        sleep "$(awk "BEGIN { print $SECONDS_RUN / ($RESTARTS + 1) }")"
+        old_servers+=($SERVER)
+        case "$1" in
+            hot) start_server --hot-restart ;; # Takes the socket over, the old process drains and exits on its own
+            cold) kill $SERVER; wait $SERVER 2>/dev/null; sleep "$(awk "BEGIN { print $GAP_MS / 1000 }")"; start_server --hot-restart ;;
+        esac
+    done
+    wait $replay
+    stop_server
+    kill "${old_servers[@]}" 2>/dev/null # Only an old server that failed to drain is still running
+    sed 's/\x1b\[[0-9;]*m//g' "$WORK/replay.log" | grep -E "^ +ok|^all|^Replayed"
+    if [ "$1" = hot ]; then
+        echo "$(grep -c "Drained, exiting after hot restart" "$WORK/server.log") of $RESTARTS old servers drained and exited on their own"
+    fi
+}
+
+RANDOM=7 # Same recording on every run
+rm -f "/tmp/$SERVER_NAME.handoff"
+start_server --record "$WORK/quotes.rec"
+for ((i = 0; i < REQUESTS; i++)); do
+    send_quote
+done
+sleep 2 # The recorder writes at most one second after the last request
+stop_server
+
+for mode in none hot cold; do
+    echo "== $SERVER_NAME, $RATE requests/s for $SECONDS_RUN s, $([ $mode = none ] && echo "no restart" || echo "$RESTARTS $mode restarts")"
+    run $mode
+done
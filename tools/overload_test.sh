@@ -0,0 +1,116 @@
+#!/bin/bash
+# Goodput of the TCP server at 1x, 2x and 3x its capacity, without and with --admission
+# - Records SCENARIO requests (16 events each, a few hundred microseconds of work) through TCPServer --record, quotes are too cheap for
+#   one load generator to overload the server it shares a core with
+# - Capacity is the closed-loop goodput (Replay --speed 0), then Replay --rate offers each multiple of it open loop
+# - Prints one Replay summary per run: ok/shed/timeout counts, latency percentiles and the goodput (ok answers per second)
+# - --rate-limit <requests/sec> adds a third run per multiple with the server's token bucket instead of admission control (Replay is one
+#   client address, so everything over the limit is answered BUSY and the p99 of the rest should stay flat from 1x to 3x), the burst is
+#   50 ms worth of requests: the default one second burst lets that many requests queue at once at the start of every run
+# - With two or more CPUs Replay is pinned to the last one and the server to the others (taskset), on one CPU they share it and the
+#   load generator's own connections take part of the capacity being measured
+# Usage: tools/overload_test.sh [--copies <n>] [--workers <n>] [--honor-retry] [--rate-limit <requests/sec>] (port 13000 must be free)
+#        BIN=<dir> runs the binaries from <dir> instead of compiled/
+cd "$(dirname "$0")/.." || exit 1
+BIN=${BIN:-compiled}
+
+COPIES=90      # Times the recording is replayed per run (200 requests each)
+WORKERS=""     # --workers passed to the server
+HONOR=""       # --honor-retry passed to Replay
+RATE_LIMIT=""  # --rate-limit for the third run per multiple, none without it
+REQUESTS=200   # Distinct requests recorded
+TIMEOUT=1000   # Replay --timeout in milliseconds
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --copies) COPIES="$2"; shift ;;
+        --workers) WORKERS="--workers $2"; shift ;;
+        --honor-retry) HONOR="--honor-retry" ;;
+        --rate-limit) RATE_LIMIT="--rate-limit $2 --burst $(($2 / 20 > 0 ? $2 / 20 : 1))"; shift ;;
+        *) echo "Usage: $0 [--copies <n>] [--workers <n>] [--honor-retry] [--rate-limit <requests/sec>]"; exit 1 ;;
+    esac
+    shift
+done
+for binary in "$BIN/TCPServer" "$BIN/Replay"; do
+    [ -x "$binary" ] || { echo "$binary is missing, see How to Compile Binaries"; exit 1; }
+done
+
+PIN_SERVER=() # taskset prefix for the server
+PIN_REPLAY=() # taskset prefix for Replay
+CPUS=$(nproc)
+if [ "$CPUS" -ge 2 ] && command -v taskset >/dev/null; then
+    PIN_SERVER=(taskset -c "0-$((CPUS - 2))")
+    PIN_REPLAY=(taskset -c "$((CPUS - 1))")
+fi
+
+WORK=$(mktemp -d)
+SERVER=""
+trap '[ -n "$SERVER" ] && kill $SERVER 2>/dev/null; rm -rf "$WORK"' EXIT
+
+start_server() # <args>...
+{
+    "${PIN_SERVER[@]}" "$BIN/TCPServer" "$@" >"$WORK/server.log" 2>&1 &
+    SERVER=$!
+    sleep 0.5
+}
+
+stop_server()
+{
+    kill $SERVER 2>/dev/null
+    wait $SERVER 2>/dev/null
+    SERVER=""
+}
+
+# One request on its own connection, like the TCP client
+send_request() # <message>
+{
+    exec 3<>/dev/tcp/127.0.0.1/13000 || return 1
+    printf '%s\n' "$1" >&3
+    cat <&3 >/dev/null
+    exec 3<&-
+}
+
+scenario_message()
+{
+    local years=$((RANDOM % 3 == 0 ? 15 : RANDOM % 2 == 0 ? 20 : 30))
+    local message="SCENARIO $((RANDOM % 800 + 100))000 $years $((RANDOM % 5 + 3)).$((RANDOM % 100))"
+    for ((event = 0; event < 16; event++)); do
+        local month=$((RANDOM % (years * 12) + 1))
+        case $((RANDOM % 3)) in
+            0) message+=" extra:$((RANDOM % 20 * 50 + 50)):$month" ;;
+            1) message+=" lump:$((RANDOM % 50 + 1))000:$month" ;;
+            2) message+=" reset:$((RANDOM % 7 + 2)).$((RANDOM % 100)):$month" ;;
+        esac
+    done
+    echo "$message"
+}
+
+replay() # <pacing args>...
+{
+    local recordings=()
+    for ((i = 0; i < COPIES; i++)); do
+        recordings+=("$WORK/scenario.rec")
+    done
+    "${PIN_REPLAY[@]}" "$BIN/Replay" 127.0.0.1 "${recordings[@]}" "$@" --timeout $TIMEOUT 2>&1 | sed 's/\x1b\[[0-9;]*m//g' | grep -E "^(all|Replayed)"
+}
+
+RANDOM=7 # Same recording on every run
+start_server --record "$WORK/scenario.rec"
+for ((i = 0; i < REQUESTS; i++)); do
+    send_request "$(scenario_message)"
+done
+sleep 2 # The recorder writes at most one second after the last request
+stop_server
+
+start_server $WORKERS
+PEAK=$(replay --speed 0 --max-inflight 16 | grep -o "goodput [0-9]*" | grep -o "[0-9]*")
+stop_server
+echo "Closed-loop capacity: $PEAK ok/s ($((REQUESTS * COPIES)) SCENARIO requests, server ${WORKERS:-inline}, $([ ${#PIN_REPLAY[@]} -gt 0 ] && echo "Replay pinned to CPU $((CPUS - 1))" || echo "Replay shares the only CPU"))"
+
+for multiple in 1 2 3; do
+    for protection in "" "--admission" ${RATE_LIMIT:+"$RATE_LIMIT"}; do
+        echo "== ${multiple}x ($((PEAK * multiple)) requests/s) ${protection:-without admission} $HONOR"
+        start_server $WORKERS $protection
+        replay --rate $((PEAK * multiple)) --max-inflight 8192 $HONOR
+        stop_server
+    done
+done
@@ -0,0 +1,152 @@
+#!/bin/bash
+# Latency of active TCP clients while hundreds of slow ones hold connections, and the deadlines that close the slow ones
+# - Records quotes through --record, then Replay --rate sends them twice for --seconds: alone (baseline) and while --idle connections
+#   send nothing and --trickle connections send one byte of a request every 200 ms without ever finishing it
+# - When the load stops half of the tricklers go silent (read deadline, the bytes they sent are answered), the other half keep trickling
+#   until the request deadline, the idle ones run into the idle deadline
+# - Prints both Replay summaries and the p99 ratio, then checks the totals of the last [WARNING] Connection expired line against the
+#   connections opened (idle, read, write and request expiries)
+# Usage: tools/slow_client_test.sh [--idle <n>] [--trickle <n>] [--rate <requests/sec>] [--seconds <n>] (port 13000 must be free)
+#        BIN=<dir> runs the binaries from <dir> instead of compiled/
+cd "$(dirname "$0")/.." || exit 1
+BIN=${BIN:-compiled}
+
+IDLE=500      # Connections that never send a byte
+TRICKLE=50    # Connections that send one byte every 200 ms
+RATE=2000     # Quotes per second offered by Replay
+SECONDS_RUN=5 # Length of each run
+REQUESTS=200  # Distinct quotes recorded
+TIMEOUT=1000  # Replay --timeout in milliseconds
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --idle) IDLE="$2"; shift ;;
+        --trickle) TRICKLE="$2"; shift ;;
+        --rate) RATE="$2"; shift ;;
+        --seconds) SECONDS_RUN="$2"; shift ;;
+        *) echo "Usage: $0 [--idle <n>] [--trickle <n>] [--rate <requests/sec>] [--seconds <n>]"; exit 1 ;;
+    esac
+    shift
+done
+for binary in "$BIN/TCPServer" "$BIN/Replay"; do
+    [ -x "$binary" ] || { echo "$binary is missing, see How to Compile Binaries"; exit 1; }
+done
+
+# Deadlines outlast the run so the slow connections are open the whole time, then expire one kind after the other
+IDLE_MS=$(((SECONDS_RUN + 2) * 1000))    # Idle connections close 2 s after the run
+READ_MS=2000                             # Silent tricklers close 2 s after the run
+REQUEST_MS=$(((SECONDS_RUN + 4) * 1000)) # The other tricklers close 4 s after they connected
+DEADLINES="--idle-timeout $IDLE_MS --read-timeout $READ_MS --request-timeout $REQUEST_MS"
+
+WORK=$(mktemp -d)
+SERVER=""
+SLOW=()
+trap '[ -n "$SERVER" ] && kill $SERVER 2>/dev/null; [ ${#SLOW[@]} -gt 0 ] && kill "${SLOW[@]}" 2>/dev/null; rm -rf "$WORK"' EXIT
+
+start_server() # <args>...
+{
+    "$BIN/TCPServer" "$@" >"$WORK/server.log" 2>&1 &
+    SERVER=$!
+    sleep 0.5
+}
+
+stop_server()
+{
+    kill $SERVER 2>/dev/null
+    wait $SERVER 2>/dev/null
+    SERVER=""
+}
+
+# One quote on its own connection, like the TCP client
+send_quote()
+{
+    exec 3<>/dev/tcp/127.0.0.1/13000 || return 1
+    printf '%s\n' "$((RANDOM % 900 + 100)),000 $((RANDOM % 3 == 0 ? 15 : 30)) $((RANDOM % 5 + 3)).$((RANDOM % 100))%" >&3
+    cat <&3 >/dev/null
+    exec 3<&-
+}
+
+# <n> connections that send nothing until the server closes them
+open_idle() # <n>
+{
+    (
+        for ((i = 0; i < $1; i++)); do
+            exec {fd}<>/dev/tcp/127.0.0.1/13000 || exit 1
+        done
+        sleep infinity
+    ) &
+    SLOW+=($!)
+}
+
+# <n> connections sending one byte every 200 ms, after <ticks> the first half goes silent and the rest keeps trickling
+open_trickle() # <n> <ticks>
+{
+    (
+        trap '' PIPE # The server closing a connection must not end the others
+        fds=()
+        for ((i = 0; i < $1; i++)); do
+            exec {fd}<>/dev/tcp/127.0.0.1/13000 || exit 1
+            fds+=($fd)
+        done
+        for ((tick = 0; ; tick++)); do
+            for ((i = tick < $2 ? 0 : $1 / 2; i < $1; i++)); do
+                printf 'x' >&"${fds[i]}" 2>/dev/null # A letter first, an unterminated quote (digit first) would be answered right away
+            done
+            sleep 0.2
+        done
+    ) &
+    SLOW+=($!)
+}
+
+replay()
+{
+    local recordings=()
+    for ((i = 0; i < RATE * SECONDS_RUN / REQUESTS; i++)); do
+        recordings+=("$WORK/quotes.rec")
+    done
+    "$BIN/Replay" 127.0.0.1 "${recordings[@]}" --rate $RATE --max-inflight 8192 --timeout $TIMEOUT 2>&1 | sed 's/\x1b\[[0-9;]*m//g' | grep -E "^(all|Replayed)"
+}
+
+p99() # <replay output>
+{
+    echo "$1" | awk '/^all/ { print $9 }'
+}
+
+RANDOM=7 # Same recording on every run
+start_server --record "$WORK/quotes.rec"
+for ((i = 0; i < REQUESTS; i++)); do
+    send_quote
+done
+sleep 2 # The recorder writes at most one second after the last request
+stop_server
+
+echo "== Baseline: $RATE quotes/s for $SECONDS_RUN s ($DEADLINES)"
+start_server $DEADLINES
+BASELINE=$(replay)
+echo "$BASELINE"
+stop_server
+
+echo "== Same load with $IDLE idle and $TRICKLE trickling connections"
+start_server $DEADLINES
+open_idle "$IDLE"
+open_trickle "$TRICKLE" $((SECONDS_RUN * 5))
+sleep 1 # Every slow connection is open before the load starts
+OPENED_AT=$(date +%s)
+SLOWED=$(replay)
+echo "$SLOWED"
+echo "p99 $(p99 "$BASELINE") ms -> $(p99 "$SLOWED") ms ($(awk "BEGIN { printf \"%.2fx\", $(p99 "$SLOWED") / $(p99 "$BASELINE") }"))"
+
+sleep $((OPENED_AT + REQUEST_MS / 1000 + 2 - $(date +%s))) # Past every deadline
+kill "${SLOW[@]}" 2>/dev/null
+wait "${SLOW[@]}" 2>/dev/null
+SLOW=()
+stop_server
+
+LAST=$(grep -a "Connection expired" "$WORK/server.log" | tail -n 1 | sed 's/\x1b\[[0-9;]*m//g')
+EXPECTED="idle: $IDLE, read: $((TRICKLE / 2)), write: 0, request: $((TRICKLE - TRICKLE / 2))"
+echo "Expected expiries: $EXPECTED"
+echo "Logged:            $(echo "$LAST" | grep -o "idle: .*request: [0-9]*")"
+if [ "$(echo "$LAST" | grep -o "idle: .*request: [0-9]*")" != "$EXPECTED" ]; then
+    echo "FAILED"
+    exit 1
+fi
+echo "Every slow connection was closed by its deadline"